@@ -0,0 +1,54 @@
+#ifndef ALLOC_COUNTER_HPP
+#define ALLOC_COUNTER_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+
+
+// counts every call to the global operator new, to check that the render path doesn't allocate.
+// it is compiled out unless MANDEL_COUNT_ALLOCATIONS is defined (cmake -DCOUNT_ALLOCATIONS=ON), and since it replaces
+// the global operator new it has to be included by a single translation unit, the one with main() in it
+#ifdef MANDEL_COUNT_ALLOCATIONS
+inline constexpr auto allocation_counting_enabled = true;
+
+inline auto allocation_counter = std::atomic<std::uint64_t>{0};
+
+void * operator new(std::size_t size)
+{
+    allocation_counter.fetch_add(1, std::memory_order_relaxed);
+    if ( auto * p = std::malloc(size > 0 ? size : 1) ) { return p; }
+    throw std::bad_alloc{};
+}
+
+void * operator new(std::size_t size, std::align_val_t align)
+{
+    allocation_counter.fetch_add(1, std::memory_order_relaxed);
+    // aligned_alloc wants a multiple of the alignment
+    const auto alignment = static_cast<std::size_t>(align);
+    const auto rounded = (std::max<std::size_t>(size, 1) + alignment - 1) / alignment * alignment;
+    if ( auto * p = std::aligned_alloc(alignment, rounded) ) { return p; }
+    throw std::bad_alloc{};
+}
+
+void operator delete(void * p) noexcept { std::free(p); }
+void operator delete(void * p, std::size_t) noexcept { std::free(p); }
+void operator delete(void * p, std::align_val_t) noexcept { std::free(p); }
+void operator delete(void * p, std::size_t, std::align_val_t) noexcept { std::free(p); }
+#else
+inline constexpr auto allocation_counting_enabled = false;
+#endif
+
+// how many allocations so far, always 0 when they are not counted
+inline auto allocations() noexcept -> std::uint64_t
+{
+#ifdef MANDEL_COUNT_ALLOCATIONS
+    return allocation_counter.load(std::memory_order_relaxed);
+#else
+    return 0;
+#endif
+}
+
+#endif
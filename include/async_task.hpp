@@ -0,0 +1,247 @@
+#ifndef ASYNC_TASK_HPP
+#define ASYNC_TASK_HPP
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <coroutine>
+#include <cstddef>
+#include <exception>
+#include <latch>
+#include <mutex>
+#include <new>
+#include <optional>
+#include <utility>
+
+#include "custom_locks.hpp"
+#include "task_system.hpp"
+
+
+// coroutines on top of the task system. a coroutine waiting for the workers doesn't hold a thread: it's just
+// suspended, and whichever worker finishes the last thing it waits for resumes it right there, inline. so a chain
+// of steps that each fan out on the workers, like the passes of a frame, runs without anybody blocking in between.
+//  - async_task<T> is a lazy coroutine: it starts when it's awaited, or handed to sync_wait() or spawn(),
+//  - co_await resume_on(tasks, priority) moves the rest of the coroutine to a worker,
+//  - co_await parallel_for(tasks, priority, count, f) runs f(0) ... f(count - 1) on the workers.
+// a coroutine running on a worker must never block on other tasks, sync_wait() included: with a single worker
+// nobody would be left to run them. it co_awaits them instead
+
+// where the frames of the coroutines come from: a frame renders through the same handful of them every time, so
+// instead of going back to the heap their memory waits here for the next frame. blocks of a power of two bytes, a
+// free list for each size, shared by every thread since a coroutine often ends on another worker than it started on
+class coroutine_frame_pool {
+    struct free_block {
+        free_block * next;
+    };
+
+    // 64 bytes up to 64 kB, a bigger frame goes to the heap every time
+    static constexpr auto min_shift = 6u;
+    static constexpr auto size_classes = 11u;
+
+    spin_mutex _mutex;
+    std::array<free_block *, size_classes> _free{};
+
+    static auto size_class(std::size_t size) noexcept -> unsigned {
+        return static_cast<unsigned>(std::bit_width((std::max<std::size_t>(size, 1) - 1) >> min_shift));
+    }
+
+public:
+    auto allocate(std::size_t size) -> void * {
+        const auto c = size_class(size);
+        if ( c >= size_classes ) { return ::operator new(size); }
+        {
+            auto lock = std::lock_guard{_mutex};
+            if ( auto * block = _free[c] ) {
+                _free[c] = block->next;
+                return block;
+            }
+        }
+        return ::operator new(std::size_t{1} << (c + min_shift));
+    }
+
+    // the blocks are never given back, there are only ever as many as there were coroutines at once
+    auto deallocate(void * p, std::size_t size) noexcept -> void {
+        const auto c = size_class(size);
+        if ( c >= size_classes ) {
+            ::operator delete(p);
+            return;
+        }
+        auto lock = std::lock_guard{_mutex};
+        _free[c] = ::new (p) free_block{ _free[c] };
+    }
+};
+
+inline auto coroutine_frames = coroutine_frame_pool{};
+
+struct async_promise_base {
+    // who awaits it, resumed once it's done
+    std::coroutine_handle<> continuation{};
+    // or the thread blocked in sync_wait()
+    std::latch * waiter{nullptr};
+    // or nobody at all, after spawn(): it frees itself
+    bool detached{false};
+
+    struct final_awaiter {
+        auto await_ready() noexcept -> bool { return false; }
+
+        template<typename Promise>
+        auto await_suspend(std::coroutine_handle<Promise> h) noexcept -> std::coroutine_handle<> {
+            auto & promise = h.promise();
+            if ( promise.continuation ) { return promise.continuation; }
+            // whoever waits frees the coroutine as soon as it wakes up, so nothing here is touched after that
+            if ( auto * waiter = promise.waiter ) { waiter->count_down(); }
+            else if ( promise.detached ) { h.destroy(); }
+            return std::noop_coroutine();
+        }
+
+        auto await_resume() noexcept -> void {}
+    };
+
+    static auto operator new(std::size_t size) -> void * { return coroutine_frames.allocate(size); }
+    static auto operator delete(void * p, std::size_t size) noexcept -> void { coroutine_frames.deallocate(p, size); }
+
+    auto initial_suspend() noexcept -> std::suspend_always { return {}; }
+    auto final_suspend() noexcept -> final_awaiter { return {}; }
+    // nothing in the render path throws, and there would be nobody to hand an exception to after spawn()
+    auto unhandled_exception() noexcept -> void { std::terminate(); }
+};
+
+template<typename T>
+struct async_promise : async_promise_base {
+    std::optional<T> value;
+
+    auto return_value(T v) -> void { value.emplace(std::move(v)); }
+    auto result() -> T { return std::move(*value); }
+};
+
+template<>
+struct async_promise<void> : async_promise_base {
+    auto return_void() noexcept -> void {}
+    auto result() noexcept -> void {}
+};
+
+template<typename T = void>
+class [[nodiscard]] async_task {
+public:
+    struct promise_type : async_promise<T> {
+        auto get_return_object() noexcept -> async_task {
+            return async_task{ std::coroutine_handle<promise_type>::from_promise(*this) };
+        }
+    };
+
+private:
+    std::coroutine_handle<promise_type> _handle;
+
+    explicit async_task(std::coroutine_handle<promise_type> h) noexcept : _handle{h} {}
+
+    template<typename U>
+    friend auto sync_wait(async_task<U> task) -> U;
+    friend auto spawn(async_task<void> task) -> void;
+
+public:
+    async_task(async_task && other) noexcept : _handle{std::exchange(other._handle, {})} {}
+    async_task(async_task const &) = delete;
+    auto operator=(async_task &&) -> async_task & = delete;
+    auto operator=(async_task const &) -> async_task & = delete;
+
+    ~async_task() {
+        if ( _handle ) { _handle.destroy(); }
+    }
+
+    // starts it, and resumes the awaiting coroutine with its result once it's done
+    auto operator co_await() && noexcept {
+        struct awaiter {
+            std::coroutine_handle<promise_type> handle;
+
+            auto await_ready() noexcept -> bool { return false; }
+            auto await_suspend(std::coroutine_handle<> h) noexcept -> std::coroutine_handle<> {
+                handle.promise().continuation = h;
+                return handle;
+            }
+            auto await_resume() -> T { return handle.promise().result(); }
+        };
+        return awaiter{ _handle };
+    }
+};
+
+// runs it and blocks the calling thread until it's done. for the threads outside the task system only, see above
+template<typename T>
+auto sync_wait(async_task<T> task) -> T
+{
+    auto done = std::latch{1};
+    task._handle.promise().waiter = &done;
+    task._handle.resume();
+    done.wait();
+    return task._handle.promise().result();
+}
+
+// starts it and forgets about it, it frees itself once it's done
+inline auto spawn(async_task<void> task) -> void
+{
+    auto h = std::exchange(task._handle, {});
+    h.promise().detached = true;
+    h.resume();
+}
+
+// the rest of the coroutine goes on as a task, in the class given
+inline auto resume_on(task_system & tasks, task_priority priority) noexcept
+{
+    struct awaiter {
+        task_system & tasks;
+        task_priority priority;
+
+        auto await_ready() noexcept -> bool { return false; }
+        auto await_suspend(std::coroutine_handle<> h) noexcept -> void {
+            tasks.submit(priority, [ h ] { h.resume(); });
+        }
+        auto await_resume() noexcept -> void {}
+    };
+    return awaiter{ tasks, priority };
+}
+
+template<typename F>
+class parallel_for_awaiter {
+    task_system & _tasks;
+    const task_priority _priority;
+    const int _count;
+    F _f;
+    // the tasks still running, plus one for await_suspend() itself, so that whoever gets it to 0 resumes the
+    // coroutine, even if all of them were done before the last one was even queued
+    std::atomic<int> _left{0};
+    std::coroutine_handle<> _continuation{};
+
+    auto finish_one() noexcept -> bool { return _left.fetch_sub(1, std::memory_order_acq_rel) == 1; }
+
+public:
+    parallel_for_awaiter(task_system & tasks, task_priority priority, int count, F && f)
+        : _tasks{tasks}, _priority{priority}, _count{count}, _f{std::forward<F>(f)} {}
+
+    auto await_ready() const noexcept -> bool { return _count <= 0; }
+
+    // false resumes the coroutine right away, on this thread
+    auto await_suspend(std::coroutine_handle<> h) noexcept -> bool {
+        _continuation = h;
+        _left.store(_count + 1, std::memory_order_relaxed);
+        for ( auto k{0}; k < _count; ++k ) {
+            _tasks.submit(_priority, [ this ] ( int n ) {
+                _f(n);
+                // the awaiter lives in the frame of the coroutine, which may be gone as soon as it's resumed
+                if ( finish_one() ) { _continuation.resume(); }
+            }, k);
+        }
+        return !finish_one();
+    }
+
+    auto await_resume() noexcept -> void {}
+};
+
+// f(0) ... f(count - 1), each as a task in the class given. the coroutine goes on once all of them are done, on the
+// worker that ran the last one
+template<typename F>
+auto parallel_for(task_system & tasks, task_priority priority, int count, F && f) -> parallel_for_awaiter<F>
+{
+    return { tasks, priority, count, std::forward<F>(f) };
+}
+
+#endif
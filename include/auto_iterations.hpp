@@ -0,0 +1,93 @@
+#ifndef AUTO_ITERATIONS_HPP
+#define AUTO_ITERATIONS_HPP
+
+#include <immintrin.h>
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <vector>
+
+#include "async_task.hpp"
+#include "mandel_kernel.hpp"
+#include "task_system.hpp"
+
+
+// the iteration limit a view needs, picked per frame instead of by hand. too low and the points just outside the set
+// come out black like the inside, too high and the points inside pay for iterations that change nothing.
+// a probe at a tiny fraction of the resolution, about 4096 points spread over the view, is run with a generous limit,
+// and its escape counts say how many points would still go from black to colored past any given limit: the limit
+// picked is the lowest past which that's only a couple of the probed points. when too many of them still escape in
+// the last doubling before the probe's own limit, the tail hasn't flattened out yet and the probe runs again with 4
+// times as much.
+// the probe starts from a limit that grows with the depth of the zoom, and it's cheap: the points that escape early
+// stop early, and the interior detection stops most of the ones inside
+
+constexpr auto probe_points = 4096;
+// of the probed points, the most that may still change past the limit picked. about 2 of them
+constexpr auto probe_tolerance = 1. / 2000;
+constexpr auto min_auto_iter = 64;
+constexpr auto max_auto_iter = 1 << 22;
+
+// where the probe of a view starts, 2048 for the whole set plus 1024 per doubling of the zoom
+inline auto probe_limit(viewport const & view) noexcept -> int
+{
+    const auto zoom = std::max(1., 3. / (view.max_re - view.min_re));
+    return static_cast<int>(std::min(static_cast<double>(max_auto_iter), 2048. + 1024. * std::log2(zoom)));
+}
+
+// the escape counts of a grid of columns x rows points over the view, `limit` for the ones that didn't escape
+inline auto probe_escapes(task_system & tasks, viewport const & view, render_settings settings, int limit,
+                          int columns, int rows, std::vector<float> & escapes) -> async_task<>
+{
+    settings.max_iter = limit;
+    // only the counts matter: the shading would just cost more, and the interior detection makes the inside cheap
+    settings.distance_estimation = false;
+    settings.interior_detection = true;
+    escapes.resize(static_cast<std::size_t>(columns) * static_cast<std::size_t>(rows));
+    const auto re_step = (view.max_re - view.min_re) / columns;
+    const auto im_step = (view.max_im - view.min_im) / rows;
+    co_await parallel_for(tasks, task_priority::interactive, rows, [ & ] ( int y ) {
+        const auto _i_0 = _mm512_set1_pd(view.min_im + im_step * (y + 0.5));
+        for ( auto x{0}; x < columns; x += 8 ) {
+            const auto _x = _mm512_set_pd(7.5, 6.5, 5.5, 4.5, 3.5, 2.5, 1.5, 0.5) + _mm512_set1_pd(x);
+            const auto _r_0 = _mm512_fmadd_pd(_mm512_set1_pd(re_step), _x, _mm512_set1_pd(view.min_re));
+            const auto s = sample(settings, _r_0, _i_0, re_step);
+            _mm256_storeu_ps(escapes.data() + static_cast<std::size_t>(y) * static_cast<std::size_t>(columns) + x,
+                             s.iters);
+        }
+    });
+}
+
+// a limit for rendering `view` at width x height with `settings`, whatever its max_iter says
+inline auto estimate_max_iter(task_system & tasks, viewport view, render_settings settings, std::size_t width,
+                              std::size_t height) -> async_task<int>
+{
+    // the probe keeps the aspect of the frame, in whole groups of 8 columns
+    const auto aspect = static_cast<double>(std::max<std::size_t>(width, 1))
+                        / static_cast<double>(std::max<std::size_t>(height, 1));
+    const auto columns = std::clamp(static_cast<int>(std::lround(std::sqrt(probe_points * aspect) / 8)) * 8, 8,
+                                    probe_points / 8);
+    const auto rows = std::max(1, probe_points / columns);
+    const auto allowed = static_cast<std::size_t>(probe_points * probe_tolerance);
+    auto escapes = std::vector<float>{};
+    auto limit = probe_limit(view);
+    while ( true ) {
+        co_await probe_escapes(tasks, view, settings, limit, columns, rows, escapes);
+        // the points that escaped, in order. the others are inside, or would need more than the probe gave them
+        const auto flimit = static_cast<float>(limit);
+        const auto inside = std::partition(escapes.begin(), escapes.end(), [ & ] ( float e ) { return e < flimit; });
+        const auto escaped = static_cast<std::size_t>(inside - escapes.begin());
+        std::sort(escapes.begin(), inside);
+        const auto late = static_cast<std::size_t>(inside - std::lower_bound(escapes.begin(), inside, flimit / 2));
+        if ( late > allowed && limit < max_auto_iter ) {
+            limit = std::min(max_auto_iter, limit * 4);
+            continue;
+        }
+        // the lowest limit past which no more than `allowed` of them escape, plus a quarter: the pixels between
+        // the probed points are not going to be any easier
+        const auto needed = escaped > allowed ? escapes[escaped - allowed - 1] + 1.f : 0.f;
+        co_return std::clamp(static_cast<int>(needed * 1.25f), min_auto_iter, limit);
+    }
+}
+
+#endif
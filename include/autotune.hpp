@@ -0,0 +1,164 @@
+#ifndef AUTOTUNE_HPP
+#define AUTOTUNE_HPP
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <limits>
+#include <optional>
+#include <string>
+#include <thread>
+
+#include "fmt/core.h"
+#include "cli.hpp"
+#include "disk_cache.hpp"
+#include "mandel_kernel.hpp"
+#include "task_system.hpp"
+
+
+// the scheduling that renders fastest on this machine. what's best differs a lot between hosts: how much the cores
+// slow down when all of them run 512 bit code, whether the second thread of a core helps the escape loop or just
+// fights over its vector units, how much a task costs next to a line. so instead of guessing, the first start on a
+// host times a few candidates on two representative views, and keeps the winner in a file for the next ones.
+struct tuned_setup {
+    unsigned threads{std::max(1u, std::thread::hardware_concurrency())};
+    // how many consecutive lines a single task renders
+    int lines_per_task{1};
+};
+
+// what the tuning depends on: the machine, and the build, since a binary compiled for another -march may do better
+// with something else. a tuning file with another signature is stale
+inline auto host_signature() -> std::string
+{
+    auto host = std::array<char, 256>{};
+    if ( ::gethostname(host.data(), host.size() - 1) != 0 ) { host[0] = '\0'; }
+    auto cpu = std::string{};
+    auto cpuinfo = std::ifstream("/proc/cpuinfo");
+    for ( auto line = std::string{}; std::getline(cpuinfo, line); ) {
+        if ( line.starts_with("model name") ) {
+            cpu = line.substr(std::min(line.find(':') + 2, line.size()));
+            break;
+        }
+    }
+    return fmt::format("{}|{}|{} threads|{} {}", host.data(), cpu, std::thread::hardware_concurrency(),
+                       __VERSION__, __DATE__);
+}
+
+// one file per host, so that a home directory shared between machines keeps every one of them tuned
+inline auto tuning_path() -> std::filesystem::path
+{
+    auto host = std::array<char, 256>{};
+    if ( ::gethostname(host.data(), host.size() - 1) != 0 || host[0] == '\0' ) {
+        return default_cache_dir() / "tuning";
+    }
+    return default_cache_dir() / fmt::format("tuning-{}", host.data());
+}
+
+// the file is a few `name value` lines, the signature first
+inline auto load_tuning(std::filesystem::path const & path, std::string const & signature)
+    -> std::optional<tuned_setup>
+{
+    auto in = std::ifstream(path);
+    auto line = std::string{};
+    if ( !std::getline(in, line) || line != "signature " + signature ) { return std::nullopt; }
+    auto setup = tuned_setup{};
+    auto name = std::string{};
+    if ( !(in >> name >> setup.threads) || name != "threads" ) { return std::nullopt; }
+    if ( !(in >> name >> setup.lines_per_task) || name != "lines_per_task" ) { return std::nullopt; }
+    if ( setup.threads < 1 || setup.lines_per_task < 1 ) { return std::nullopt; }
+    return setup;
+}
+
+// false if it couldn't be written, the next start will just calibrate again
+inline auto save_tuning(std::filesystem::path const & path, std::string const & signature, tuned_setup const & setup)
+    -> bool
+{
+    auto ec = std::error_code{};
+    std::filesystem::create_directories(path.parent_path(), ec);
+    auto out = std::ofstream(path, std::ios::trunc);
+    out << "signature " << signature << "\nthreads " << setup.threads
+        << "\nlines_per_task " << setup.lines_per_task << '\n';
+    return static_cast<bool>(out);
+}
+
+// the seconds the calibration views take with that setup, the best of a few runs each
+inline auto time_setup(tuned_setup const & setup) -> double
+{
+    // the whole set, mostly cheap lines, and a deep valley with lots of detail, mostly expensive ones. with the
+    // adaptive AA of the gui, so the scattered work of the refinement is part of it
+    constexpr auto views = std::array{
+        viewport{ -2.0, 1.0, -1.5, 1.5 },
+        viewport{ -0.7450669, -0.7420669, 0.1299023, 0.1329023 },
+    };
+    constexpr auto size = 256;
+    constexpr auto reps = 3;
+    auto settings = render_settings{ 1000, 1, 8 };
+    auto tasks = task_system(setup.threads);
+    auto frame = render_frame(size, size);
+    auto total = 0.;
+    for ( auto const & view : views ) {
+        auto best = std::numeric_limits<double>::max();
+        for ( auto r{0}; r < reps; ++r ) {
+            const auto start = std::chrono::steady_clock::now();
+            render_blocking(tasks, frame, view, settings, setup.lines_per_task);
+            best = std::min(best, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+        }
+        total += best;
+    }
+    return total;
+}
+
+// picks the thread count first, with a line per task, then how many lines a task gets with that many threads.
+// a couple of seconds at most
+inline auto calibrate() -> tuned_setup
+{
+    const auto hardware = std::max(1u, std::thread::hardware_concurrency());
+    auto best = tuned_setup{ hardware, 1 };
+    auto best_time = time_setup(best);
+    auto consider = [ & ] ( tuned_setup const & candidate ) {
+        const auto t = time_setup(candidate);
+        fmt::print(stderr, "  {} threads, {} lines per task: {:.1f} ms\n",
+                   candidate.threads, candidate.lines_per_task, t * 1e3);
+        // a couple of percent is just noise, it has to be clearly faster
+        if ( t < best_time * 0.97 ) {
+            best = candidate;
+            best_time = t;
+        }
+    };
+    fmt::print(stderr, "calibrating for this host\n  {} threads, 1 lines per task: {:.1f} ms\n",
+               hardware, best_time * 1e3);
+    // all the threads, three quarters of them and one per core on the usual two way smt
+    for ( auto threads : { hardware * 3 / 4, hardware / 2 } ) {
+        if ( threads >= 1 && threads != hardware ) { consider(tuned_setup{ threads, 1 }); }
+    }
+    for ( auto lines : { 2, 4, 8 } ) { consider(tuned_setup{ best.threads, lines }); }
+    return best;
+}
+
+// the setup for this run: the tuning file of this host, or a fresh calibration if there is none or it's stale.
+// --retune calibrates anyway, --no-autotune skips all of it, --threads N and --lines-per-task N override the result
+inline auto tuned_setup_from(cli_args const & args) -> tuned_setup
+{
+    auto setup = tuned_setup{};
+    if ( !args.has("--no-autotune") ) {
+        const auto path = tuning_path();
+        const auto signature = host_signature();
+        auto loaded = args.has("--retune") ? std::nullopt : load_tuning(path, signature);
+        if ( loaded ) {
+            setup = *loaded;
+        } else {
+            setup = calibrate();
+            if ( save_tuning(path, signature, setup) ) { fmt::print(stderr, "tuning saved to {}\n", path.string()); }
+        }
+    }
+    setup.threads = static_cast<unsigned>(std::max(1, args.get("--threads", static_cast<int>(setup.threads))));
+    setup.lines_per_task = std::max(1, args.get("--lines-per-task", setup.lines_per_task));
+    fmt::print(stderr, "{} threads, {} lines per task\n", setup.threads, setup.lines_per_task);
+    return setup;
+}
+
+#endif
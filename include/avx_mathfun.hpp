@@ -1,5 +1,6 @@
 /*
  *** changed all C-casts to C++ casts to make the compiler happy ***
+ *** added the AVX-512 functions at the bottom, for 16 floats and 8 doubles ***
    AVX implementation of sin, cos, sincos, exp and log
 
    Based on "sse_mathfun.h", by Julien Pommier
@@ -30,7 +31,13 @@
   (this is the zlib license)
 */
 
+#ifndef AVX_MATHFUN_HPP
+#define AVX_MATHFUN_HPP
+
 #include <immintrin.h>
+#include <cfloat>
+#include <cmath>
+#include <initializer_list>
 
 /* yes I know, the top of this file is quite ugly */
 # define ALIGN32_BEG
@@ -719,3 +726,189 @@ void sincos256_ps(v8sf x, v8sf *s, v8sf *c) {
     *s = _mm256_xor_ps(xmm1, sign_bit_sin);
     *c = _mm256_xor_ps(xmm2, sign_bit_cos);
 }
+
+
+/* AVX-512 versions, 16 floats or 8 doubles at once, written for this project.
+   they don't port the cephes code above, the mask registers and getexp/getmant/scalef make most of its tricks
+   unnecessary: the argument is split in exponent and mantissa, or reduced by multiples of ln2 or pi/2 (split in
+   parts, with fma), and what is left goes through a short polynomial.
+   the error bounds below are the largest errors measured against the long double libm over a few million
+   arguments spread over the whole range given, in units in the last place of the result:
+     log512_ps, log512_pd    any x, 1 ulp. x < 0 and nan give nan, 0 gives -inf, inf gives inf
+     exp512_ps, exp512_pd    any x, 1 ulp. overflows to inf and underflows to 0, through the denormals
+     sin512_ps, cos512_ps    |x| < 8192, 1.5 ulp of max(|result|, 2^-24), the same range as sin256_ps above.
+                             past that they slowly lose precision, but stay in [-1, 1]
+     sin512_pd, cos512_pd    |x| < 2^30, 2 ulp of max(|result|, 2^-53). past that the quadrant doesn't fit an int
+*/
+
+/* the mantissa of x in [0.75, 1.5) and the matching exponent, so that x = m * 2^e */
+inline auto split512_ps(__m512 x, __m512 & e) noexcept -> __m512 {
+    const auto m = _mm512_getmant_ps(x, _MM_MANT_NORM_p75_1p5, _MM_MANT_SIGN_zero);
+    e = _mm512_getexp_ps(x);
+    /* the mantissas in [1.5, 2) come out halved */
+    e = _mm512_mask_add_ps(e, _mm512_cmp_ps_mask(m, _mm512_set1_ps(1.f), _CMP_LT_OQ), e, _mm512_set1_ps(1.f));
+    return m;
+}
+
+inline auto split512_pd(__m512d x, __m512d & e) noexcept -> __m512d {
+    const auto m = _mm512_getmant_pd(x, _MM_MANT_NORM_p75_1p5, _MM_MANT_SIGN_zero);
+    e = _mm512_getexp_pd(x);
+    e = _mm512_mask_add_pd(e, _mm512_cmp_pd_mask(m, _mm512_set1_pd(1.), _CMP_LT_OQ), e, _mm512_set1_pd(1.));
+    return m;
+}
+
+/* natural logarithm: ln x = e ln2 + ln(1 + f), with f = m - 1 in [-1/4, 1/2).
+   ln(1 + f) = 2 atanh(s) with s = f / (2 + f) in [-1/7, 1/5], which is odd in s and converges in a handful of terms.
+   it's summed as f - (f^2/2 - s (f^2/2 + R)), like fdlibm does, so that near 1 the big terms cancel exactly */
+inline auto log512_ps(__m512 x) noexcept -> __m512 {
+    auto e = __m512{};
+    const auto f = _mm512_sub_ps(split512_ps(x, e), _mm512_set1_ps(1.f));
+    const auto s = _mm512_div_ps(f, _mm512_add_ps(f, _mm512_set1_ps(2.f)));
+    const auto s2 = _mm512_mul_ps(s, s);
+    auto r = _mm512_set1_ps(2.f / 9);
+    r = _mm512_fmadd_ps(r, s2, _mm512_set1_ps(2.f / 7));
+    r = _mm512_fmadd_ps(r, s2, _mm512_set1_ps(2.f / 5));
+    r = _mm512_fmadd_ps(r, s2, _mm512_set1_ps(2.f / 3));
+    r = _mm512_mul_ps(r, s2);
+    const auto hfsq = _mm512_mul_ps(_mm512_set1_ps(0.5f), _mm512_mul_ps(f, f));
+    /* ln2 in two parts, the first one times e is exact */
+    auto y = _mm512_fmadd_ps(s, _mm512_add_ps(hfsq, r), _mm512_mul_ps(e, _mm512_set1_ps(-2.12194440e-4f)));
+    y = _mm512_sub_ps(f, _mm512_sub_ps(hfsq, y));
+    y = _mm512_fmadd_ps(e, _mm512_set1_ps(0.693359375f), y);
+    /* 0 and inf come out of getexp as -inf and inf already, the negative numbers have to be fixed up */
+    y = _mm512_mask_mov_ps(y, _mm512_cmp_ps_mask(x, _mm512_setzero_ps(), _CMP_EQ_OQ), _mm512_set1_ps(-INFINITY));
+    y = _mm512_mask_mov_ps(y, _mm512_cmp_ps_mask(x, _mm512_set1_ps(INFINITY), _CMP_EQ_OQ), x);
+    return _mm512_mask_mov_ps(y, _mm512_cmp_ps_mask(x, _mm512_setzero_ps(), _CMP_NGE_UQ), _mm512_set1_ps(NAN));
+}
+
+inline auto log512_pd(__m512d x) noexcept -> __m512d {
+    auto e = __m512d{};
+    const auto f = _mm512_sub_pd(split512_pd(x, e), _mm512_set1_pd(1.));
+    const auto s = _mm512_div_pd(f, _mm512_add_pd(f, _mm512_set1_pd(2.)));
+    const auto s2 = _mm512_mul_pd(s, s);
+    auto r = _mm512_set1_pd(2. / 23);
+    for ( auto k : { 21., 19., 17., 15., 13., 11., 9., 7., 5., 3. } ) {
+        r = _mm512_fmadd_pd(r, s2, _mm512_set1_pd(2. / k));
+    }
+    r = _mm512_mul_pd(r, s2);
+    const auto hfsq = _mm512_mul_pd(_mm512_set1_pd(0.5), _mm512_mul_pd(f, f));
+    auto y = _mm512_fmadd_pd(s, _mm512_add_pd(hfsq, r), _mm512_mul_pd(e, _mm512_set1_pd(1.9082149292705877000e-10)));
+    y = _mm512_sub_pd(f, _mm512_sub_pd(hfsq, y));
+    y = _mm512_fmadd_pd(e, _mm512_set1_pd(6.9314718036912381649e-01), y);
+    y = _mm512_mask_mov_pd(y, _mm512_cmp_pd_mask(x, _mm512_setzero_pd(), _CMP_EQ_OQ), _mm512_set1_pd(-INFINITY));
+    y = _mm512_mask_mov_pd(y, _mm512_cmp_pd_mask(x, _mm512_set1_pd(INFINITY), _CMP_EQ_OQ), x);
+    return _mm512_mask_mov_pd(y, _mm512_cmp_pd_mask(x, _mm512_setzero_pd(), _CMP_NGE_UQ), _mm512_set1_pd(NAN));
+}
+
+/* exp x = 2^n exp r, with n the integer closest to x / ln2 and |r| <= ln2 / 2. scalef does the 2^n, overflow and
+   underflow included, so x only has to be kept finite for r to make sense. nan goes through the min and max */
+inline auto exp512_ps(__m512 x) noexcept -> __m512 {
+    x = _mm512_max_ps(_mm512_set1_ps(-200.f), _mm512_min_ps(_mm512_set1_ps(200.f), x));
+    const auto n = _mm512_roundscale_ps(_mm512_mul_ps(x, _mm512_set1_ps(1.44269504088896341f)),
+                                        _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+    auto r = _mm512_fnmadd_ps(n, _mm512_set1_ps(0.693359375f), x);
+    r = _mm512_fnmadd_ps(n, _mm512_set1_ps(-2.12194440e-4f), r);
+    auto p = _mm512_set1_ps(1.f / 5040);
+    for ( auto k : { 720.f, 120.f, 24.f, 6.f, 2.f, 1.f, 1.f } ) {
+        p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(1.f / k));
+    }
+    return _mm512_scalef_ps(p, n);
+}
+
+inline auto exp512_pd(__m512d x) noexcept -> __m512d {
+    x = _mm512_max_pd(_mm512_set1_pd(-1500.), _mm512_min_pd(_mm512_set1_pd(1500.), x));
+    const auto n = _mm512_roundscale_pd(_mm512_mul_pd(x, _mm512_set1_pd(1.4426950408889634074)),
+                                        _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+    auto r = _mm512_fnmadd_pd(n, _mm512_set1_pd(6.9314718036912381649e-01), x);
+    r = _mm512_fnmadd_pd(n, _mm512_set1_pd(1.9082149292705877000e-10), r);
+    /* the taylor series up to r^13 / 13! */
+    auto p = _mm512_set1_pd(1. / 6227020800.);
+    auto factorial = 6227020800.;
+    for ( auto k{13}; k > 0; --k ) {
+        factorial /= k;
+        p = _mm512_fmadd_pd(p, r, _mm512_set1_pd(1. / factorial));
+    }
+    return _mm512_scalef_pd(p, n);
+}
+
+/* sin and cos of r in [-pi/4, pi/4], picked by quadrant: with x = r + q pi/2, sin x is sin r, cos r, -sin r, -cos r
+   for q = 0, 1, 2, 3 and cos x is the same with q + 1 */
+inline auto sincos_quadrant512_ps(__m512 x, int offset) noexcept -> __m512 {
+    const auto n = _mm512_roundscale_ps(_mm512_mul_ps(x, _mm512_set1_ps(0.636619772367581343f)),
+                                        _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+    /* pi/2 in three parts, each the float closest to what the previous ones left out: with fma every step only rounds
+       something about as small as r itself */
+    auto r = _mm512_fnmadd_ps(n, _mm512_set1_ps(1.57079637050628662109e+00f), x);
+    r = _mm512_fnmadd_ps(n, _mm512_set1_ps(-4.37113882867379288655e-08f), r);
+    r = _mm512_fnmadd_ps(n, _mm512_set1_ps(-1.71512451000588187280e-15f), r);
+    const auto r2 = _mm512_mul_ps(r, r);
+
+    auto sin = _mm512_set1_ps(1.f / 362880);
+    sin = _mm512_fmadd_ps(sin, r2, _mm512_set1_ps(-1.f / 5040));
+    sin = _mm512_fmadd_ps(sin, r2, _mm512_set1_ps(1.f / 120));
+    sin = _mm512_fmadd_ps(sin, r2, _mm512_set1_ps(-1.f / 6));
+    sin = _mm512_fmadd_ps(_mm512_mul_ps(sin, r2), r, r);
+    auto cos = _mm512_set1_ps(1.f / 479001600);
+    cos = _mm512_fmadd_ps(cos, r2, _mm512_set1_ps(-1.f / 3628800));
+    cos = _mm512_fmadd_ps(cos, r2, _mm512_set1_ps(1.f / 40320));
+    cos = _mm512_fmadd_ps(cos, r2, _mm512_set1_ps(-1.f / 720));
+    cos = _mm512_fmadd_ps(cos, r2, _mm512_set1_ps(1.f / 24));
+    cos = _mm512_fmadd_ps(cos, r2, _mm512_set1_ps(-1.f / 2));
+    cos = _mm512_fmadd_ps(cos, r2, _mm512_set1_ps(1.f));
+
+    const auto q = _mm512_add_epi32(_mm512_cvtps_epi32(n), _mm512_set1_epi32(offset));
+    auto y = _mm512_mask_mov_ps(sin, _mm512_test_epi32_mask(q, _mm512_set1_epi32(1)), cos);
+    return _mm512_mask_sub_ps(y, _mm512_test_epi32_mask(q, _mm512_set1_epi32(2)), _mm512_setzero_ps(), y);
+}
+
+inline auto sin512_ps(__m512 x) noexcept -> __m512 { return sincos_quadrant512_ps(x, 0); }
+inline auto cos512_ps(__m512 x) noexcept -> __m512 { return sincos_quadrant512_ps(x, 1); }
+
+inline auto sincos_quadrant512_pd(__m512d x, int offset) noexcept -> __m512d {
+    const auto n = _mm512_roundscale_pd(_mm512_mul_pd(x, _mm512_set1_pd(0.63661977236758134308)),
+                                        _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+    auto r = _mm512_fnmadd_pd(n, _mm512_set1_pd(1.57079632679489655800e+00), x);
+    r = _mm512_fnmadd_pd(n, _mm512_set1_pd(6.12323399573676603587e-17), r);
+    r = _mm512_fnmadd_pd(n, _mm512_set1_pd(-1.49738490485916983294e-33), r);
+    const auto r2 = _mm512_mul_pd(r, r);
+
+    /* the taylor series of sin up to r^17 and of cos up to r^18 */
+    auto sin = _mm512_set1_pd(1. / 355687428096000.);
+    auto cos = _mm512_set1_pd(-1. / 6402373705728000.);
+    auto sin_factorial = 355687428096000.;
+    auto cos_factorial = 6402373705728000.;
+    for ( auto k{8}; k > 0; --k ) {
+        sin_factorial /= (2 * k + 1) * (2 * k);
+        cos_factorial /= (2 * k + 2) * (2 * k + 1);
+        /* r^(2k - 1) and r^2k have the opposite sign */
+        const auto sign = (k % 2) ? 1. : -1.;
+        sin = _mm512_fmadd_pd(sin, r2, _mm512_set1_pd(sign / sin_factorial));
+        cos = _mm512_fmadd_pd(cos, r2, _mm512_set1_pd(-sign / cos_factorial));
+    }
+    sin = _mm512_mul_pd(sin, r);
+    cos = _mm512_fmadd_pd(cos, r2, _mm512_set1_pd(1.));
+
+    const auto q = _mm256_add_epi32(_mm512_cvtpd_epi32(n), _mm256_set1_epi32(offset));
+    auto y = _mm512_mask_mov_pd(sin, _mm256_test_epi32_mask(q, _mm256_set1_epi32(1)), cos);
+    return _mm512_mask_sub_pd(y, _mm256_test_epi32_mask(q, _mm256_set1_epi32(2)), _mm512_setzero_pd(), y);
+}
+
+inline auto sin512_pd(__m512d x) noexcept -> __m512d { return sincos_quadrant512_pd(x, 0); }
+inline auto cos512_pd(__m512d x) noexcept -> __m512d { return sincos_quadrant512_pd(x, 1); }
+
+/* the continuous escape count of the smooth coloring, iter - log2(ln |z|^2), straight from the squared modulus the
+   escape loop already has, so without any sqrt. the kernel passes the last modulus before the bailout, not the one
+   past it: for the lanes that escaped it's still well above 1, but the ones that ran out of iterations can be
+   anywhere below the escape radius, 0 included. the inner logarithm is clamped to the smallest positive normal
+   number, so those get a big but finite count instead of a nan */
+inline auto smooth_iter512_ps(__m512 iter, __m512 sq_mod) noexcept -> __m512 {
+    const auto ln_mod = _mm512_max_ps(log512_ps(sq_mod), _mm512_set1_ps(FLT_MIN));
+    return _mm512_fnmadd_ps(log512_ps(ln_mod), _mm512_set1_ps(1.44269504088896341f), iter);
+}
+
+inline auto smooth_iter512_pd(__m512d iter, __m512d sq_mod) noexcept -> __m512d {
+    const auto ln_mod = _mm512_max_pd(log512_pd(sq_mod), _mm512_set1_pd(DBL_MIN));
+    return _mm512_fnmadd_pd(log512_pd(ln_mod), _mm512_set1_pd(1.4426950408889634074), iter);
+}
+
+#endif
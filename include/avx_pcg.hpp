@@ -2,6 +2,7 @@
 #define AVXPCG_HPP
 
 #include <immintrin.h>
+#include <bit>
 #include <cstdint>
 #include <numeric>
 #include <array>
@@ -51,11 +52,32 @@ public:
         auto t = (static_cast<uint64_t>(next(str)) << 20) | 0x3ff0000000000000ul;
         return std::bit_cast<double>(t) - 1.0f;
     }
-    // TODO jump() and long_jump(), maybe something like xorshiro256?
+    // skips the next `delta` numbers in O(log delta), with the jump ahead of the lcg from the pcg paper: a step is
+    // state * m + c, so 2^k steps are state * m^(2^k) + c (m^(2^k - 1) + ... + 1), and both get squared k times
+    inline constexpr auto advance(std::uint64_t delta) noexcept -> void {
+        auto mul = std::uint64_t{6364136223846793005ul};
+        auto add = _stream;
+        auto acc_mul = std::uint64_t{1};
+        auto acc_add = std::uint64_t{0};
+        while ( delta > 0 ) {
+            if ( delta & 1 ) {
+                acc_mul *= mul;
+                acc_add = acc_add * mul + add;
+            }
+            add = (mul + 1) * add;
+            mul *= mul;
+            delta >>= 1;
+        }
+        _state = acc_mul * _state + acc_add;
+    }
+    // 2^32 numbers ahead: a generator per thread or per tile, each jumped once more than the previous one, never
+    // overlap as long as none of them draws more than that
+    inline constexpr auto jump() noexcept -> void { advance(std::uint64_t{1} << 32); }
 };
 
 
-// TODO fix the double.
+// 8 independent pcg32 generators, one per lane, that give the same numbers the scalar one gives with the same state
+// and stream
 class avx_pcg32 {
 private:
     __m512i _state{};
@@ -67,11 +89,10 @@ private:
         _state = old_state * _mul_const + _stream;
         auto xor_shifted = _mm512_srli_epi64(old_state, 18u);
         xor_shifted = _mm512_xor_epi64(xor_shifted, old_state);
-        xor_shifted = _mm512_srli_epi64(xor_shifted, 27u);
+        // the output is 32 bits, and so is the rotation: in the low half of every lane, the high half stays 0
+        xor_shifted = _mm512_and_epi64(_mm512_srli_epi64(xor_shifted, 27u), _mm512_set1_epi64(0xffffffff));
         auto const rot = _mm512_srli_epi64(old_state, 59u);
-        auto const first = _mm512_srlv_epi64(xor_shifted, rot);
-        auto const second = _mm512_rorv_epi64(xor_shifted, -rot);
-        return _mm512_or_epi64(first, second);
+        return _mm512_rorv_epi32(xor_shifted, rot);
     }
 
 public:
@@ -85,23 +106,57 @@ public:
         advance();
     }
 
+    // the 32 bit numbers, zero extended to 64
     __attribute__ ((always_inline)) auto next64() noexcept -> __m512i {
         return advance();
     }
 
     __attribute__ ((always_inline)) auto next32() noexcept -> __m256i {
-        return _mm512_castsi512_si256(advance());
+        return _mm512_cvtepi64_epi32(advance());
     }
 
+    // doubles between 0. and 1., the same as pcg32::next_d
     __attribute__ ((always_inline)) auto next_d() noexcept -> __m512d {
-        auto t = _mm512_srli_epi64(advance(), 20);
+        auto t = _mm512_slli_epi64(advance(), 20);
         t = _mm512_or_epi64(t, _mm512_set1_epi64(0x3ff0000000000000ul));
         return _mm512_sub_pd(_mm512_castsi512_pd(t), _mm512_set1_pd(1.));
     }
 
+    // floats between 0. and 1., the same as pcg32::next_f
     __attribute__ ((always_inline)) auto next_f() noexcept -> __m256 {
-        return _mm512_cvtpd_ps(next_d());
+        auto t = _mm256_srli_epi32(next32(), 9);
+        t = _mm256_or_si256(t, _mm256_set1_epi32(0x3f800000));
+        return _mm256_sub_ps(_mm256_castsi256_ps(t), _mm256_set1_ps(1.f));
     }
 };
 
+// counter based random numbers: the n-th number of a stream is just a hash of n, so any of them can be computed on
+// its own, in any order and on any thread, and always comes out the same. the samples of a pixel are numbered from
+// its coordinates in the whole picture, which is what makes a frame the same whoever renders which line of it.
+// the hash is the splitmix64 finalizer, which passes the usual statistical tests on consecutive counters.
+inline constexpr auto mix64(std::uint64_t z) noexcept -> std::uint64_t
+{
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ul;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebul;
+    return z ^ (z >> 31);
+}
+
+inline auto mix64(__m512i _z) noexcept -> __m512i
+{
+    _z = _mm512_mullo_epi64(_mm512_xor_epi64(_z, _mm512_srli_epi64(_z, 30)), _mm512_set1_epi64(0xbf58476d1ce4e5b9ul));
+    _z = _mm512_mullo_epi64(_mm512_xor_epi64(_z, _mm512_srli_epi64(_z, 27)), _mm512_set1_epi64(0x94d049bb133111ebul));
+    return _mm512_xor_epi64(_z, _mm512_srli_epi64(_z, 31));
+}
+
+// the top 53 bits of a hash as a double in [0, 1), every double of the form k / 2^53 equally likely
+inline constexpr auto to_unit(std::uint64_t bits) noexcept -> double
+{
+    return static_cast<double>(bits >> 11) * 0x1p-53;
+}
+
+inline auto to_unit(__m512i _bits) noexcept -> __m512d
+{
+    return _mm512_mul_pd(_mm512_cvtepu64_pd(_mm512_srli_epi64(_bits, 11)), _mm512_set1_pd(0x1p-53));
+}
+
 #endif
\ No newline at end of file
@@ -0,0 +1,111 @@
+#ifndef BACKGROUND_RENDER_HPP
+#define BACKGROUND_RENDER_HPP
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <optional>
+#include <stop_token>
+
+#include "fmt/core.h"
+#include "fmt/chrono.h"
+#include "async_task.hpp"
+#include "frame_pipeline.hpp"
+#include "mandel_kernel.hpp"
+#include "render_stream.hpp"
+#include "resolve.hpp"
+#include "task_system.hpp"
+
+
+// the high res renders, saved to a png and never shown. they go through the same workers as the frames on screen,
+// but as background tasks: the workers only pick a line of the export when there is nothing interactive left to do,
+// so the user can keep exploring while a big one runs, and it just goes on with whatever time the gui leaves to it.
+// one at a time, as a coroutine on the workers, see render_stream.hpp: no thread of its own, and saving the png and
+// the resolve go on as background work too, on whichever worker finished the last line
+class background_render {
+    std::stop_source _stop;
+    std::atomic<bool> _running{false};
+
+    static auto render(task_system & tasks, frame_request request, std::optional<resolve_options> resolved,
+                       std::stop_token stop) -> async_task<> {
+        const auto & view = request.view;
+        const auto & settings = request.settings;
+        const auto height = static_cast<int>(request.height);
+        // nothing else ever renders at this size, it's not worth going through the pool
+        auto frame = std::make_shared<render_frame>(request.width, request.height);
+        auto start_time = std::chrono::steady_clock::now();
+
+        // a line per task, the most expensive first, see schedule_lines. a cancelled export leaves its lines behind,
+        // they return right away and the last one frees the frame
+        auto tiles = render_tiles(tasks, frame, view, settings, tile_stream_options{ task_priority::background, 1 },
+                                  [ stop ] { return !stop.stop_requested(); });
+        auto lines = 0;
+        while ( auto tile = co_await tiles.next() ) {
+            if ( tile->pass_done ) {
+                lines = 0;
+                continue;
+            }
+            const auto step = (lines + tile->count) * 10 / height;
+            if ( step != lines * 10 / height && tile->pass != render_pass::equalize ) {
+                const auto name = tile->pass == render_pass::first ? "first pass" : "refinement";
+                fmt::print("export {}: {}%\n", name, step * 10);
+            }
+            lines += tile->count;
+        }
+        if ( !tiles.complete() ) { co_return; }
+
+        auto end_time = std::chrono::steady_clock::now();
+        fmt::print("high res render done in {}\n",
+                   std::chrono::duration_cast<std::chrono::microseconds>(end_time - start_time));
+        auto r_c = (view.max_re - view.min_re) / 2;
+        auto i_c = (view.max_im - view.min_im) / 2;
+        auto filename = fmt::format("{}_{}_{}_{}.png",
+                                    r_c, i_c, settings.max_iter, settings.colored_pic ? "color" : "bw");
+        frame->image.save_to_file(filename);
+        fmt::print("image saved with name {}\n", filename);
+        if ( resolved && !stop.stop_requested() ) {
+            const auto resolved_name = resolved_filename(filename);
+            const auto small = co_await resolve(tasks, frame->image, resolved->width, resolved->height,
+                                                resolved->filter, task_priority::background);
+            small.save_to_file(resolved_name);
+            fmt::print("{}x{} {} resolve saved with name {}\n", resolved->width, resolved->height,
+                       resolve_filter_name(resolved->filter), resolved_name);
+        }
+        fmt::print("\n");
+    }
+
+    auto run(task_system & tasks, frame_request request, std::optional<resolve_options> resolved,
+             std::stop_token stop) -> async_task<> {
+        // even allocating the frame takes a while at this size, the gui thread that started it has better things to do
+        co_await resume_on(tasks, task_priority::background);
+        co_await render(tasks, request, resolved, stop);
+        if ( stop.stop_requested() ) { fmt::print("export cancelled\n\n"); }
+        _running = false;
+        _running.notify_all();
+    }
+
+public:
+    // false if another one is still running. with `resolved`, the render is also filtered down to that size
+    // and saved next to it, see resolve.hpp
+    auto start(task_system & tasks, frame_request const & request,
+               std::optional<resolve_options> resolved = std::nullopt) -> bool {
+        if ( _running.exchange(true) ) { return false; }
+        // the previous one, if any, is already done
+        _stop = std::stop_source{};
+        spawn(run(tasks, request, resolved, _stop.get_token()));
+        return true;
+    }
+
+    auto running() const noexcept -> bool { return _running; }
+
+    // returns right away, the export notices as soon as its tasks running now are done with their line
+    auto cancel() -> void { _stop.request_stop(); }
+
+    // cancels the export and waits for it to be gone, it has to be before the task system stops
+    auto stop() -> void {
+        cancel();
+        _running.wait(true);
+    }
+};
+
+#endif
@@ -0,0 +1,468 @@
+#ifndef BUDDHABROT_HPP
+#define BUDDHABROT_HPP
+
+#include <immintrin.h>
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <latch>
+#include <limits>
+#include <ranges>
+#include <string>
+#include <vector>
+
+#include "fmt/core.h"
+#include "autotune.hpp"
+#include "avx_pcg.hpp"
+#include "cli.hpp"
+#include "mandel_kernel.hpp"
+#include "spl/image.hpp"
+#include "task_system.hpp"
+
+
+// buddhabrot and anti-buddhabrot: instead of coloring every c by how its orbit ends, random c are drawn and every
+// point their orbit goes through is counted, the picture is the density of those points. the buddhabrot keeps the
+// orbits that escape, after at least min_iter iterations, the anti-buddhabrot the ones that never do.
+//  - the c are drawn 8 at a time with avx_pcg32, from an importance map that draws more of them where the orbits
+//    worth counting start, see importance_map,
+//  - every lane of the orbit loop first finds out whether its orbit counts, then runs it again from the start and
+//    records it. a lane that's done gets a new c right away, so the 8 lanes are always all busy,
+//  - every worker counts into its own density, and they are summed at the end.
+//
+// usage: mandelbrot_avx --buddhabrot [--center RE IM] [--radius R] [--size N] [--samples N] [--min-iter N]
+//                       [--max-iter N] [--anti] [--uniform] [--gamma G] [--seed N] [--output name.png]
+
+struct buddhabrot_options {
+    double center_re{-0.5};
+    double center_im{0.0};
+    // half the width of the picture
+    double radius{1.5};
+    int size{1000};
+    // how many c are drawn in total
+    std::int64_t samples{50'000'000};
+    // shorter orbits are left out, they only add a blur over the whole set
+    int min_iter{20};
+    int max_iter{1000};
+    bool anti{false};
+    // every c equally likely, without the importance map
+    bool uniform{false};
+    double gamma{2.0};
+    // another seed draws other c, for another picture of the same density with the noise somewhere else
+    std::uint64_t seed{0};
+    std::string output{"buddhabrot.png"};
+};
+
+inline auto buddhabrot_options_from(cli_args const & args) -> buddhabrot_options
+{
+    auto opts = buddhabrot_options{};
+    opts.center_re = args.get("--center", opts.center_re, 1);
+    opts.center_im = args.get("--center", opts.center_im, 2);
+    opts.radius = args.get("--radius", opts.radius);
+    opts.size = std::max(8, args.get("--size", opts.size));
+    opts.samples = std::max<std::int64_t>(8, args.get("--samples", opts.samples));
+    opts.max_iter = std::max(1, args.get("--max-iter", opts.max_iter));
+    opts.min_iter = std::clamp(args.get("--min-iter", opts.min_iter), 0, opts.max_iter);
+    opts.anti = args.has("--anti");
+    opts.uniform = args.has("--uniform");
+    opts.gamma = std::max(0.1, args.get("--gamma", opts.gamma));
+    opts.seed = args.get("--seed", opts.seed);
+    opts.output = args.get("--output", opts.output);
+    return opts;
+}
+
+// the pixels 8 points fall on, and which of them fall inside the picture at all. a struct, not a std::pair: the
+// attributes of the vector types don't survive as template arguments
+struct pixel_hits {
+    __m512i _index;
+    __mmask8 inside;
+};
+
+// where on the plane the picture is, and how to get from a point to its pixel
+struct density_view {
+    viewport view;
+    double inv_pixel;
+    int size;
+
+    explicit density_view(buddhabrot_options const & opts)
+        : view{ opts.center_re - opts.radius, opts.center_re + opts.radius,
+                opts.center_im - opts.radius, opts.center_im + opts.radius },
+          inv_pixel{opts.size / (2 * opts.radius)}, size{opts.size} {}
+
+    // the pixels the 8 points z fall on
+    auto pixels(__m512d _zr, __m512d _zi) const noexcept -> pixel_hits {
+        const auto _inv = _mm512_set1_pd(inv_pixel);
+        const auto _size = _mm512_set1_pd(static_cast<double>(size));
+        const auto _px = _mm512_mul_pd(_mm512_sub_pd(_zr, _mm512_set1_pd(view.min_re)), _inv);
+        const auto _py = _mm512_mul_pd(_mm512_sub_pd(_zi, _mm512_set1_pd(view.min_im)), _inv);
+        auto inside = _mm512_cmp_pd_mask(_px, _mm512_setzero_pd(), _CMP_GE_OQ);
+        inside = _mm512_mask_cmp_pd_mask(inside, _px, _size, _CMP_LT_OQ);
+        inside = _mm512_mask_cmp_pd_mask(inside, _py, _mm512_setzero_pd(), _CMP_GE_OQ);
+        inside = _mm512_mask_cmp_pd_mask(inside, _py, _size, _CMP_LT_OQ);
+        const auto _row = _mm512_mullo_epi64(_mm512_cvttpd_epi64(_py), _mm512_set1_epi64(size));
+        return { _mm512_add_epi64(_row, _mm512_cvttpd_epi64(_px)), inside };
+    }
+};
+
+// the main cardioid and the period 2 bulb, where no orbit ever escapes
+inline auto in_main_bulbs(__m512d _cr, __m512d _ci) noexcept -> __mmask8
+{
+    const auto _ci2 = _ci * _ci;
+    const auto _x = _cr - _mm512_set1_pd(0.25);
+    const auto _q = _x * _x + _ci2;
+    const auto cardioid = _mm512_cmp_pd_mask(_q * (_q + _x), _ci2 * _mm512_set1_pd(0.25), _CMP_LE_OQ);
+    const auto _b = _cr + _mm512_set1_pd(1.);
+    return cardioid | _mm512_cmp_pd_mask(_b * _b + _ci2, _mm512_set1_pd(1. / 16), _CMP_LE_OQ);
+}
+
+// what the c are drawn from: the square [-2, 2]^2, which holds every orbit that doesn't escape right away, split in
+// cells. every cell is drawn with a probability that goes with sqrt(points / cost), the points its orbits put in the
+// picture over the iterations they take, found by a few orbits from every cell beforehand: that's what gives the
+// least noise for the time spent. a sample then counts for 1 / (cells * probability) of a sample drawn uniformly, so
+// the density comes out the same as with uniform sampling, only with less noise.
+// a zoom on a small part of the picture gets the most out of it, most c have orbits that never go through it.
+// a cell is drawn with Vose's alias method: a random cell, and either it or its alias, two gathers for 8 lanes
+class importance_map {
+public:
+    static constexpr auto side_bits = 7;
+    static constexpr auto side = 1 << side_bits;
+    static constexpr auto cells = side * side;
+    static constexpr auto extent = 2.0;
+    static constexpr auto cell_size = 2 * extent / side;
+
+private:
+    std::vector<double> _threshold = std::vector<double>(cells, 1.);
+    std::vector<std::int64_t> _alias = std::vector<std::int64_t>(cells);
+    std::vector<double> _cell_weight = std::vector<double>(cells, 1.);
+
+    // how many points the orbits of the 8 c put in the picture, counting only the orbits it keeps, and what they
+    // cost, in iterations, probing and recording included
+    static auto probe(buddhabrot_options const & opts, density_view const & dv, __m512d _cr, __m512d _ci) noexcept
+        -> std::pair<double, double>
+    {
+        auto _zr = _mm512_setzero_pd();
+        auto _zi = _mm512_setzero_pd();
+        auto _hits = _mm512_setzero_si512();
+        auto _kept = _mm512_setzero_si512();
+        const auto _four = _mm512_set1_pd(4.);
+        const auto _one = _mm512_set1_epi64(1);
+        const auto bulbs = in_main_bulbs(_cr, _ci);
+        // in the bulbs an orbit runs to max_iter: the buddhabrot drops it right away, the anti-buddhabrot records it
+        // without probing it first
+        auto running = opts.anti ? __mmask8{0xff} : static_cast<__mmask8>(~bulbs);
+        const auto unprobed = opts.anti ? bulbs : __mmask8{0};
+        // drawing a c isn't free either
+        auto cost = 8. * 4;
+        auto n{1};
+        for ( ; n <= opts.max_iter && running; ++n ) {
+            const auto _zr2 = _zr * _zr;
+            const auto _zi2 = _zi * _zi;
+            _zi = _mm512_fmadd_pd(_zr + _zr, _zi, _ci);
+            _zr = _zr2 - _zi2 + _cr;
+            const auto in_view = dv.pixels(_zr, _zi).inside;
+            _hits = _mm512_mask_add_epi64(_hits, running & in_view, _hits, _one);
+            const auto escaped = _mm512_mask_cmp_pd_mask(running, _zr * _zr + _zi * _zi, _four, _CMP_GT_OQ);
+            if ( !opts.anti && n >= opts.min_iter ) {
+                _kept = _mm512_mask_mov_epi64(_kept, escaped, _hits);
+                cost += n * std::popcount(static_cast<unsigned>(escaped));
+            }
+            cost += std::popcount(static_cast<unsigned>(running & ~unprobed));
+            running &= static_cast<__mmask8>(~escaped);
+        }
+        if ( opts.anti ) {
+            _kept = _mm512_mask_mov_epi64(_kept, running, _hits);
+            cost += opts.max_iter * std::popcount(static_cast<unsigned>(running));
+        }
+        return { static_cast<double>(_mm512_reduce_add_epi64(_kept)), cost };
+    }
+
+public:
+    // every cell equally likely
+    importance_map() {
+        for ( auto c{0}; c < cells; ++c ) { _alias[static_cast<std::size_t>(c)] = c; }
+    }
+
+    // 16 orbits from every cell, a row of cells per task
+    importance_map(task_system & tasks, buddhabrot_options const & opts) {
+        const auto dv = density_view(opts);
+        auto score = std::vector<double>(cells);
+        auto done = std::latch{side};
+        for ( auto row{0}; row < side; ++row ) {
+            tasks.async([ & ] ( int y ) {
+                for ( auto x{0}; x < side; ++x ) {
+                    const auto cell = y * side + x;
+                    auto worth = 0.;
+                    auto cost = 0.;
+                    for ( auto round{0}; round < 2; ++round ) {
+                        const auto _n = _mm512_add_epi64(_mm512_set1_epi64((cell * 2 + round) * 16),
+                                                         _mm512_set_epi64(14, 12, 10, 8, 6, 4, 2, 0));
+                        const auto _u = to_unit(mix64(_n));
+                        const auto _v = to_unit(mix64(_mm512_add_epi64(_n, _mm512_set1_epi64(1))));
+                        const auto _cr = _mm512_set1_pd(-extent + x * cell_size) + _u * _mm512_set1_pd(cell_size);
+                        const auto _ci = _mm512_set1_pd(-extent + y * cell_size) + _v * _mm512_set1_pd(cell_size);
+                        const auto [w, c] = probe(opts, dv, _cr, _ci);
+                        worth += w;
+                        cost += c;
+                    }
+                    score[static_cast<std::size_t>(cell)] = std::sqrt(worth / cost);
+                }
+                done.count_down();
+            }, row);
+        }
+        done.wait();
+        build(score);
+    }
+
+    // the cells of the 8 lanes, from 4 uniform numbers, and the c in them
+    auto draw(avx_pcg32 & rng, __m512d & _cr, __m512d & _ci, __m512d & _weight) const noexcept -> void {
+        const auto _picked = _mm512_cvttpd_epi64(rng.next_d() * _mm512_set1_pd(cells));
+        const auto _threshold_of = _mm512_i64gather_pd(_picked, _threshold.data(), 8);
+        const auto keep = _mm512_cmp_pd_mask(rng.next_d(), _threshold_of, _CMP_LT_OQ);
+        const auto _alias_of = _mm512_i64gather_epi64(_picked, _alias.data(), 8);
+        const auto _cell = _mm512_mask_mov_epi64(_alias_of, keep, _picked);
+        const auto _x = _mm512_cvtepi64_pd(_mm512_and_epi64(_cell, _mm512_set1_epi64(side - 1)));
+        const auto _y = _mm512_cvtepi64_pd(_mm512_srli_epi64(_cell, side_bits));
+        const auto _size = _mm512_set1_pd(cell_size);
+        _cr = _mm512_fmadd_pd(_x + rng.next_d(), _size, _mm512_set1_pd(-extent));
+        _ci = _mm512_fmadd_pd(_y + rng.next_d(), _size, _mm512_set1_pd(-extent));
+        _weight = _mm512_i64gather_pd(_cell, _cell_weight.data(), 8);
+    }
+
+private:
+    auto build(std::vector<double> const & score) -> void {
+        // 16 orbits are a noisy estimate, a cell gets the average of its 3x3 neighbourhood, which mostly isn't much
+        // different from what the cell itself is worth
+        auto smooth = std::vector<double>(cells);
+        auto total = 0.;
+        for ( auto y{0}; y < side; ++y ) {
+            for ( auto x{0}; x < side; ++x ) {
+                auto sum = 0.;
+                auto n = 0;
+                for ( auto ny = std::max(0, y - 1); ny <= std::min(side - 1, y + 1); ++ny ) {
+                    for ( auto nx = std::max(0, x - 1); nx <= std::min(side - 1, x + 1); ++nx, ++n ) {
+                        sum += score[static_cast<std::size_t>(ny * side + nx)];
+                    }
+                }
+                total += smooth[static_cast<std::size_t>(y * side + x)] = sum / n;
+            }
+        }
+        // nothing seen at all, uniform it is
+        if ( total <= 0. ) { return; }
+        // half of the c are drawn uniformly anyway: a cell whose few orbits of the estimate missed the picture
+        // keeps a fair chance, so it's never drawn so rarely that a single orbit of it shows up as a bright streak
+        auto p = std::vector<double>(cells);
+        for ( auto c{0u}; c < cells; ++c ) { p[c] = 0.5 * smooth[c] / total + 0.5 / cells; }
+        auto small = std::vector<int>{};
+        auto large = std::vector<int>{};
+        for ( auto c{0}; c < cells; ++c ) {
+            auto & q = p[static_cast<std::size_t>(c)];
+            _cell_weight[static_cast<std::size_t>(c)] = 1. / (cells * q);
+            q *= cells;
+            (q < 1. ? small : large).push_back(c);
+        }
+        while ( !small.empty() && !large.empty() ) {
+            const auto s = small.back();
+            const auto l = large.back();
+            small.pop_back();
+            _threshold[static_cast<std::size_t>(s)] = p[static_cast<std::size_t>(s)];
+            _alias[static_cast<std::size_t>(s)] = l;
+            p[static_cast<std::size_t>(l)] -= 1. - p[static_cast<std::size_t>(s)];
+            if ( p[static_cast<std::size_t>(l)] < 1. ) {
+                large.pop_back();
+                small.push_back(l);
+            }
+        }
+        // whatever is left is 1 up to rounding
+        for ( auto c : small ) { _threshold[static_cast<std::size_t>(c)] = 1.; }
+        for ( auto c : large ) { _threshold[static_cast<std::size_t>(c)] = 1.; }
+    }
+};
+
+// adds the orbits of `count` c, drawn from `stream`, to density.
+// a lane is either probing, running its orbit to find out whether it counts, or recording, running it again from the
+// start and adding the points that fall in the picture, weighted by its cell. a lane that's done draws a new c
+inline auto trace_orbits(buddhabrot_options const & opts, density_view const & dv, importance_map const & map,
+                         std::uint64_t stream, std::int64_t count, float * density) noexcept -> void
+{
+    const auto _lanes = _mm512_set_epi64(7, 6, 5, 4, 3, 2, 1, 0);
+    const auto _ids = _mm512_add_epi64(_mm512_set1_epi64(static_cast<long long>(stream * 8)), _lanes);
+    auto rng = avx_pcg32(mix64(_ids), _ids);
+    auto _cr = _mm512_setzero_pd();
+    auto _ci = _mm512_setzero_pd();
+    auto _zr = _mm512_setzero_pd();
+    auto _zi = _mm512_setzero_pd();
+    auto _weight = _mm512_setzero_pd();
+    auto _n = _mm512_setzero_si512();
+    // how long the orbit of a recording lane is
+    auto _length = _mm512_setzero_si512();
+    const auto _four = _mm512_set1_pd(4.);
+    const auto _one = _mm512_set1_epi64(1);
+    const auto _min_iter = _mm512_set1_epi64(opts.min_iter);
+    const auto _max_iter = _mm512_set1_epi64(opts.max_iter);
+    auto idle = __mmask8{0xff};
+    auto recording = __mmask8{0};
+    alignas(64) std::int64_t pixel[8];
+    alignas(64) double weight[8];
+
+    // restarts the orbit of the lanes in `lanes` from z = 0, recording it up to `_len`
+    auto record = [ & ] ( __mmask8 lanes, __m512i _len ) {
+        _zr = _mm512_mask_mov_pd(_zr, lanes, _mm512_setzero_pd());
+        _zi = _mm512_mask_mov_pd(_zi, lanes, _mm512_setzero_pd());
+        _n = _mm512_mask_mov_epi64(_n, lanes, _mm512_setzero_si512());
+        _length = _mm512_mask_mov_epi64(_length, lanes, _len);
+        recording |= lanes;
+    };
+
+    while ( true ) {
+        if ( idle && count > 0 ) {
+            // the last few c may not fill every idle lane
+            auto fresh = idle;
+            while ( std::popcount(static_cast<unsigned>(fresh)) > count ) {
+                fresh &= static_cast<__mmask8>(fresh - 1);
+            }
+            count -= std::popcount(static_cast<unsigned>(fresh));
+            auto _new_r = __m512d{};
+            auto _new_i = __m512d{};
+            auto _new_w = __m512d{};
+            map.draw(rng, _new_r, _new_i, _new_w);
+            _cr = _mm512_mask_mov_pd(_cr, fresh, _new_r);
+            _ci = _mm512_mask_mov_pd(_ci, fresh, _new_i);
+            _weight = _mm512_mask_mov_pd(_weight, fresh, _new_w);
+            _zr = _mm512_mask_mov_pd(_zr, fresh, _mm512_setzero_pd());
+            _zi = _mm512_mask_mov_pd(_zi, fresh, _mm512_setzero_pd());
+            _n = _mm512_mask_mov_epi64(_n, fresh, _mm512_setzero_si512());
+            idle &= static_cast<__mmask8>(~fresh);
+            // no need to probe the orbits that never escape: the buddhabrot just drops them, the anti-buddhabrot
+            // records them right away
+            const auto bulbs = static_cast<__mmask8>(in_main_bulbs(_new_r, _new_i) & fresh);
+            if ( opts.anti ) { record(bulbs, _max_iter); }
+            else { idle |= bulbs; }
+        }
+        const auto busy = static_cast<__mmask8>(~idle);
+        if ( !busy ) {
+            if ( count == 0 ) { break; }
+            continue;
+        }
+
+        const auto _zr2 = _zr * _zr;
+        const auto _zi2 = _zi * _zi;
+        _zi = _mm512_fmadd_pd(_zr + _zr, _zi, _ci);
+        _zr = _zr2 - _zi2 + _cr;
+        _n = _mm512_add_epi64(_n, _one);
+
+        if ( recording ) {
+            const auto [_px, in_view] = dv.pixels(_zr, _zi);
+            // two lanes may well hit the same pixel, so the adds can't be a scatter
+            if ( auto hit = static_cast<unsigned>(in_view & recording) ) {
+                _mm512_store_epi64(pixel, _px);
+                _mm512_store_pd(weight, _weight);
+                for ( ; hit; hit &= hit - 1 ) {
+                    const auto lane = std::countr_zero(hit);
+                    density[pixel[lane]] += static_cast<float>(weight[lane]);
+                }
+            }
+            const auto finished = _mm512_mask_cmpge_epi64_mask(recording, _n, _length);
+            recording &= static_cast<__mmask8>(~finished);
+            idle |= finished;
+        }
+
+        const auto probing = static_cast<__mmask8>(~idle & ~recording);
+        if ( probing ) {
+            const auto escaped = _mm512_mask_cmp_pd_mask(probing, _zr * _zr + _zi * _zi, _four, _CMP_GT_OQ);
+            const auto maxed = _mm512_mask_cmpge_epi64_mask(probing & ~escaped, _n, _max_iter);
+            if ( opts.anti ) {
+                idle |= escaped;
+                record(maxed, _max_iter);
+            } else {
+                const auto kept = _mm512_mask_cmpge_epi64_mask(escaped, _n, _min_iter);
+                idle |= static_cast<__mmask8>((escaped & ~kept) | maxed);
+                record(kept, _n);
+            }
+        }
+    }
+}
+
+// the density of the whole picture: chunks of orbits, each from its own stream, so the c drawn don't depend on how
+// many threads there are. every worker counts its chunks into a density of its own, then they are summed, every
+// worker a slice of the pixels
+inline auto render_density(task_system & tasks, buddhabrot_options const & opts, importance_map const & map)
+    -> std::vector<float>
+{
+    constexpr auto chunk = std::int64_t{1} << 16;
+    const auto dv = density_view(opts);
+    const auto pixels = static_cast<std::size_t>(opts.size) * static_cast<std::size_t>(opts.size);
+    const auto chunks = (opts.samples + chunk - 1) / chunk;
+    const auto slices = static_cast<int>(std::min<std::int64_t>(tasks.size(), chunks));
+    auto partial = std::vector<std::vector<float>>(static_cast<std::size_t>(slices), std::vector<float>(pixels));
+    auto finished = std::atomic<std::int64_t>{0};
+
+    auto done = std::latch{slices};
+    for ( auto s{0}; s < slices; ++s ) {
+        tasks.async([ & ] ( int slice ) {
+            auto * density = partial[static_cast<std::size_t>(slice)].data();
+            for ( auto k = std::int64_t{slice}; k < chunks; k += slices ) {
+                const auto stream = (opts.seed << 32) + static_cast<std::uint64_t>(k);
+                trace_orbits(opts, dv, map, stream, std::min(chunk, opts.samples - k * chunk), density);
+                const auto f = finished.fetch_add(1, std::memory_order_relaxed) + 1;
+                if ( f * 10 / chunks != (f - 1) * 10 / chunks ) {
+                    fmt::print(stderr, "buddhabrot: {}%\n", f * 100 / chunks);
+                }
+            }
+            done.count_down();
+        }, s);
+    }
+    done.wait();
+
+    auto summed = std::latch{slices};
+    for ( auto s{0}; s < slices; ++s ) {
+        tasks.async([ & ] ( int slice ) {
+            const auto first = pixels * static_cast<std::size_t>(slice) / static_cast<std::size_t>(slices);
+            const auto last = pixels * static_cast<std::size_t>(slice + 1) / static_cast<std::size_t>(slices);
+            for ( auto const & p : partial | std::views::drop(1) ) {
+                for ( auto i = first; i < last; ++i ) { partial[0][i] += p[i]; }
+            }
+            summed.count_down();
+        }, s);
+    }
+    summed.wait();
+    return std::move(partial[0]);
+}
+
+// gray levels: the density over that of the brightest pixels, through 1 / gamma. the brightest 0.05% of the pixels
+// are clipped, or the few where every orbit ends up would leave everything else black
+inline auto density_image(std::vector<float> const & density, buddhabrot_options const & opts) -> spl::graphics::image
+{
+    auto sorted = density;
+    const auto rank = sorted.begin() + static_cast<std::ptrdiff_t>(static_cast<double>(sorted.size()) * 0.9995);
+    std::ranges::nth_element(sorted, rank);
+    const auto reference = std::max(*rank, std::numeric_limits<float>::min());
+    const auto size = static_cast<std::size_t>(opts.size);
+    auto image = spl::graphics::image(size, size);
+    auto * out = image.raw_data();
+    for ( auto i{0u}; i < density.size(); ++i ) {
+        const auto level = std::pow(std::min(1.f, density[i] / reference), static_cast<float>(1. / opts.gamma));
+        const auto v = static_cast<std::uint8_t>(level * 255.f);
+        out[i] = spl::graphics::rgba{ v, v, v };
+    }
+    return image;
+}
+
+inline auto buddhabrot_main(cli_args const & args) -> int
+{
+    const auto opts = buddhabrot_options_from(args);
+    const auto tuning = tuned_setup_from(args);
+    auto tasks = task_system(tuning.threads);
+    const auto start_time = std::chrono::steady_clock::now();
+    const auto map = opts.uniform ? importance_map() : importance_map(tasks, opts);
+    const auto density = render_density(tasks, opts, map);
+    const auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+    fmt::print(stderr, "{} {} samples in {:.2f}s, {:.1f} Msamples/s\n", opts.samples,
+               opts.anti ? "anti-buddhabrot" : "buddhabrot", seconds, static_cast<double>(opts.samples) / seconds * 1e-6);
+    density_image(density, opts).save_to_file(opts.output);
+    fmt::print(stderr, "image saved with name {}\n", opts.output);
+    return 0;
+}
+
+#endif
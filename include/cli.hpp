@@ -0,0 +1,81 @@
+#ifndef CLI_HPP
+#define CLI_HPP
+
+#include <algorithm>
+#include <charconv>
+#include <optional>
+#include <iterator>
+#include <span>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+#include "fmt/core.h"
+#include "formulas.hpp"
+#include "mandel_kernel.hpp"
+
+
+// the bare minimum of command line parsing the non-gui modes need: options are either `--name` or `--name value`
+class cli_args {
+    std::vector<std::string_view> _args;
+
+public:
+    cli_args(int argc, char ** argv) {
+        for ( auto a : std::span(argv, static_cast<std::size_t>(argc)).subspan(1) ) { _args.emplace_back(a); }
+    }
+
+    auto has(std::string_view flag) const noexcept -> bool {
+        return std::ranges::find(_args, flag) != _args.end();
+    }
+
+    // the argument `position` places after `flag`, so that options like `--center RE IM` can take more than one
+    auto value(std::string_view flag, std::size_t position = 1) const noexcept -> std::optional<std::string_view> {
+        auto it = std::ranges::find(_args, flag);
+        if ( it == _args.end() || static_cast<std::size_t>(std::distance(it, _args.end())) <= position ) {
+            return std::nullopt;
+        }
+        return *std::next(it, static_cast<std::ptrdiff_t>(position));
+    }
+
+    // the value of `flag` converted to T, or `fallback` if it is missing or malformed
+    template<typename T>
+    auto get(std::string_view flag, T fallback, std::size_t position = 1) const -> T {
+        auto v = value(flag, position);
+        if ( !v ) { return fallback; }
+        if constexpr ( std::is_same_v<T, std::string> ) {
+            return std::string{*v};
+        } else {
+            auto result = T{};
+            auto [ptr, ec] = std::from_chars(v->data(), v->data() + v->size(), result);
+            return ec == std::errc{} ? result : fallback;
+        }
+    }
+};
+
+// the render settings shared by every non-gui mode: --max-iter N, --aa N, --adaptive N (max samples factor),
+// --bw and --smooth (the second coloring algorithm), --formula NAME and --julia RE IM, --distance (distance
+// estimation shading) and --interior (stop the points caught in a cycle inside the set before max_iter)
+inline auto settings_from(cli_args const & args) -> render_settings
+{
+    auto settings = render_settings{};
+    settings.max_iter = std::max(1, args.get("--max-iter", settings.max_iter));
+    settings.anti_aliasing = std::max(1, args.get("--aa", settings.anti_aliasing));
+    settings.max_samples = settings.anti_aliasing * std::max(1, args.get("--adaptive", 1));
+    settings.colored_pic = !args.has("--bw");
+    settings.first_color = !args.has("--smooth");
+    if ( auto name = args.value("--formula") ) {
+        if ( auto f = parse_formula(*name) ) { settings.formula = *f; }
+        else { fmt::print(stderr, "unknown formula {}, using {}\n", *name, formula_name(settings.formula)); }
+    }
+    settings.distance_estimation = args.has("--distance");
+    settings.interior_detection = args.has("--interior");
+    if ( args.has("--julia") ) {
+        settings.formula = formula_kind::julia;
+        settings.julia_re = args.get("--julia", settings.julia_re, 1);
+        settings.julia_im = args.get("--julia", settings.julia_im, 2);
+    }
+    return settings;
+}
+
+#endif
@@ -2,21 +2,32 @@
 #define CUSTOM_LOCKS_HPP
 
 #include <atomic>
+#include <cstdint>
+#include <new>
+
+// both mutexes count how many times they were found already locked, by a lock() that had to wait or by a try_lock()
+// that failed. it's only ever counted on the slow path, taking a free mutex costs the same as without it
 
 struct spin_mutex {
 private:
     std::atomic_flag flag = ATOMIC_FLAG_INIT;
+    std::atomic<std::uint64_t> _contended{0};
 public:
     constexpr auto lock() noexcept -> void {
-        while (flag.test_and_set(std::memory_order_acquire)) { flag.wait(true, std::memory_order_relaxed); }
+        if (!flag.test_and_set(std::memory_order_acquire)) { return; }
+        _contended.fetch_add(1, std::memory_order_relaxed);
+        do { flag.wait(true, std::memory_order_relaxed); } while (flag.test_and_set(std::memory_order_acquire));
     }
     constexpr auto unlock() noexcept -> void {
         flag.clear(std::memory_order_release);
         flag.notify_one();
     }
     constexpr auto try_lock() noexcept -> bool {
-        return !flag.test_and_set(std::memory_order_acquire);
+        if (!flag.test_and_set(std::memory_order_acquire)) { return true; }
+        _contended.fetch_add(1, std::memory_order_relaxed);
+        return false;
     }
+    auto contended() const noexcept -> std::uint64_t { return _contended.load(std::memory_order_relaxed); }
 };
 
 
@@ -24,12 +35,16 @@ struct ticket_mutex {
 private:
     alignas(std::hardware_destructive_interference_size) std::atomic<int>  in{0};
     alignas(std::hardware_destructive_interference_size) std::atomic<int> out{0};
+    std::atomic<std::uint64_t> _contended{0};
 public:
     constexpr auto lock() noexcept -> void {
         auto const my = in.fetch_add(1, std::memory_order_acquire);
+        auto waited = false;
         while (true) {
             auto const now = out.load(std::memory_order_acquire);
             if (now == my) return;
+            if (!waited) { _contended.fetch_add(1, std::memory_order_relaxed); }
+            waited = true;
             out.wait(now, std::memory_order_relaxed);
         }
     }
@@ -44,8 +59,10 @@ public:
             in.fetch_add(1, std::memory_order_acquire);
             return true;
         }
+        _contended.fetch_add(1, std::memory_order_relaxed);
         return false;
     }
+    auto contended() const noexcept -> std::uint64_t { return _contended.load(std::memory_order_relaxed); }
 };
 
 #endif
@@ -0,0 +1,293 @@
+#ifndef DISK_CACHE_HPP
+#define DISK_CACHE_HPP
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <charconv>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "fmt/core.h"
+#include "fmt/format.h"
+#include "cli.hpp"
+#include "mandel_kernel.hpp"
+#include "task_system.hpp"
+
+
+// a persistent cache of rendered frames, so that going back to a view, or to a tile, is a page-in and not a render.
+// a frame is addressed by the hash of everything that determines its content: the viewport, the size, the render
+// settings and the precision of the arithmetic. each one lives in its own file,
+//     header (the full key, to tell hash collisions apart) | rgba pixels | escape data | luma
+// which is mapped and copied straight into a render_frame. files are written under a temporary name and renamed,
+// so a reader, even one in another process, never sees half a frame.
+// the total size is capped: past the budget, the frames that were used the longest time ago are deleted. the
+// directory is only scanned once, when the cache is opened, and ordered by modification time, which a hit
+// refreshes; from then on the sizes and the order of use are kept in memory, so a store doesn't list the directory.
+// a frame another process adds meanwhile is only counted once this one reads it.
+// it's off unless asked for: writing every frame costs about 9 bytes per pixel of disk bandwidth.
+
+struct disk_cache_options {
+    std::filesystem::path dir{};
+    std::uintmax_t budget{std::uintmax_t{1} << 30};
+    bool enabled{false};
+};
+
+// $XDG_CACHE_HOME/mandelbrot_avx, or ~/.cache/mandelbrot_avx
+inline auto default_cache_dir() -> std::filesystem::path
+{
+    if ( auto xdg = std::getenv("XDG_CACHE_HOME"); xdg && *xdg ) { return std::filesystem::path(xdg) / "mandelbrot_avx"; }
+    if ( auto home = std::getenv("HOME"); home && *home ) { return std::filesystem::path(home) / ".cache" / "mandelbrot_avx"; }
+    return std::filesystem::temp_directory_path() / "mandelbrot_avx";
+}
+
+// --disk-cache, optionally followed by the directory, and --disk-cache-mb N
+inline auto disk_cache_options_from(cli_args const & args) -> disk_cache_options
+{
+    auto opts = disk_cache_options{};
+    const auto dir = args.value("--disk-cache");
+    opts.dir = dir && !dir->starts_with("--") ? std::filesystem::path(*dir) : default_cache_dir();
+    opts.budget = static_cast<std::uintmax_t>(std::max(1, args.get("--disk-cache-mb", 1024))) << 20;
+    opts.enabled = args.has("--disk-cache");
+    return opts;
+}
+
+// the only arithmetic the kernel has for now, part of the key so that frames rendered with something else later on
+// never get mixed up with these
+constexpr auto precision_bits = std::uint64_t{64};
+
+// every field that changes what a frame looks like, as 64 bit words. the first one tells the file format version
+using frame_key = std::array<std::uint64_t, 16>;
+
+inline auto frame_key_of(viewport const & view, std::size_t width, std::size_t height, render_settings const & settings)
+    noexcept -> frame_key
+{
+    const auto flags = std::uint64_t{settings.colored_pic} | std::uint64_t{settings.first_color} << 1
+                       | std::uint64_t{settings.distance_estimation} << 2 | std::uint64_t{settings.interior_detection} << 3
+                       | std::uint64_t{settings.equalized} << 4;
+    return {
+        0x6d616e64656c0002,     // "mandel", version 2: the same samples on every run
+        precision_bits,
+        std::bit_cast<std::uint64_t>(view.min_re), std::bit_cast<std::uint64_t>(view.max_re),
+        std::bit_cast<std::uint64_t>(view.min_im), std::bit_cast<std::uint64_t>(view.max_im),
+        width, height,
+        static_cast<std::uint64_t>(settings.max_iter),
+        static_cast<std::uint64_t>(settings.anti_aliasing),
+        static_cast<std::uint64_t>(settings.max_samples),
+        flags,
+        static_cast<std::uint64_t>(settings.formula),
+        std::bit_cast<std::uint64_t>(settings.julia_re), std::bit_cast<std::uint64_t>(settings.julia_im),
+        0
+    };
+}
+
+// fnv-1a over the key, the name of the file
+inline auto frame_key_hash(frame_key const & key) noexcept -> std::uint64_t
+{
+    auto h = std::uint64_t{0xcbf29ce484222325};
+    for ( auto word : key ) {
+        for ( auto b{0}; b < 8; ++b ) {
+            h ^= (word >> (8 * b)) & 0xff;
+            h *= 0x100000001b3;
+        }
+    }
+    return h;
+}
+
+class disk_cache {
+    struct cached_file {
+        std::uint64_t used;
+        std::uintmax_t size;
+    };
+
+    std::filesystem::path _dir;
+    std::uintmax_t _budget;
+    // everything below is guarded by _mutex
+    std::mutex _mutex;
+    // by hash of the key, and the same hashes by the last time they were used, the oldest first. the times are just
+    // a counter
+    std::unordered_map<std::uint64_t, cached_file> _files;
+    std::map<std::uint64_t, std::uint64_t> _by_use;
+    std::uint64_t _clock{0};
+    std::uintmax_t _total{0};
+
+    auto path_of(std::uint64_t hash) const -> std::filesystem::path {
+        return _dir / fmt::format("{:016x}.frame", hash);
+    }
+
+    auto path_of(frame_key const & key) const -> std::filesystem::path { return path_of(frame_key_hash(key)); }
+
+    static auto file_size(render_frame const & frame) noexcept -> std::size_t {
+        const auto pixels = frame.image.width() * frame.image.height();
+        return sizeof(frame_key) + pixels * (sizeof(spl::graphics::rgba) + sizeof(float) + sizeof(std::uint8_t));
+    }
+
+    // with the lock held: the file is the most recently used one
+    auto touch(std::uint64_t hash, std::uintmax_t size) -> void {
+        if ( auto it = _files.find(hash); it != _files.end() ) {
+            _by_use.erase(it->second.used);
+            _total -= it->second.size;
+        }
+        _files[hash] = { _clock, size };
+        _by_use.emplace(_clock++, hash);
+        _total += size;
+    }
+
+    // the files already there, the least recently used first
+    auto scan() -> void {
+        struct found_file {
+            std::filesystem::file_time_type used;
+            std::uint64_t hash;
+            std::uintmax_t size;
+        };
+        auto found = std::vector<found_file>{};
+        auto ec = std::error_code{};
+        for ( auto const & entry : std::filesystem::directory_iterator(_dir, ec) ) {
+            if ( entry.path().extension() != ".frame" ) { continue; }
+            const auto name = entry.path().stem().string();
+            auto hash = std::uint64_t{0};
+            const auto [end, error] = std::from_chars(name.data(), name.data() + name.size(), hash, 16);
+            if ( error != std::errc{} || end != name.data() + name.size() ) { continue; }
+            auto size = entry.file_size(ec);
+            auto used = entry.last_write_time(ec);
+            if ( ec ) { continue; }
+            found.push_back({ used, hash, size });
+        }
+        std::ranges::sort(found, {}, &found_file::used);
+        auto lock = std::lock_guard{_mutex};
+        for ( auto const & f : found ) { touch(f.hash, f.size); }
+    }
+
+    // deletes the least recently used files until the rest fits in the budget
+    auto evict() -> void {
+        auto lock = std::lock_guard{_mutex};
+        while ( _total > _budget && !_by_use.empty() ) {
+            const auto oldest = _by_use.begin();
+            const auto hash = oldest->second;
+            _by_use.erase(oldest);
+            auto ec = std::error_code{};
+            // whether it's deleted here or it was gone already, it doesn't count anymore
+            std::filesystem::remove(path_of(hash), ec);
+            _total -= _files[hash].size;
+            _files.erase(hash);
+        }
+    }
+
+public:
+    disk_cache(std::filesystem::path dir, std::uintmax_t budget) : _dir{std::move(dir)}, _budget{budget} {
+        auto ec = std::error_code{};
+        std::filesystem::create_directories(_dir, ec);
+        scan();
+        evict();
+    }
+
+    // fills `frame`, which must already have the size in the key, and returns true if the frame was in the cache
+    auto load(frame_key const & key, render_frame & frame) -> bool {
+        const auto path = path_of(key);
+        const auto fd = ::open(path.c_str(), O_RDONLY);
+        if ( fd < 0 ) { return false; }
+        const auto size = file_size(frame);
+        struct stat info{};
+        if ( ::fstat(fd, &info) < 0 || static_cast<std::size_t>(info.st_size) != size ) {
+            ::close(fd);
+            return false;
+        }
+        auto * mapped = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if ( mapped == MAP_FAILED ) { return false; }
+        const auto * bytes = static_cast<std::uint8_t const *>(mapped);
+        const auto hit = std::memcmp(bytes, key.data(), sizeof(frame_key)) == 0;
+        if ( hit ) {
+            const auto pixels = frame.image.width() * frame.image.height();
+            bytes += sizeof(frame_key);
+            std::memcpy(frame.image.raw_data(), bytes, pixels * sizeof(spl::graphics::rgba));
+            bytes += pixels * sizeof(spl::graphics::rgba);
+            std::memcpy(frame.escape.data(), bytes, pixels * sizeof(float));
+            bytes += pixels * sizeof(float);
+            std::memcpy(frame.luma.data(), bytes, pixels);
+        }
+        ::munmap(mapped, size);
+        if ( hit ) {
+            // for the next run, which orders the files by it
+            auto ec = std::error_code{};
+            std::filesystem::last_write_time(path, std::filesystem::file_time_type::clock::now(), ec);
+            auto lock = std::lock_guard{_mutex};
+            touch(frame_key_hash(key), size);
+        }
+        return hit;
+    }
+
+    // writes the frame and then evicts whatever is needed to get back under the budget. it takes a while: nobody
+    // should be waiting on it, see store_later()
+    auto store(frame_key const & key, render_frame const & frame) -> void {
+        const auto path = path_of(key);
+        auto temp = path;
+        temp += fmt::format(".{}.tmp", std::hash<std::thread::id>{}(std::this_thread::get_id()));
+        {
+            auto out = std::ofstream(temp, std::ios::binary);
+            const auto pixels = frame.image.width() * frame.image.height();
+            out.write(reinterpret_cast<char const *>(key.data()), sizeof(frame_key));
+            out.write(reinterpret_cast<char const *>(frame.image.raw_data()),
+                      static_cast<std::streamsize>(pixels * sizeof(spl::graphics::rgba)));
+            out.write(reinterpret_cast<char const *>(frame.escape.data()),
+                      static_cast<std::streamsize>(pixels * sizeof(float)));
+            out.write(reinterpret_cast<char const *>(frame.luma.data()), static_cast<std::streamsize>(pixels));
+            if ( !out ) {
+                out.close();
+                auto ec = std::error_code{};
+                std::filesystem::remove(temp, ec);
+                return;
+            }
+        }
+        auto ec = std::error_code{};
+        std::filesystem::rename(temp, path, ec);
+        if ( ec ) { std::filesystem::remove(temp, ec); return; }
+        {
+            auto lock = std::lock_guard{_mutex};
+            touch(frame_key_hash(key), file_size(frame));
+        }
+        evict();
+    }
+
+    // the bytes of all the frames it knows about
+    auto total() -> std::uintmax_t {
+        auto lock = std::lock_guard{_mutex};
+        return _total;
+    }
+
+    auto dir() const noexcept -> std::filesystem::path const & { return _dir; }
+};
+
+// the cache of the options, or nothing if it's disabled
+inline auto make_disk_cache(disk_cache_options const & opts) -> std::shared_ptr<disk_cache>
+{
+    if ( !opts.enabled ) { return nullptr; }
+    return std::make_shared<disk_cache>(opts.dir, opts.budget);
+}
+
+// stores the frame in a background task, off the way of whoever waits for it. the task holds on to the cache and
+// the frame until it's done
+inline auto store_later(task_system & tasks, std::shared_ptr<disk_cache> disk, frame_key const & key,
+                        std::shared_ptr<render_frame const> frame) -> void
+{
+    tasks.submit(task_priority::background, [ disk = std::move(disk), key, frame = std::move(frame) ] {
+        disk->store(key, *frame);
+    });
+}
+
+#endif
@@ -0,0 +1,419 @@
+#ifndef DISTRIBUTED_HPP
+#define DISTRIBUTED_HPP
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "fmt/core.h"
+#include "autotune.hpp"
+#include "cli.hpp"
+#include "mandel_kernel.hpp"
+#include "net.hpp"
+#include "resolve.hpp"
+#include "spl/image.hpp"
+#include "task_system.hpp"
+
+
+// rendering one frame on several processes, possibly on several machines.
+// the coordinator splits the frame in bands of lines and hands them over tcp to the workers, each of them a process
+// running the usual kernel on its own task system. every connection keeps a few bands in flight so that a worker
+// never waits for the network between two of them; a band whose connection fails or times out goes back in the queue
+// and is picked up by whoever is free, and a worker that keeps failing is given up on. the bands are copied into the
+// frame at their place as they arrive, and the frame is saved once every band is there.
+//
+// the adaptive AA looks at the lines above and below each pixel, so a worker renders one more line on each side of
+// its band and throws them away: the result is the same as rendering the frame in one go.
+//
+// the messages are the raw structs below, both ends are expected to run the same build on the same architecture.
+//
+// usage: mandelbrot_avx --worker [--port N] [--bind ADDR] [--max-connections N]
+//        mandelbrot_avx --coordinate --workers HOST:PORT,HOST:PORT,... [--center RE IM] [--radius R] [--size N]
+//                       [--width W] [--height H] [--band N] [--pipeline N] [--timeout S] [--retries N]
+//                       [--output file.png] [--thumbnail N] [--filter box|tent|lanczos]
+//                       [--max-iter N] [--aa N] [--adaptive N] [--formula NAME] [--julia RE IM] ...
+
+constexpr auto band_magic = std::uint32_t{0x444e424d};      // "MBND"
+constexpr auto band_protocol_version = std::uint32_t{2};  // 2: the samples of a pixel depend only on where it is
+
+// a band of `lines` lines, starting at `first_line`, of a width x height frame over the given view
+struct band_request {
+    std::uint32_t magic{band_magic};
+    std::uint32_t version{band_protocol_version};
+    std::uint32_t id{0};
+    std::uint32_t width{0};
+    std::uint32_t height{0};
+    std::uint32_t first_line{0};
+    std::uint32_t lines{0};
+    std::int32_t max_iter{0};
+    std::int32_t anti_aliasing{0};
+    std::int32_t max_samples{0};
+    std::uint32_t formula{0};
+    std::uint8_t colored_pic{0};
+    std::uint8_t first_color{0};
+    std::uint8_t distance_estimation{0};
+    std::uint8_t interior_detection{0};
+    double min_re{0};
+    double max_re{0};
+    double min_im{0};
+    double max_im{0};
+    double julia_re{0};
+    double julia_im{0};
+};
+static_assert(std::is_trivially_copyable_v<band_request> && sizeof(band_request) == 96, "band_request has padding");
+
+// followed by width * lines rgba pixels when status is 0
+struct band_reply {
+    std::uint32_t magic{band_magic};
+    std::uint32_t id{0};
+    std::uint32_t first_line{0};
+    std::uint32_t lines{0};
+    std::uint32_t width{0};
+    std::uint32_t status{0};
+};
+
+// bands wider or taller than this are refused by the workers, they are surely garbage
+constexpr auto max_band_width = std::uint32_t{1} << 16;
+constexpr auto max_band_lines = std::uint32_t{1} << 12;
+
+inline auto make_band_request(viewport const & view, std::uint32_t width, std::uint32_t height,
+                              render_settings const & settings) noexcept -> band_request
+{
+    auto req = band_request{};
+    req.width = width;
+    req.height = height;
+    req.max_iter = settings.max_iter;
+    req.anti_aliasing = settings.anti_aliasing;
+    req.max_samples = settings.max_samples;
+    req.formula = static_cast<std::uint32_t>(settings.formula);
+    req.colored_pic = settings.colored_pic;
+    req.first_color = settings.first_color;
+    req.distance_estimation = settings.distance_estimation;
+    req.interior_detection = settings.interior_detection;
+    req.min_re = view.min_re;
+    req.max_re = view.max_re;
+    req.min_im = view.min_im;
+    req.max_im = view.max_im;
+    req.julia_re = settings.julia_re;
+    req.julia_im = settings.julia_im;
+    return req;
+}
+
+inline auto settings_of(band_request const & req) noexcept -> render_settings
+{
+    auto settings = render_settings{};
+    settings.max_iter = std::max(1, req.max_iter);
+    settings.anti_aliasing = std::max(1, req.anti_aliasing);
+    settings.max_samples = std::max(settings.anti_aliasing, req.max_samples);
+    settings.colored_pic = req.colored_pic != 0;
+    settings.first_color = req.first_color != 0;
+    settings.formula = req.formula < formula_names.size() ? static_cast<formula_kind>(req.formula)
+                                                          : formula_kind::mandelbrot;
+    settings.julia_re = req.julia_re;
+    settings.julia_im = req.julia_im;
+    settings.distance_estimation = req.distance_estimation != 0;
+    settings.interior_detection = req.interior_detection != 0;
+    return settings;
+}
+
+inline auto valid_band(band_request const & req) noexcept -> bool
+{
+    return req.magic == band_magic && req.version == band_protocol_version
+           && req.width > 0 && req.width <= max_band_width
+           && req.lines > 0 && req.lines <= max_band_lines
+           && req.first_line < req.height && req.lines <= req.height - req.first_line;
+}
+
+// renders the band, plus a line of margin on the sides that have one, and returns only the pixels of the band
+inline auto render_band(task_system & tasks, band_request const & req, int lines_per_task = 1)
+    -> std::vector<spl::graphics::rgba>
+{
+    const auto above = req.first_line > 0 ? 1u : 0u;
+    const auto below = req.first_line + req.lines < req.height ? 1u : 0u;
+    const auto first = req.first_line - above;
+    auto frame = render_frame(req.width, req.lines + above + below, first, req.height);
+    const auto view = viewport{ req.min_re, req.max_re, req.min_im, req.max_im };
+    render_blocking(tasks, frame, view, settings_of(req), lines_per_task);
+    auto begin = frame.image.get_pixel_iterator(0, above);
+    return { begin, begin + static_cast<std::ptrdiff_t>(req.width * req.lines) };
+}
+
+// answers the bands of one coordinator connection, in order, until it's closed
+inline auto serve_bands(task_system & tasks, int fd, int lines_per_task) -> void
+{
+    auto req = band_request{};
+    while ( recv_all(fd, &req, sizeof(req)) ) {
+        auto reply = band_reply{ band_magic, req.id, req.first_line, req.lines, req.width, 0 };
+        if ( !valid_band(req) ) {
+            reply.status = 1;
+            send_all(fd, &reply, sizeof(reply));
+            break;
+        }
+        auto scope = trace_scope("band", "distributed", req.id);
+        const auto pixels = render_band(tasks, req, lines_per_task);
+        if ( !send_all(fd, &reply, sizeof(reply))
+             || !send_all(fd, pixels.data(), pixels.size() * sizeof(spl::graphics::rgba)) ) { break; }
+    }
+    ::close(fd);
+}
+
+// the whole --worker mode
+inline auto band_worker_main(cli_args const & args) -> int
+{
+    const auto bind = args.get("--bind", std::string{"0.0.0.0"});
+    const auto port = args.get("--port", 9000);
+    auto fd = listen_tcp(bind, port);
+    if ( fd < 0 ) {
+        fmt::print(stderr, "can't listen on {}:{}\n", bind, port);
+        return 1;
+    }
+    const auto tuning = tuned_setup_from(args);
+    auto tasks = task_system(tuning.threads);
+    fmt::print(stderr, "worker listening on {}:{} with {} threads\n", bind, port, tasks.size());
+    // a coordinator may open more than one connection, they all share the task system
+    serve_connections(fd, args.get("--max-connections", 16), [ &tasks, lines = tuning.lines_per_task ] ( int client ) {
+        serve_bands(tasks, client, lines);
+    });
+    fmt::print(stderr, "accept keeps failing, stopping\n");
+    ::close(fd);
+    return 1;
+}
+
+struct coordinator_options {
+    std::vector<std::pair<std::string, int>> workers;
+    double center_re{-0.5};
+    double center_im{0.0};
+    // half the width of the view, the height follows the aspect of the frame
+    double radius{1.5};
+    int width{4000};
+    int height{4000};
+    int band{32};
+    // how many bands each connection keeps in flight
+    int pipeline{2};
+    // seconds a worker has to answer a band before it's considered lost
+    int timeout{300};
+    // consecutive failures after which a worker is given up on
+    int retries{5};
+    std::string output{"poster.png"};
+    // the width of a copy of the poster resolved down from the whole frame, 0 for none
+    int thumbnail{0};
+    resolve_filter filter{resolve_filter::lanczos};
+};
+
+inline auto coordinator_options_from(cli_args const & args) -> coordinator_options
+{
+    auto opts = coordinator_options{};
+    auto list = std::string_view{args.value("--workers").value_or("")};
+    while ( !list.empty() ) {
+        const auto comma = list.find(',');
+        const auto item = list.substr(0, comma);
+        if ( auto endpoint = parse_endpoint(item) ) { opts.workers.push_back(*endpoint); }
+        else if ( !item.empty() ) { fmt::print(stderr, "ignoring the malformed worker {}\n", item); }
+        list.remove_prefix(comma == std::string_view::npos ? list.size() : comma + 1);
+    }
+    opts.center_re = args.get("--center", opts.center_re, 1);
+    opts.center_im = args.get("--center", opts.center_im, 2);
+    opts.radius = args.get("--radius", opts.radius);
+    // --size N for a square one
+    const auto size = args.get("--size", opts.width);
+    opts.width = std::max(1, args.get("--width", size));
+    opts.height = std::max(1, args.get("--height", size));
+    opts.band = std::clamp(args.get("--band", opts.band), 1, static_cast<int>(max_band_lines));
+    opts.pipeline = std::max(1, args.get("--pipeline", opts.pipeline));
+    opts.timeout = std::max(1, args.get("--timeout", opts.timeout));
+    opts.retries = std::max(0, args.get("--retries", opts.retries));
+    opts.output = args.get("--output", opts.output);
+    opts.thumbnail = std::max(0, args.get("--thumbnail", opts.thumbnail));
+    if ( auto name = args.value("--filter") ) {
+        if ( auto f = parse_resolve_filter(*name) ) { opts.filter = *f; }
+        else { fmt::print(stderr, "unknown filter {}, using {}\n", *name, resolve_filter_name(opts.filter)); }
+    }
+    return opts;
+}
+
+class coordinator {
+    const coordinator_options _opts;
+    std::vector<band_request> _bands;
+    spl::graphics::image _image;
+
+    std::mutex _mutex;
+    std::condition_variable _changed;
+    std::deque<std::uint32_t> _pending;
+    std::vector<bool> _done;
+    std::size_t _remaining;
+    std::size_t _retried{0};
+
+    // a band that came back, copied straight to its lines
+    auto complete(band_request const & req, std::vector<spl::graphics::rgba> const & pixels) -> void {
+        auto lock = std::lock_guard{_mutex};
+        if ( _done[req.id] ) { return; }
+        std::copy(pixels.begin(), pixels.end(), _image.get_pixel_iterator(0, req.first_line));
+        _done[req.id] = true;
+        --_remaining;
+        if ( _remaining % 16 == 0 ) {
+            fmt::print(stderr, "{} of {} bands left\n", _remaining, _bands.size());
+        }
+        _changed.notify_all();
+    }
+
+    // the bands of a failed connection go back to the front of the queue, they are the oldest ones
+    auto requeue(std::deque<std::uint32_t> & in_flight) -> void {
+        auto lock = std::lock_guard{_mutex};
+        for ( auto it = in_flight.rbegin(); it != in_flight.rend(); ++it ) {
+            if ( !_done[*it] ) { _pending.push_front(*it); ++_retried; }
+        }
+        in_flight.clear();
+        _changed.notify_all();
+    }
+
+    // one connection to one worker: keep `pipeline` bands in flight and read the answers, which come in order.
+    // returns true once every band is done, false if the connection broke. `completed` counts the bands it got back
+    auto drive(int fd, std::string_view name, std::size_t & completed) -> bool {
+        auto in_flight = std::deque<std::uint32_t>{};
+        auto fresh = std::vector<std::uint32_t>{};
+        auto pixels = std::vector<spl::graphics::rgba>{};
+        auto receive = [ & ] () -> bool {
+            auto reply = band_reply{};
+            const auto & req = _bands[in_flight.front()];
+            if ( !recv_all(fd, &reply, sizeof(reply)) || reply.magic != band_magic || reply.status != 0
+                 || reply.id != req.id || reply.lines != req.lines || reply.width != req.width ) { return false; }
+            pixels.resize(static_cast<std::size_t>(req.width) * req.lines);
+            if ( !recv_all(fd, pixels.data(), pixels.size() * sizeof(spl::graphics::rgba)) ) { return false; }
+            complete(req, pixels);
+            in_flight.pop_front();
+            ++completed;
+            return true;
+        };
+        while ( true ) {
+            fresh.clear();
+            {
+                auto lock = std::unique_lock{_mutex};
+                // nothing to send and nothing to wait for: either everything is done, or some other connection
+                // still has bands in flight that may come back to the queue
+                while ( in_flight.empty() && _pending.empty() ) {
+                    if ( _remaining == 0 ) { return true; }
+                    _changed.wait_for(lock, std::chrono::milliseconds(100));
+                }
+                while ( std::ssize(in_flight) < _opts.pipeline && !_pending.empty() ) {
+                    in_flight.push_back(_pending.front());
+                    fresh.push_back(_pending.front());
+                    _pending.pop_front();
+                }
+            }
+            auto sent = std::ranges::all_of(fresh, [ & ] ( auto id ) {
+                return send_all(fd, &_bands[id], sizeof(band_request));
+            });
+            if ( !sent || !receive() ) { break; }
+        }
+        fmt::print(stderr, "lost the connection to {}, {} bands go back in the queue\n", name, in_flight.size());
+        requeue(in_flight);
+        return false;
+    }
+
+    // connects to one worker and drives it, reconnecting after a failure, until everything is done or it failed
+    // `retries` times in a row
+    auto work(std::string const & host, int port) -> void {
+        const auto name = fmt::format("{}:{}", host, port);
+        auto failures = 0;
+        while ( true ) {
+            auto completed = std::size_t{0};
+            auto fd = connect_tcp(host, port);
+            if ( fd >= 0 ) {
+                set_receive_timeout(fd, _opts.timeout);
+                const auto finished = drive(fd, name, completed);
+                ::close(fd);
+                if ( finished ) { return; }
+            }
+            failures = completed > 0 ? 1 : failures + 1;
+            if ( failures > _opts.retries ) {
+                fmt::print(stderr, "giving up on {}\n", name);
+                return;
+            }
+            {
+                auto lock = std::unique_lock{_mutex};
+                if ( _remaining == 0 ) { return; }
+            }
+            // back off a bit more after every failure, up to a few seconds
+            std::this_thread::sleep_for(std::chrono::milliseconds(100) * (1 << std::min(failures, 6)));
+        }
+    }
+
+public:
+    explicit coordinator(coordinator_options const & opts, render_settings const & settings)
+        : _opts{opts}, _image(static_cast<std::size_t>(opts.width), static_cast<std::size_t>(opts.height)) {
+        const auto width = static_cast<std::uint32_t>(opts.width);
+        const auto height = static_cast<std::uint32_t>(opts.height);
+        const auto half_height = opts.radius * opts.height / opts.width;
+        const auto view = viewport{ opts.center_re - opts.radius, opts.center_re + opts.radius,
+                                    opts.center_im - half_height, opts.center_im + half_height };
+        const auto base = make_band_request(view, width, height, settings);
+        for ( auto first = std::uint32_t{0}; first < height; first += static_cast<std::uint32_t>(opts.band) ) {
+            auto req = base;
+            req.id = static_cast<std::uint32_t>(_bands.size());
+            req.first_line = first;
+            req.lines = std::min(static_cast<std::uint32_t>(opts.band), height - first);
+            _pending.push_back(req.id);
+            _bands.push_back(req);
+        }
+        _done.assign(_bands.size(), false);
+        _remaining = _bands.size();
+    }
+
+    // renders the whole frame, returns false if every worker was given up on before it was done
+    auto run() -> bool {
+        {
+            auto threads = std::vector<std::jthread>{};
+            for ( auto const & [host, port] : _opts.workers ) {
+                threads.emplace_back([ this, host, port ] { work(host, port); });
+            }
+        }
+        return _remaining == 0;
+    }
+
+    auto image() const noexcept -> spl::graphics::image const & { return _image; }
+    auto retried() const noexcept -> std::size_t { return _retried; }
+};
+
+// the whole --coordinate mode
+inline auto coordinator_main(cli_args const & args) -> int
+{
+    const auto opts = coordinator_options_from(args);
+    if ( opts.workers.empty() ) {
+        fmt::print(stderr, "--coordinate needs the workers, as --workers HOST:PORT,HOST:PORT,...\n");
+        return 1;
+    }
+    auto settings = settings_from(args);
+    auto c = coordinator(opts, settings);
+    const auto start_time = std::chrono::steady_clock::now();
+    if ( !c.run() ) {
+        fmt::print(stderr, "every worker failed, the frame is not complete\n");
+        return 1;
+    }
+    fmt::print(stderr, "{}x{} rendered on {} workers in {:.2f}s, {} bands retried\n", opts.width, opts.height,
+               opts.workers.size(), std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count(),
+               c.retried());
+    c.image().save_to_file(opts.output);
+    fmt::print(stderr, "image saved with name {}\n", opts.output);
+    if ( opts.thumbnail > 0 ) {
+        // the workers did the heavy part, the coordinator can spare its own cores for this
+        auto tasks = task_system();
+        const auto width = static_cast<std::size_t>(opts.thumbnail);
+        const auto height = std::max<std::size_t>(1, static_cast<std::size_t>(
+            std::lround(static_cast<double>(opts.thumbnail) * opts.height / opts.width)));
+        const auto filename = resolved_filename(opts.output);
+        sync_wait(resolve(tasks, c.image(), width, height, opts.filter)).save_to_file(filename);
+        fmt::print(stderr, "{}x{} thumbnail saved with name {}\n", width, height, filename);
+    }
+    return 0;
+}
+
+#endif
@@ -0,0 +1,165 @@
+#ifndef EQUALIZE_HPP
+#define EQUALIZE_HPP
+
+#include <immintrin.h>
+#include <algorithm>
+#include <cstdint>
+#include <numbers>
+#include <vector>
+
+#include "async_task.hpp"
+#include "mandel_kernel.hpp"
+#include "render_trace.hpp"
+#include "task_system.hpp"
+
+
+// histogram equalized coloring: every pixel is colored by the fraction of the pixels outside the set that escaped
+// before it did, instead of by its own iteration count. the colors spread evenly over whatever the frame contains,
+// so they don't need tuning by hand after every zoom or max_iter change.
+// it works on the escape counts the first pass leaves in the frame, after the render:
+//  - every worker counts its own slice of the lines into its own histogram,
+//  - the histograms are summed, every worker a slice of the bins,
+//  - the prefix sum of that is the cdf, which the pixels are colored through, 8 at a time.
+// the palette is laid out in a table once per frame, so coloring a pixel is a couple of gathers and no math.
+// the buffers are kept from a frame to the next, so once they are big enough this doesn't allocate.
+class histogram_equalizer {
+    // past this many bins the histograms would cost more than they give, the iterations share them instead
+    static constexpr auto max_bins = 1 << 16;
+    // finer than what 8 bit channels can tell apart
+    static constexpr auto palette_size = 4096;
+    // every worker counts into this many interleaved copies of its histogram: neighbouring pixels mostly fall in the
+    // same bin, and with a single copy every increment would wait for the previous one
+    static constexpr auto copies = 4;
+
+    std::vector<std::vector<std::uint32_t>> _partial;
+    std::vector<float> _cdf;
+    // rgba pixels and their luma, one entry per step of the cdf
+    std::vector<std::uint32_t> _palette = std::vector<std::uint32_t>(palette_size);
+    std::vector<std::uint32_t> _palette_luma = std::vector<std::uint32_t>(palette_size);
+
+    // the first and one past the last of `total` things that slice k of `count` gets
+    static auto slice(std::size_t total, int k, int count) noexcept -> std::pair<std::size_t, std::size_t> {
+        return { total * static_cast<std::size_t>(k) / static_cast<std::size_t>(count),
+                 total * static_cast<std::size_t>(k + 1) / static_cast<std::size_t>(count) };
+    }
+
+public:
+    // every step fans out on the workers, see async_task.hpp. sync_wait() it from a thread outside of them
+    auto apply(task_system & tasks, render_frame & frame, render_settings const & settings,
+               task_priority priority = task_priority::interactive) -> async_task<> {
+        auto scope = trace_scope("equalize", "kernel");
+        const auto width = frame.image.width();
+        const auto height = frame.image.height();
+        const auto bins = std::min(settings.max_iter, max_bins);
+        const auto fmax_iter = static_cast<float>(settings.max_iter);
+        const auto bin_scale = static_cast<float>(bins) / fmax_iter;
+        const auto slices = static_cast<int>(std::min<std::size_t>(tasks.size(), height));
+
+        _partial.resize(static_cast<std::size_t>(slices));
+        for ( auto & h : _partial ) { h.assign(static_cast<std::size_t>(bins) * copies, 0); }
+        _cdf.resize(static_cast<std::size_t>(bins) + 1);
+
+        co_await parallel_for(tasks, priority, slices, [ & ] ( int k ) {
+            auto * histogram = _partial[static_cast<std::size_t>(k)].data();
+            const auto [first, last] = slice(height, k, slices);
+            for ( auto i = first * width; i < last * width; ++i ) {
+                const auto e = frame.escape[i];
+                // the points inside the set are left out, they are not colored through the cdf
+                if ( e >= fmax_iter ) { continue; }
+                const auto bin = std::min(static_cast<int>(e * bin_scale), bins - 1);
+                ++histogram[bin * copies + static_cast<int>(i % copies)];
+            }
+        });
+        // everything ends up in the first copy of the first histogram
+        co_await parallel_for(tasks, priority, slices, [ & ] ( int k ) {
+            const auto [first, last] = slice(static_cast<std::size_t>(bins), k, slices);
+            auto & total = _partial[0];
+            for ( auto b = first; b < last; ++b ) {
+                auto sum = std::uint32_t{0};
+                for ( auto const & histogram : _partial ) {
+                    for ( auto c{0u}; c < copies; ++c ) { sum += histogram[b * copies + c]; }
+                }
+                total[b * copies] = sum;
+            }
+        });
+        // _cdf[b] is the fraction of the outside pixels in the bins before b, so the pixels of bin b go from _cdf[b]
+        // to _cdf[b + 1] and get interpolated in between
+        auto sum = std::uint64_t{0};
+        for ( auto b{0}; b < bins; ++b ) {
+            _cdf[static_cast<std::size_t>(b)] = static_cast<float>(sum);
+            sum += _partial[0][static_cast<std::size_t>(b) * copies];
+        }
+        _cdf[static_cast<std::size_t>(bins)] = static_cast<float>(sum);
+        const auto norm = sum > 0 ? 1.f / static_cast<float>(sum) : 0.f;
+        for ( auto & c : _cdf ) { c *= norm; }
+
+        fill_palette(settings);
+
+        co_await parallel_for(tasks, priority, slices, [ & ] ( int k ) {
+            const auto [first, last] = slice(height, k, slices);
+            for ( auto line = first; line < last; ++line ) { color_line(frame, settings, line, bins); }
+        });
+    }
+
+private:
+    auto fill_palette(render_settings const & settings) noexcept -> void {
+        const auto _255 = _mm256_set1_ps(255.f);
+        const auto _half = _mm256_set1_ps(0.5f);
+        for ( auto p{0}; p < palette_size; p += 8 ) {
+            const auto _t = _mm256_mul_ps(_mm256_add_ps(_mm256_set1_ps(static_cast<float>(p)),
+                                                        _mm256_set_ps(7.f, 6.f, 5.f, 4.f, 3.f, 2.f, 1.f, 0.f)),
+                                          _mm256_set1_ps(1.f / (palette_size - 1)));
+            auto red = __m256{};
+            auto green = __m256{};
+            auto blue = __m256{};
+            if ( settings.colored_pic ) {
+                // the same sine palette as the first coloring algorithm, one and a half turns over the whole cdf
+                const auto _n = _mm256_mul_ps(_t, _mm256_set1_ps(3 * std::numbers::pi_v<float>));
+                red = (sin256_ps(_n) * _half + _half) * _255;
+                green = (sin256_ps(_n + _mm256_set1_ps(2.094f)) * _half + _half) * _255;
+                blue = (sin256_ps(_n + _mm256_set1_ps(4.188f)) * _half + _half) * _255;
+            } else {
+                // white for the fastest to escape, like the black and white algorithm
+                red = (_mm256_set1_ps(1.f) - _t) * _255;
+                green = red;
+                blue = red;
+            }
+            _mm256_storeu_si256(reinterpret_cast<__m256i *>(_palette.data() + p), pack_rgba(red, green, blue));
+            _mm256_storeu_si256(reinterpret_cast<__m256i *>(_palette_luma.data() + p), luma(red, green, blue));
+        }
+    }
+
+    auto color_line(render_frame & frame, render_settings const & settings, std::size_t line, int bins) const noexcept
+        -> void
+    {
+        const auto width = frame.image.width();
+        const auto row = line * width;
+        auto * pixels = &*frame.image.get_pixel_iterator(0, line);
+        const auto _max_iter = _mm256_set1_ps(static_cast<float>(settings.max_iter));
+        const auto _bin_scale = _mm256_set1_ps(static_cast<float>(bins) / static_cast<float>(settings.max_iter));
+        const auto _last_bin = _mm256_set1_ps(static_cast<float>(bins) - 1.f);
+        const auto _steps = _mm256_set1_ps(static_cast<float>(palette_size - 1));
+        // inside the set is black
+        const auto _black = _mm256_set1_epi32(static_cast<int>(0xff000000));
+        for ( auto x{0u}; x < width; x += 8 ) {
+            const auto tail = tail_mask(x, width);
+            const auto _escape = _mm256_maskz_loadu_ps(tail, frame.escape.data() + row + x);
+            const auto _inside = _mm256_cmp_ps_mask(_escape, _max_iter, _CMP_GE_OQ);
+            const auto _pos = _mm256_min_ps(_mm256_mul_ps(_escape, _bin_scale), _last_bin);
+            const auto _bin = _mm256_floor_ps(_pos);
+            const auto _index = _mm256_cvttps_epi32(_bin);
+            const auto _low = _mm256_i32gather_ps(_cdf.data(), _index, 4);
+            const auto _high = _mm256_i32gather_ps(_cdf.data() + 1, _index, 4);
+            const auto _t = _mm256_fmadd_ps(_mm256_sub_ps(_pos, _bin), _mm256_sub_ps(_high, _low), _low);
+            const auto _entry = _mm256_cvtps_epi32(_mm256_mul_ps(_t, _steps));
+            auto _px = _mm256_i32gather_epi32(reinterpret_cast<int const *>(_palette.data()), _entry, 4);
+            auto _luma = _mm256_i32gather_epi32(reinterpret_cast<int const *>(_palette_luma.data()), _entry, 4);
+            _px = _mm256_mask_blend_epi32(_inside, _px, _black);
+            _luma = _mm256_mask_blend_epi32(_inside, _luma, _mm256_setzero_si256());
+            _mm256_mask_storeu_epi32(pixels + x, tail, _px);
+            _mm256_mask_cvtepi32_storeu_epi8(frame.luma.data() + row + x, tail, _luma);
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,203 @@
+#ifndef FORMULAS_HPP
+#define FORMULAS_HPP
+
+#include <immintrin.h>
+#include <array>
+#include <optional>
+#include <string_view>
+
+
+// the fractal formulas, as policies for the escape loop in mandel_kernel.hpp.
+// every policy has the same two static functions:
+//  - init() takes the point of the plane a lane is sampling, plus the fixed julia parameter, and returns the starting
+//    z and the c of the iteration
+//  - step() does z = f(z) + c in place. it gets z^2 split in re^2 and im^2, which the escape loop computes anyway
+//    for the modulus, so the quadratic formulas don't have to square again.
+// and two flags: `analytic` formulas also have derivative(), which does d = f'(z) * d in place and is what the
+// distance estimation and the interior detection are built on, and `c_is_pixel` tells whether c or z_0 is the pixel.
+// the kernel is instantiated once per formula and the choice is made once per batch of 8 samples, outside of the
+// iteration, so there is no branch nor indirect call inside the loop.
+
+enum class formula_kind {
+    mandelbrot,
+    julia,
+    multibrot3,
+    multibrot4,
+    multibrot5,
+    burning_ship,
+    tricorn,
+};
+
+constexpr auto formula_names = std::array<std::string_view, 7>{
+    "mandelbrot", "julia", "multibrot3", "multibrot4", "multibrot5", "burning_ship", "tricorn"
+};
+
+constexpr auto formula_name(formula_kind f) noexcept -> std::string_view
+{
+    return formula_names[static_cast<std::size_t>(f)];
+}
+
+constexpr auto parse_formula(std::string_view name) noexcept -> std::optional<formula_kind>
+{
+    for ( auto f{0u}; f < formula_names.size(); ++f ) {
+        if ( formula_names[f] == name ) { return static_cast<formula_kind>(f); }
+    }
+    return std::nullopt;
+}
+
+// the next formula in the list, wrapping around, for the gui
+constexpr auto next_formula(formula_kind f) noexcept -> formula_kind
+{
+    return static_cast<formula_kind>((static_cast<std::size_t>(f) + 1) % formula_names.size());
+}
+
+struct orbit_start {
+    __m512d z_re;
+    __m512d z_im;
+    __m512d c_re;
+    __m512d c_im;
+};
+
+// the complex product (a_re + i a_im) * (b_re + i b_im), stored into a
+__attribute__ ((always_inline)) inline auto complex_mul(__m512d & _a_re, __m512d & _a_im, __m512d _b_re, __m512d _b_im)
+    noexcept -> void
+{
+    auto _t = _mm512_fmsub_pd(_a_re, _b_re, _a_im * _b_im);
+    _a_im = _mm512_fmadd_pd(_a_re, _b_im, _a_im * _b_re);
+    _a_re = _t;
+}
+
+// z_0 = 0 and c is the pixel: the classic
+struct mandelbrot_formula {
+    static constexpr auto analytic = true;
+    static constexpr auto c_is_pixel = true;
+
+    __attribute__ ((always_inline)) static auto init(__m512d _px_re, __m512d _px_im, __m512d, __m512d) noexcept
+        -> orbit_start {
+        return { _mm512_setzero_pd(), _mm512_setzero_pd(), _px_re, _px_im };
+    }
+
+    __attribute__ ((always_inline)) static auto step(__m512d & _r, __m512d & _i, __m512d _r2, __m512d _i2,
+                                                     __m512d _c_re, __m512d _c_im) noexcept -> void {
+        auto _tr = (_r2 - _i2) + _c_re;
+        _i = _mm512_fmadd_pd( _r + _r, _i, _c_im );
+        _r = _tr;
+    }
+
+    // f'(z) = 2z
+    __attribute__ ((always_inline)) static auto derivative(__m512d _r, __m512d _i, __m512d & _d_re, __m512d & _d_im)
+        noexcept -> void {
+        complex_mul(_d_re, _d_im, _r + _r, _i + _i);
+    }
+};
+
+// same iteration, but z_0 is the pixel and c is fixed
+struct julia_formula {
+    static constexpr auto analytic = true;
+    static constexpr auto c_is_pixel = false;
+
+    __attribute__ ((always_inline)) static auto init(__m512d _px_re, __m512d _px_im, __m512d _j_re, __m512d _j_im)
+        noexcept -> orbit_start {
+        return { _px_re, _px_im, _j_re, _j_im };
+    }
+
+    __attribute__ ((always_inline)) static auto step(__m512d & _r, __m512d & _i, __m512d _r2, __m512d _i2,
+                                                     __m512d _c_re, __m512d _c_im) noexcept -> void {
+        mandelbrot_formula::step(_r, _i, _r2, _i2, _c_re, _c_im);
+    }
+
+    __attribute__ ((always_inline)) static auto derivative(__m512d _r, __m512d _i, __m512d & _d_re, __m512d & _d_im)
+        noexcept -> void {
+        mandelbrot_formula::derivative(_r, _i, _d_re, _d_im);
+    }
+};
+
+// z = z^D + c: z^2 and then D-2 more complex multiplications, unrolled at compile time
+template<int D>
+struct multibrot_formula {
+    static_assert(D >= 2, "a multibrot needs at least z^2");
+    static constexpr auto analytic = true;
+    static constexpr auto c_is_pixel = true;
+
+    __attribute__ ((always_inline)) static auto init(__m512d _px_re, __m512d _px_im, __m512d _j_re, __m512d _j_im)
+        noexcept -> orbit_start {
+        return mandelbrot_formula::init(_px_re, _px_im, _j_re, _j_im);
+    }
+
+    __attribute__ ((always_inline)) static auto step(__m512d & _r, __m512d & _i, __m512d _r2, __m512d _i2,
+                                                     __m512d _c_re, __m512d _c_im) noexcept -> void {
+        // start from z^2, which is already half computed
+        auto _w_re = _r2 - _i2;
+        auto _w_im = (_r + _r) * _i;
+#pragma GCC unroll 8
+        for ( auto n{2}; n < D; ++n ) { complex_mul(_w_re, _w_im, _r, _i); }
+        _r = _w_re + _c_re;
+        _i = _w_im + _c_im;
+    }
+
+    // f'(z) = D z^(D-1)
+    __attribute__ ((always_inline)) static auto derivative(__m512d _r, __m512d _i, __m512d & _d_re, __m512d & _d_im)
+        noexcept -> void {
+        const auto _d = _mm512_set1_pd(D);
+        auto _w_re = _r * _d;
+        auto _w_im = _i * _d;
+#pragma GCC unroll 8
+        for ( auto n{2}; n < D; ++n ) { complex_mul(_w_re, _w_im, _r, _i); }
+        complex_mul(_d_re, _d_im, _w_re, _w_im);
+    }
+};
+
+// z = (|re z| + i |im z|)^2 + c
+struct burning_ship_formula {
+    static constexpr auto analytic = false;
+    static constexpr auto c_is_pixel = true;
+
+    __attribute__ ((always_inline)) static auto init(__m512d _px_re, __m512d _px_im, __m512d _j_re, __m512d _j_im)
+        noexcept -> orbit_start {
+        return mandelbrot_formula::init(_px_re, _px_im, _j_re, _j_im);
+    }
+
+    __attribute__ ((always_inline)) static auto step(__m512d & _r, __m512d & _i, __m512d _r2, __m512d _i2,
+                                                     __m512d _c_re, __m512d _c_im) noexcept -> void {
+        auto _tr = (_r2 - _i2) + _c_re;
+        _i = _mm512_abs_pd( _r + _r ) * _mm512_abs_pd( _i ) + _c_im;
+        _r = _tr;
+    }
+};
+
+// z = conj(z)^2 + c
+struct tricorn_formula {
+    static constexpr auto analytic = false;
+    static constexpr auto c_is_pixel = true;
+
+    __attribute__ ((always_inline)) static auto init(__m512d _px_re, __m512d _px_im, __m512d _j_re, __m512d _j_im)
+        noexcept -> orbit_start {
+        return mandelbrot_formula::init(_px_re, _px_im, _j_re, _j_im);
+    }
+
+    __attribute__ ((always_inline)) static auto step(__m512d & _r, __m512d & _i, __m512d _r2, __m512d _i2,
+                                                     __m512d _c_re, __m512d _c_im) noexcept -> void {
+        auto _tr = (_r2 - _i2) + _c_re;
+        _i = _mm512_fnmadd_pd( _r + _r, _i, _c_im );
+        _r = _tr;
+    }
+};
+
+// calls `f.template operator()<Policy>()` with the policy of `kind`, this is the only place where the formula is
+// a runtime value
+template<typename F>
+__attribute__ ((always_inline)) inline auto with_formula(formula_kind kind, F && f)
+{
+    switch ( kind ) {
+        case formula_kind::julia:        return f.template operator()<julia_formula>();
+        case formula_kind::multibrot3:   return f.template operator()<multibrot_formula<3>>();
+        case formula_kind::multibrot4:   return f.template operator()<multibrot_formula<4>>();
+        case formula_kind::multibrot5:   return f.template operator()<multibrot_formula<5>>();
+        case formula_kind::burning_ship: return f.template operator()<burning_ship_formula>();
+        case formula_kind::tricorn:      return f.template operator()<tricorn_formula>();
+        case formula_kind::mandelbrot:
+        default:                         return f.template operator()<mandelbrot_formula>();
+    }
+}
+
+#endif
@@ -0,0 +1,110 @@
+#ifndef FRAME_PIPELINE_HPP
+#define FRAME_PIPELINE_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+
+#include "custom_locks.hpp"
+#include "mandel_kernel.hpp"
+
+
+// what the gui wants to see, as of the last input event
+struct frame_request {
+    viewport view;
+    render_settings settings;
+    std::size_t width{0};
+    std::size_t height{0};
+    bool trace{false};
+    // the iteration limit is picked per frame, and the one in the settings ignored, see auto_iterations.hpp
+    bool auto_iterations{false};
+};
+
+// a request picked up by the compute thread
+struct frame_ticket {
+    frame_request request;
+    std::uint64_t generation;
+    std::uint64_t cancels;
+};
+
+// hands the frame requests over from the gui thread to the compute thread.
+// the gui posts whenever the input changes something, without waiting for anything: every request posted while a
+// frame is being rendered folds into the last one, and posting makes the frame in progress stale, so its lines still
+// queued in the task system return right away and the new frame starts as soon as the compute thread notices.
+// the high res renders don't go through here, see background_render.hpp
+class frame_pipeline {
+    spin_mutex _mutex;
+    frame_request _latest{};
+    // bumped by every request that replaces the one on screen, it's what makes a frame stale
+    std::atomic<std::uint64_t> _generation{0};
+    // bumped by cancel()
+    std::atomic<std::uint64_t> _cancels{0};
+    // bumped by every post, it's what the compute thread waits on
+    std::atomic<std::uint64_t> _posted{0};
+    std::uint64_t _taken{0};
+    bool _closed{false};
+
+    auto wake() noexcept -> void {
+        _posted.fetch_add(1, std::memory_order_release);
+        _posted.notify_all();
+    }
+
+public:
+    auto post(frame_request const & request) -> void {
+        {
+            auto lock = std::lock_guard{_mutex};
+            _latest = request;
+            _generation.fetch_add(1, std::memory_order_relaxed);
+        }
+        wake();
+    }
+
+    // makes the frame in progress stale without asking for another one
+    auto cancel() -> void {
+        {
+            auto lock = std::lock_guard{_mutex};
+            _cancels.fetch_add(1, std::memory_order_relaxed);
+        }
+        wake();
+    }
+
+    // wakes up take() for good
+    auto close() -> void {
+        {
+            auto lock = std::lock_guard{_mutex};
+            _closed = true;
+        }
+        wake();
+    }
+
+    // blocks until there is a request newer than the last one taken, nothing once the pipeline is closed
+    auto take() -> std::optional<frame_ticket> {
+        while ( true ) {
+            const auto posted = _posted.load(std::memory_order_acquire);
+            {
+                auto lock = std::lock_guard{_mutex};
+                if ( _closed ) { return std::nullopt; }
+                const auto generation = _generation.load(std::memory_order_relaxed);
+                if ( generation != _taken ) {
+                    _taken = generation;
+                    return frame_ticket{ _latest, generation, _cancels.load(std::memory_order_relaxed) };
+                }
+            }
+            _posted.wait(posted, std::memory_order_acquire);
+        }
+    }
+
+    // whether take() would return right away
+    auto pending() -> bool {
+        auto lock = std::lock_guard{_mutex};
+        return _closed || _generation.load(std::memory_order_relaxed) != _taken;
+    }
+
+    auto stale(frame_ticket const & ticket) const noexcept -> bool {
+        return _cancels.load(std::memory_order_relaxed) != ticket.cancels
+            || _generation.load(std::memory_order_relaxed) != ticket.generation;
+    }
+};
+
+#endif
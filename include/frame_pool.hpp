@@ -0,0 +1,51 @@
+#ifndef FRAME_POOL_HPP
+#define FRAME_POOL_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+#include "mandel_kernel.hpp"
+
+
+// a frame on its way through the workers
+struct frame_job {
+    render_frame frame;
+
+    frame_job(std::size_t width, std::size_t height) : frame(width, height) {}
+};
+
+// the frames the gui renders, handed out again once nobody holds them anymore instead of allocating ~9 bytes per
+// pixel for every single one. a frame is free when the pool holds the only reference left: the tasks, the gui and
+// the caches all keep a shared_ptr to whatever they still read.
+// only the compute thread calls acquire(), the other threads just drop their references
+class frame_pool {
+    std::vector<std::shared_ptr<frame_job>> _jobs;
+
+    static auto is_free(std::shared_ptr<frame_job> const & job) noexcept -> bool {
+        if ( job.use_count() != 1 ) { return false; }
+        // pairs with the release of whoever dropped the last other reference, so their writes are done
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return true;
+    }
+
+public:
+    // a frame of that size, with whatever a previous render left in it
+    auto acquire(std::size_t width, std::size_t height) -> std::shared_ptr<frame_job> {
+        auto fits = [ & ] ( auto const & job ) {
+            return job->frame.image.width() == width && job->frame.image.height() == height;
+        };
+        for ( auto const & job : _jobs ) {
+            if ( fits(job) && is_free(job) ) { return job; }
+        }
+        // the free frames of another size, like the one of the last high res render, are not worth keeping around
+        std::erase_if(_jobs, [ & ] ( auto const & job ) { return !fits(job) && is_free(job); });
+        return _jobs.emplace_back(std::make_shared<frame_job>(width, height));
+    }
+
+    auto size() const noexcept -> std::size_t { return _jobs.size(); }
+};
+
+#endif
@@ -0,0 +1,90 @@
+#ifndef FRAME_UPDATES_HPP
+#define FRAME_UPDATES_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "custom_locks.hpp"
+#include "mandel_kernel.hpp"
+
+
+// the lines of the frame being rendered that are ready to be shown, handed over from the render tasks to the gui
+// thread, which is the only one allowed to touch the textures.
+// the gui uploads them straight from the frame's own buffer, and it does it while holding the lock: so once
+// drained() is true, nobody is reading the frame anymore and the refinement pass can start writing to it again.
+class frame_updates {
+    spin_mutex _mutex;
+    std::shared_ptr<render_frame const> _frame;
+    viewport _view{};
+    std::uint64_t _serial{0};
+    bool _complete{false};
+    std::vector<std::size_t> _lines;
+
+public:
+    // which frame the lines of the last drain() belong to, and whether it's complete
+    struct status {
+        std::uint64_t serial;
+        viewport view;
+        bool complete;
+    };
+
+    // starts handing out the lines of a new frame, whatever was left of the previous one is dropped
+    auto begin(std::shared_ptr<render_frame const> frame, viewport const & view) -> void {
+        auto lock = std::lock_guard{_mutex};
+        _frame = std::move(frame);
+        _view = view;
+        ++_serial;
+        _complete = false;
+        _lines.clear();
+    }
+
+    auto line_done(std::size_t line) -> void {
+        auto lock = std::lock_guard{_mutex};
+        _lines.push_back(line);
+    }
+
+    // every line at once, for a frame that didn't need rendering
+    auto frame_done() -> void {
+        auto lock = std::lock_guard{_mutex};
+        _lines.resize(_frame ? _frame->image.height() : 0);
+        for ( auto n{0u}; n < _lines.size(); ++n ) { _lines[n] = n; }
+        _complete = true;
+    }
+
+    // no more lines are coming, the frame can be shown as a whole
+    auto complete() -> void {
+        auto lock = std::lock_guard{_mutex};
+        _complete = true;
+    }
+
+    auto drained() -> bool {
+        auto lock = std::lock_guard{_mutex};
+        return _lines.empty();
+    }
+
+    // calls upload(first_line, line_count, pixels) for every run of consecutive ready lines, where pixels points to
+    // the rgba bytes of the first of them. when the status says complete, every line of the frame has been handed out
+    template<typename F>
+    auto drain(F && upload) -> status {
+        auto lock = std::lock_guard{_mutex};
+        const auto current = status{ _serial, _view, _complete };
+        if ( _lines.empty() || !_frame ) { return current; }
+        std::ranges::sort(_lines);
+        const auto width = _frame->image.width();
+        const auto * pixels = &(_frame->image.raw_data()->r);
+        for ( auto first{0u}; first < _lines.size(); ) {
+            auto last = first + 1;
+            while ( last < _lines.size() && _lines[last] <= _lines[last - 1] + 1 ) { ++last; }
+            const auto line = _lines[first];
+            upload(line, _lines[last - 1] - line + 1, pixels + line * width * 4);
+            first = last;
+        }
+        _lines.clear();
+        return current;
+    }
+};
+
+#endif
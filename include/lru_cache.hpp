@@ -0,0 +1,80 @@
+#ifndef LRU_CACHE_HPP
+#define LRU_CACHE_HPP
+
+#include <cstddef>
+#include <functional>
+#include <list>
+#include <optional>
+#include <unordered_map>
+#include <utility>
+
+
+// a least recently used cache with a budget: every entry has a cost (its size in bytes, usually) and inserting past
+// the budget evicts the entries that were looked at the longest time ago.
+// it is not synchronized, whoever shares it between threads has to lock around it.
+template<typename Key, typename Value, typename Hash = std::hash<Key>>
+class lru_cache {
+    struct entry {
+        Key key;
+        Value value;
+        std::size_t cost;
+    };
+
+    // most recently used at the front
+    std::list<entry> _entries;
+    std::unordered_map<Key, typename std::list<entry>::iterator, Hash> _index;
+    std::size_t _budget;
+    std::size_t _cost{0};
+
+    auto evict_to(std::size_t budget) -> void {
+        while ( _cost > budget && !_entries.empty() ) {
+            auto & last = _entries.back();
+            _cost -= last.cost;
+            _index.erase(last.key);
+            _entries.pop_back();
+        }
+    }
+
+public:
+    explicit lru_cache(std::size_t budget) : _budget{budget} {}
+
+    // the value of `key`, which also becomes the most recently used entry
+    auto get(Key const & key) -> std::optional<Value> {
+        auto it = _index.find(key);
+        if ( it == _index.end() ) { return std::nullopt; }
+        _entries.splice(_entries.begin(), _entries, it->second);
+        return it->second->value;
+    }
+
+    auto contains(Key const & key) const -> bool { return _index.contains(key); }
+
+    // an entry costing more than the whole budget is not stored at all
+    auto insert(Key const & key, Value value, std::size_t cost) -> void {
+        erase(key);
+        if ( cost > _budget ) { return; }
+        evict_to(_budget - cost);
+        _entries.push_front(entry{ key, std::move(value), cost });
+        _index.emplace(key, _entries.begin());
+        _cost += cost;
+    }
+
+    auto erase(Key const & key) -> void {
+        auto it = _index.find(key);
+        if ( it == _index.end() ) { return; }
+        _cost -= it->second->cost;
+        _entries.erase(it->second);
+        _index.erase(it);
+    }
+
+    auto clear() -> void {
+        _entries.clear();
+        _index.clear();
+        _cost = 0;
+    }
+
+    auto size() const noexcept -> std::size_t { return _entries.size(); }
+    auto cost() const noexcept -> std::size_t { return _cost; }
+    auto budget() const noexcept -> std::size_t { return _budget; }
+};
+
+#endif
@@ -0,0 +1,618 @@
+#ifndef MANDEL_KERNEL_HPP
+#define MANDEL_KERNEL_HPP
+
+#include <immintrin.h>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <latch>
+#include <utility>
+#include <vector>
+
+#include "async_task.hpp"
+#include "avx_mathfun.hpp"
+#include "avx_pcg.hpp"
+#include "formulas.hpp"
+#include "render_trace.hpp"
+#include "spl/image.hpp"
+#include "task_system.hpp"
+
+
+// the region of the complex plane mapped onto the image
+struct viewport {
+    double min_re{-2.0};
+    double max_re{1.0};
+    double min_im{-1.5};
+    double max_im{1.5};
+};
+
+// everything the kernel needs to know about how to render a frame, copied once per frame so that the gui can keep
+// changing its own state while the workers are running
+struct render_settings {
+    int max_iter{256};
+    int anti_aliasing{1};
+    // adaptive anti aliasing: the first pass takes `anti_aliasing` samples per pixel, then only the pixels whose
+    // neighbourhood shows some detail get extra samples, up to `max_samples` in total.
+    // with max_samples == anti_aliasing the refinement pass is skipped altogether.
+    int max_samples{1};
+    bool colored_pic{true};
+    bool first_color{true};
+    formula_kind formula{formula_kind::mandelbrot};
+    // the fixed c of the julia formula
+    double julia_re{-0.8};
+    double julia_im{0.156};
+    // shade by the distance estimate, which shows the filaments thinner than a pixel
+    bool distance_estimation{false};
+    // stop the lanes as soon as their orbit is caught in an attracting cycle instead of running them to max_iter.
+    // off unless asked for, so the default frames and the iteration counts of the benchmark stay what they were
+    bool interior_detection{false};
+    // color through the histogram of the escape counts of the whole frame, see equalize.hpp. it's done after the
+    // render, whoever renders the frame has to apply it
+    bool equalized{false};
+    // write the pixels around the caches, for the frames too big to be still there by the time they are read again.
+    // it doesn't change the picture, so it's not part of the cache keys
+    bool streaming_stores{false};
+};
+
+// a pixel is refined if the luma of its 3x3 neighbourhood spans more than this, or if the neighbourhood has both
+// points inside the set and points outside of it
+constexpr auto luma_threshold = 24;
+
+// the image plus the per-pixel data of the first pass.
+// the refinement pass needs to look at the neighbours of a pixel as they were after the first pass, so the data
+// it reads lives in these two buffers, which only the first pass writes to.
+// a frame can also be a band of a taller picture, `total_height` lines tall, starting at its line `first_line`: the
+// lines are still placed on the plane as in the whole picture, so the band comes out exactly as the same lines of the
+// whole picture would.
+// the viewport is stretched over the picture, width and height can be anything: a view with the same aspect ratio as
+// the picture gives square pixels.
+struct render_frame {
+    spl::graphics::image image;
+    std::vector<float> escape;
+    std::vector<std::uint8_t> luma;
+    std::size_t first_line{0};
+    std::size_t total_height{0};
+
+    render_frame(std::size_t width, std::size_t height, std::size_t first = 0, std::size_t total = 0)
+        : image(width, height), escape(width * height), luma(width * height), first_line{first},
+          total_height{total > 0 ? total : height} {}
+};
+
+// the red, green and blue contribution of 8 samples, plus how many iterations each of them took
+struct samples_t {
+    __m256 red;
+    __m256 green;
+    __m256 blue;
+    __m256 iters;
+};
+
+// below this |dz/dz_0|^2 the orbit has been contracting for long enough to be caught in an attracting cycle, so the
+// point is inside the set and there is no need to run it up to max_iter
+constexpr auto interior_threshold = 1e-24;
+
+// iterates the 8 points (_px_re, _px_im) with Formula and colors them with the current coloring algorithm.
+// Distance tracks dz/dc alongside z, for the distance estimation coloring, and Interior tracks dz/dz_0 to stop the
+// lanes that fell into an attracting cycle. both only make sense for the analytic formulas, and cost nothing when off.
+template<typename Formula, bool Distance = false, bool Interior = false>
+inline auto sample_formula(render_settings const & settings, __m512d _px_re, __m512d _px_im, double pixel_size)
+    noexcept -> samples_t
+{
+    static_assert(Formula::analytic || !(Distance || Interior), "derivatives need an analytic formula");
+    const auto _max_iter = _mm512_set1_epi64(settings.max_iter);
+    const auto _brdc = _mm512_setzero_si512();
+    const auto _escape_radius = _mm512_set1_pd(1000);
+    const auto _255 = _mm256_set1_ps(255);
+
+    auto [_r, _i, _c_re, _c_im] = Formula::init(_px_re, _px_im, _mm512_set1_pd(settings.julia_re),
+                                                _mm512_set1_pd(settings.julia_im));
+    auto _iter = _mm512_setzero_si512();
+    auto _iter_mask = 0b0;
+    auto _mod_mask = 0b0;
+    auto _check = 0b0;
+    auto _mod = _mm512_setzero_pd();
+    // dz/dc starts at 0 when c is the pixel (dz_0/dc = 0) and at 1 for the julia sets, where the pixel is z_0.
+    // _dmod is |dz/dc|^2 taken at the same iteration as _mod
+    const auto _one = _mm512_set1_pd(1.);
+    auto _dc_re = Formula::c_is_pixel ? _mm512_setzero_pd() : _one;
+    auto _dc_im = _mm512_setzero_pd();
+    auto _dmod = _mm512_setzero_pd();
+    auto _dz_re = _one;
+    auto _dz_im = _mm512_setzero_pd();
+    __mmask8 _interior = 0;
+    // the idea inside this loop is:
+    // we store all the x and y values of the 8 complex numbers and apply the steps of the formula.
+    // we store all the iterations and abs of out points.
+    // we compare after one iteration if any point escapes generating a mask set for each point not escaped.
+    // we also check if the current iteration is greater than the max, and we generate a mask set for each
+    // point whose iteration is less than the max.
+    // basically, we are saying "a point is still valid if it's inside both the escape time and radius" so
+    // we bit-wise _and_ the two masks to check if any of the two loop condition are *not* verified.
+    // when a point fails at least one of the two condition, the relative mask bit will be set to 0 and
+    // since the mask is a simple 8-bit unsigned number, if the mask is 0 it means _all_ 8 points failed
+    // at least one of the two condition, and we exit the loop.
+    // if we are still looping, meaning at least 1 point is valid, we update the iteration counter
+    // and the new absolute value only for the valid ones.
+    do {
+        auto _r2 = (_r * _r);
+        auto _i2 = (_i * _i);
+        auto _tmp_mod = (_r2 + _i2);
+        _mod_mask = _mm512_cmp_pd_mask( _tmp_mod, _escape_radius, _CMP_LT_OQ );
+        // dz/dc_(n+1) = f'(z_n) dz/dc_n (+ 1), so it goes before the step. the lanes that already escaped keep going
+        // like z does, their values are just never looked at again
+        if constexpr ( Distance ) {
+            _dmod = _mm512_mask_blend_pd(_mod_mask, _dmod, _dc_re * _dc_re + _dc_im * _dc_im);
+            Formula::derivative(_r, _i, _dc_re, _dc_im);
+            if constexpr ( Formula::c_is_pixel ) { _dc_re += _one; }
+        }
+        Formula::step(_r, _i, _r2, _i2, _c_re, _c_im);
+        // this one instead uses the new z: with the pixel as c, z_0 is always 0 and f'(z_0) would zero everything,
+        // so the product starts from f'(z_1)
+        if constexpr ( Interior ) {
+            Formula::derivative(_r, _i, _dz_re, _dz_im);
+            auto _dz_mod = _dz_re * _dz_re + _dz_im * _dz_im;
+            _interior |= _mm512_mask_cmp_pd_mask( _mod_mask, _dz_mod, _mm512_set1_pd(interior_threshold), _CMP_LT_OQ );
+        }
+        _iter_mask = _mm512_cmplt_epi64_mask( _iter, _max_iter );
+        _check = _iter_mask & _mod_mask;
+        if constexpr ( Interior ) { _check &= ~_interior; }
+        if constexpr ( tracing_enabled ) { render_trace::count_lanes(static_cast<std::uint8_t>(_check)); }
+        auto _c = _mm512_mask_set1_epi64( _brdc, _check, 1 );
+        _iter = _iter + _c;
+        _mod = _mm512_mask_blend_pd(_mod_mask, _mod, _tmp_mod);
+    } while ( _check > 0 );
+    if constexpr ( Interior ) {
+        // the lanes stopped early are inside the set, for everything that follows it's as if they hit max_iter
+        _iter = _mm512_mask_mov_epi64(_iter, _interior, _max_iter);
+        _iter_mask &= ~_interior;
+    }
+
+    auto result = samples_t{ _mm256_setzero_ps(), _mm256_setzero_ps(), _mm256_setzero_ps(),
+                             _mm512_cvtepi64_ps(_iter) };
+    // two coloring algorithms found online, feel free to change them!
+    // the first one is picked from the javidx9 YouTube video that inspired the project
+    // and despite beautiful colors it's affected by banding and noise, meaning two adjacent points could
+    // have completely different colors, making the pictures quite ugly near singular points.
+    if ( settings.colored_pic ) {
+        if ( settings.first_color ) {
+            auto _n = _mm256_set1_ps(0.1) * _mm512_cvtepi64_ps(_iter);
+            const auto _half = _mm256_set1_ps(0.5);
+            auto _red = sin256_ps(_n) * _half;
+            auto _green = sin256_ps(_n + _mm256_set1_ps(2.094)) * _half;
+            auto _blue = sin256_ps(_n + _mm256_set1_ps(4.188)) * _half;
+            _red = (_red + _half);
+            _green = (_green + _half);
+            _blue = (_blue + _half);
+            result.red = (_red * _255);
+            result.green = (_green * _255);
+            result.blue = (_blue * _255);
+        } else {
+            // if all points reached max iter we can skip all the computation for the colors
+            if (_iter_mask == 0b0) {
+                result.red = _mm256_set1_ps(64);
+                result.green = _mm256_set1_ps(64);
+                result.blue = _mm256_set1_ps(64);
+                return result;
+            }
+            __m512i tmp_red;
+            __m512i tmp_green;
+            __m512i tmp_blue;
+            _iter += _mm512_set1_epi64(2);
+            auto _final_iters = _mm512_cvtpd_ps(smooth_iter512_pd(_mm512_cvtepi64_pd(_iter), _mod));
+            _final_iters = _mm256_max_ps(_final_iters, _mm256_set1_ps(0));
+            auto periodic_color = [&](int c) {
+                if (c < 128) return 128 + c;
+                else if (c < 384) return 383 - c;
+                return c - 384;
+            };
+            for (auto t{0}; t < 8; ++t) {
+                auto a = std::sqrt(_final_iters[t]) * 8;
+                tmp_red[t] = periodic_color(static_cast<int>(floor(a * 2)) % 512);
+                tmp_green[t] = periodic_color(static_cast<int>(floor(a * 3)) % 512);
+                tmp_blue[t] = periodic_color(static_cast<int>(floor(a * 5)) % 512);
+            }
+            tmp_red = _mm512_mask_blend_epi64(_iter_mask, _mm512_set1_epi64(64), tmp_red);
+            tmp_green = _mm512_mask_blend_epi64(_iter_mask, _mm512_set1_epi64(64), tmp_green);
+            tmp_blue = _mm512_mask_blend_epi64(_iter_mask, _mm512_set1_epi64(64), tmp_blue);
+            result.red = _mm512_cvtepi64_ps(tmp_red);
+            result.green = _mm512_cvtepi64_ps(tmp_green);
+            result.blue = _mm512_cvtepi64_ps(tmp_blue);
+        }
+    }
+    // this other algorithm is the classic mandelbrot black and white, it has excellent smooth blending but
+    // with the way I handle iterations (basically << 1 or >> 1) I don't have much control over the shadow
+    // and the overall image it's either too bright or too dark, and thus details are not so visible.
+    // also, I'm using the dumb way to make BW pixels, basically (r,r,r), and the human eye doesn't perceive
+    // each r-g-b color with the same sensitivity, so I should change the way the final rgb pixel is made.
+    else {
+        _iter += _mm512_set1_epi64(1);
+        // the smooth iteration count stays in double all the way, only the color is narrowed
+        auto _final_iters = _mm512_cvtpd_ps(smooth_iter512_pd(_mm512_cvtepi64_pd(_iter), _mod));
+        auto frac = _final_iters / _mm512_cvtepi64_ps(_max_iter);
+        auto stability = _mm256_min_ps(frac, _mm256_set1_ps(1.0));
+        stability = _mm256_max_ps(stability, _mm256_setzero_ps());
+        result.red = (_mm256_set1_ps(1) - stability) * _255;
+        result.green = result.red;
+        result.blue = result.red;
+    }
+    if constexpr ( Distance ) {
+        // distance estimation: d = |z| ln|z|^2 / |dz/dc|, in pixels. whatever is closer than a couple of pixels to
+        // the set gets darker, so the filaments show up even when no sample falls exactly on them
+        auto _ln_mod = log512_pd(_mod);
+        auto _distance = _mm512_sqrt_pd(_mod / _dmod) * _ln_mod / _mm512_set1_pd(2 * pixel_size);
+        _distance = _mm512_min_pd(_mm512_max_pd(_distance, _mm512_setzero_pd()), _one);
+        auto _shade = _mm512_cvtpd_ps(_mm512_sqrt_pd(_distance));
+        _shade = _mm256_mask_blend_ps(_iter_mask, _mm256_set1_ps(1), _shade);
+        result.red *= _shade;
+        result.green *= _shade;
+        result.blue *= _shade;
+    }
+    return result;
+}
+
+// iterates the 8 points (_px_re, _px_im) with the formula of the settings. this is where the formula and the
+// derivatives are picked, once per 8 samples, the escape loop itself is specialized for each of them.
+// pixel_size is the size of a pixel on the plane, for the distance estimation.
+inline auto sample(render_settings const & settings, __m512d _px_re, __m512d _px_im, double pixel_size) noexcept
+    -> samples_t
+{
+    return with_formula(settings.formula, [ & ] <typename Formula> () {
+        if constexpr ( Formula::analytic ) {
+            const auto distance = settings.distance_estimation;
+            const auto interior = settings.interior_detection;
+            if ( distance && interior ) { return sample_formula<Formula, true, true>(settings, _px_re, _px_im, pixel_size); }
+            if ( distance ) { return sample_formula<Formula, true, false>(settings, _px_re, _px_im, pixel_size); }
+            if ( interior ) { return sample_formula<Formula, false, true>(settings, _px_re, _px_im, pixel_size); }
+        }
+        return sample_formula<Formula>(settings, _px_re, _px_im, pixel_size);
+    });
+}
+
+// where the samples of 8 pixels are, from the centers of the pixels. a struct, not a std::pair: the attributes of the
+// vector types don't survive as template arguments
+struct sample_offsets {
+    __m512d _dx;
+    __m512d _dy;
+};
+
+// where the random numbers of the samples of 8 pixels start: the pixels x (one per lane) of line y, both counted in
+// the whole picture. see mix64 in avx_pcg.hpp: the same pixel always gets the same samples, whatever thread, band
+// or machine renders it, so a frame comes out bit for bit the same every time
+inline auto pixel_keys(__m512i _x, std::uint64_t y) noexcept -> __m512i
+{
+    return mix64(_mm512_or_epi64(_x, _mm512_set1_epi64(static_cast<long long>(y << 32))));
+}
+
+// the samples of a pixel are spread over a grid x grid stratification of the pixel area, and each of the 8 lanes
+// gets its own random position inside its stratum, so that neither the pixels of a line nor the samples of a
+// pixel end up all shifted by the same amount. sample i of a pixel takes the numbers 2i and 2i + 1 of its stream.
+// returns the x and y offsets, in pixels, from the center of the pixel.
+inline auto jitter(__m512i _keys, int sample_idx, int count) noexcept -> sample_offsets
+{
+    // with a single sample we just take the center of the pixel, random offsets would only add noise
+    if ( count == 1 ) { return { _mm512_setzero_pd(), _mm512_setzero_pd() }; }
+    const auto grid = static_cast<int>(std::ceil(std::sqrt(count)));
+    const auto stratum = sample_idx * grid * grid / count;
+    const auto _sx = _mm512_set1_pd(static_cast<double>(stratum % grid));
+    const auto _sy = _mm512_set1_pd(static_cast<double>(stratum / grid));
+    const auto _counter = _mm512_add_epi64(_keys, _mm512_set1_epi64(2 * sample_idx));
+    const auto _rx = to_unit(mix64(_counter));
+    const auto _ry = to_unit(mix64(_mm512_add_epi64(_counter, _mm512_set1_epi64(1))));
+    const auto _inv_grid = _mm512_set1_pd(1. / grid);
+    const auto _half = _mm512_set1_pd(0.5);
+    return { _mm512_fmsub_pd(_sx + _rx, _inv_grid, _half), _mm512_fmsub_pd(_sy + _ry, _inv_grid, _half) };
+}
+
+inline auto luma(float r, float g, float b) noexcept -> std::uint8_t
+{
+    return static_cast<std::uint8_t>(0.2126f * r + 0.7152f * g + 0.0722f * b);
+}
+
+// the same, for 8 pixels at a time, as 32 bit integers
+inline auto luma(__m256 _r, __m256 _g, __m256 _b) noexcept -> __m256i
+{
+    auto _l = _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(0.2126f), _r), _mm256_mul_ps(_mm256_set1_ps(0.7152f), _g));
+    _l = _mm256_add_ps(_l, _mm256_mul_ps(_mm256_set1_ps(0.0722f), _b));
+    return _mm256_cvttps_epi32(_l);
+}
+
+// packs 8 colors into 8 opaque rgba pixels, r in the lowest byte
+inline auto pack_rgba(__m256 _r, __m256 _g, __m256 _b) noexcept -> __m256i
+{
+    auto _px = _mm256_or_si256(_mm256_cvttps_epi32(_r), _mm256_slli_epi32(_mm256_cvttps_epi32(_g), 8));
+    _px = _mm256_or_si256(_px, _mm256_slli_epi32(_mm256_cvttps_epi32(_b), 16));
+    return _mm256_or_si256(_px, _mm256_set1_epi32(static_cast<int>(0xff000000)));
+}
+
+// the lanes of the 8 pixels starting at x that are still inside a line `width` pixels wide
+inline auto tail_mask(std::size_t x, std::size_t width) noexcept -> __mmask8
+{
+    return width - x >= 8 ? __mmask8{0xff} : static_cast<__mmask8>((1u << (width - x)) - 1);
+}
+
+// sums the iteration count of the 8 lanes
+inline auto total_iterations(__m256 _iters) noexcept -> std::uint64_t
+{
+    auto sum = 0.;
+    for ( auto t{0}; t < 8; ++t ) { sum += _iters[t]; }
+    return static_cast<std::uint64_t>(sum);
+}
+
+// this computes a single row of the fractal, the first pass of the adaptive AA.
+// returns the number of iterations it took, summed over every sample.
+inline auto render_line(render_frame & frame, viewport const & view, render_settings const & settings, int line)
+    noexcept -> std::uint64_t
+{
+    auto scope = trace_scope("render_line", "kernel", line);
+    auto & buffer = frame.image;
+    // the pixels go straight into the frame, which is also what the gui uploads from
+    auto * pixels = &*buffer.get_pixel_iterator(0, static_cast<std::size_t>(line));
+    auto iterations = std::uint64_t{0};
+
+    const auto width = buffer.width();
+    const auto pixel_size = (view.max_re - view.min_re) / static_cast<double>(width);
+    const auto _r_scale = _mm512_set1_pd(pixel_size);
+    const auto _i_scale = _mm512_set1_pd((view.max_im - view.min_im) / static_cast<double>(frame.total_height));
+    const auto _aa = _mm256_set1_ps(static_cast<float>(settings.anti_aliasing));
+    const auto row = static_cast<std::size_t>(line) * width;
+    // we move horizontally by 8 since we are computing 8 doubles at a time
+    for ( auto x{0u}; x < width; x += 8 ) {
+        // past the end of the line the lanes are computed anyway, they are just never stored
+        const auto tail = tail_mask(x, width);
+        auto red = _mm256_set1_ps(0);
+        auto green = _mm256_set1_ps(0);
+        auto blue = _mm256_set1_ps(0);
+        auto iters = _mm256_set1_ps(0);
+        const auto _keys = pixel_keys(_mm512_add_epi64(_mm512_set1_epi64(x), _mm512_set_epi64(7, 6, 5, 4, 3, 2, 1, 0)),
+                                      frame.first_line + static_cast<std::size_t>(line));
+        // the way I compute AA on this fractal is by doing something similar to what it's done with ray-tracing:
+        // basically I compute the color of a certain number of complex numbers around the one at the center of the
+        // pixel, and I average it after the for loop.
+        for ( auto aa{0}; aa < settings.anti_aliasing; ++aa ) {
+            auto [_dx, _dy] = jitter(_keys, aa, settings.anti_aliasing);
+            auto _r_offset = _mm512_set_pd(7., 6., 5., 4., 3., 2., 1., 0.);
+            _r_offset += _mm512_set1_pd( x ) + _dx;
+            auto _i_offset = _mm512_set1_pd( static_cast<double>(frame.first_line + line) ) + _dy;
+            auto _r_0 = _mm512_fmadd_pd(_r_scale, _r_offset, _mm512_set1_pd( view.min_re ));
+            auto _i_0 = _mm512_fmadd_pd(_i_scale, _i_offset, _mm512_set1_pd( view.min_im ));
+            auto s = sample(settings, _r_0, _i_0, pixel_size);
+            red += s.red;
+            green += s.green;
+            blue += s.blue;
+            iters += s.iters;
+        }
+        iterations += total_iterations(iters);
+        red = _mm256_div_ps(red, _aa);
+        green = _mm256_div_ps(green, _aa);
+        blue = _mm256_div_ps(blue, _aa);
+        iters = _mm256_div_ps(iters, _aa);
+        const auto _px = pack_rgba(red, green, blue);
+        auto * dst = pixels + x;
+        if ( settings.streaming_stores && tail == 0xff && reinterpret_cast<std::uintptr_t>(dst) % 32 == 0 ) {
+            _mm256_stream_si256(reinterpret_cast<__m256i *>(dst), _px);
+        } else {
+            _mm256_mask_storeu_epi32(dst, tail, _px);
+        }
+        _mm256_mask_storeu_ps(frame.escape.data() + row + x, tail, iters);
+        _mm256_mask_cvtepi32_storeu_epi8(frame.luma.data() + row + x, tail, luma(red, green, blue));
+    }
+    // the streaming stores are weakly ordered, they have to be out before whoever waits for the line looks at it
+    if ( settings.streaming_stores ) { _mm_sfence(); }
+    return iterations;
+}
+
+// the second pass of the adaptive AA: it looks at the 3x3 neighbourhood of every pixel in the line and, if there
+// is enough going on, it takes `max_samples - anti_aliasing` more samples and blends them with the first pass.
+// the pixels to refine are scattered around, so they get packed 8 at a time into the lanes.
+inline auto refine_line(render_frame & frame, viewport const & view, render_settings const & settings, int line)
+    noexcept -> std::uint64_t
+{
+    auto scope = trace_scope("refine_line", "kernel", line);
+    auto & buffer = frame.image;
+    auto iterations = std::uint64_t{0};
+    const auto width = static_cast<int>(buffer.width());
+    const auto height = static_cast<int>(buffer.height());
+    const auto extra = settings.max_samples - settings.anti_aliasing;
+    const auto fmax_iter = static_cast<float>(settings.max_iter);
+
+    auto needs_refinement = [ & ] ( int x ) -> bool {
+        auto min_luma = 255;
+        auto max_luma = 0;
+        auto inside = false;
+        auto outside = false;
+        for ( auto y = std::max(line - 1, 0); y <= std::min(line + 1, height - 1); ++y ) {
+            for ( auto xx = std::max(x - 1, 0); xx <= std::min(x + 1, width - 1); ++xx ) {
+                const auto idx = static_cast<std::size_t>(y) * width + xx;
+                min_luma = std::min<int>(min_luma, frame.luma[idx]);
+                max_luma = std::max<int>(max_luma, frame.luma[idx]);
+                (frame.escape[idx] >= fmax_iter ? inside : outside) = true;
+            }
+        }
+        return max_luma - min_luma > luma_threshold || ( inside && outside );
+    };
+
+    const auto pixel_size = (view.max_re - view.min_re) / static_cast<double>(buffer.width());
+    const auto _r_scale = _mm512_set1_pd(pixel_size);
+    const auto _i_scale = _mm512_set1_pd((view.max_im - view.min_im) / static_cast<double>(frame.total_height));
+    const auto _i_line = _mm512_set1_pd( static_cast<double>(frame.first_line + line) );
+    alignas(64) auto lanes = std::array<double, 8>{};
+    auto count = 0;
+
+    auto flush = [ & ] () {
+        // the unused lanes just repeat the last pixel, their result is thrown away
+        for ( auto t{count}; t < 8; ++t ) { lanes[t] = lanes[count - 1]; }
+        const auto _x = _mm512_load_pd(lanes.data());
+        // the first pass took the first samples of every pixel, these go on from there
+        const auto _keys = _mm512_add_epi64(pixel_keys(_mm512_cvttpd_epi64(_x), frame.first_line + line),
+                                            _mm512_set1_epi64(2 * settings.anti_aliasing));
+        auto red = _mm256_set1_ps(0);
+        auto green = _mm256_set1_ps(0);
+        auto blue = _mm256_set1_ps(0);
+        for ( auto aa{0}; aa < extra; ++aa ) {
+            auto [_dx, _dy] = jitter(_keys, aa, extra);
+            auto _r_0 = _mm512_fmadd_pd(_r_scale, _x + _dx, _mm512_set1_pd( view.min_re ));
+            auto _i_0 = _mm512_fmadd_pd(_i_scale, _i_line + _dy, _mm512_set1_pd( view.min_im ));
+            auto s = sample(settings, _r_0, _i_0, pixel_size);
+            red += s.red;
+            green += s.green;
+            blue += s.blue;
+            iterations += total_iterations(s.iters);
+        }
+        const auto base = static_cast<float>(settings.anti_aliasing);
+        const auto total = static_cast<float>(settings.max_samples);
+        for ( auto t{0}; t < count; ++t ) {
+            auto & pixel = *buffer.get_pixel_iterator(static_cast<std::size_t>(lanes[t]), line);
+            pixel.r = static_cast<uint8_t>((pixel.r * base + red[t]) / total);
+            pixel.g = static_cast<uint8_t>((pixel.g * base + green[t]) / total);
+            pixel.b = static_cast<uint8_t>((pixel.b * base + blue[t]) / total);
+        }
+        count = 0;
+    };
+
+    for ( auto x{0}; x < width; ++x ) {
+        if ( !needs_refinement(x) ) { continue; }
+        lanes[count++] = x;
+        if ( count == 8 ) { flush(); }
+    }
+    if ( count > 0 ) { flush(); }
+    return iterations;
+}
+
+// a run of consecutive lines rendered by a single task, and what they are expected to cost
+struct line_task {
+    int first;
+    int count;
+    float cost;
+};
+
+// the cost estimates are split in this many blocks of lines, a task each
+constexpr auto cost_blocks = 64;
+
+// fills costs with what every line of a frame `height` lines tall is expected to cost, estimate(first, last) giving
+// the lines of a block. on the workers, since with a lot of them even a millisecond spent estimating on a single
+// thread would cost more than the scheduling saves.
+// always as interactive tasks: they are tiny, and whoever waits here must not queue behind a whole export
+inline auto estimate_costs(task_system & tasks, int height, std::vector<float> & costs, auto estimate) -> async_task<>
+{
+    costs.resize(static_cast<std::size_t>(height));
+    const auto blocks = std::min(height, cost_blocks);
+    co_await parallel_for(tasks, task_priority::interactive, blocks, [ & ] ( int k ) {
+        estimate(height * k / blocks, height * (k + 1) / blocks);
+    });
+}
+
+// what each line of the first pass will cost, in iterations, from a pre-pass at a tiny fraction of the resolution:
+// 16 samples across the middle line of every block, which is about a thousandth of the samples of a 1000x1000
+// frame. the other lines of the block get the same cost
+inline auto first_pass_costs(task_system & tasks, render_frame const & frame, viewport const & view,
+                             render_settings const & settings, std::vector<float> & costs) -> async_task<>
+{
+    const auto width = frame.image.width();
+    const auto pixel_size = (view.max_re - view.min_re) / static_cast<double>(width);
+    const auto i_scale = (view.max_im - view.min_im) / static_cast<double>(frame.total_height);
+    const auto columns = static_cast<double>(width) / 16;
+    co_await estimate_costs(tasks, static_cast<int>(frame.image.height()), costs, [ & ] ( int first, int last ) {
+        const auto line = static_cast<double>(frame.first_line) + (first + last) / 2;
+        const auto _i_0 = _mm512_set1_pd(view.min_im + i_scale * line);
+        // whatever a sample costs besides the iterations, so that a block of points escaping right away isn't free
+        auto iters = _mm256_set1_ps(16.f);
+        for ( auto half{0}; half < 2; ++half ) {
+            auto _x = _mm512_set_pd(7.5, 6.5, 5.5, 4.5, 3.5, 2.5, 1.5, 0.5) + _mm512_set1_pd(8. * half);
+            auto _r_0 = _mm512_fmadd_pd(_mm512_set1_pd(pixel_size * columns), _x, _mm512_set1_pd(view.min_re));
+            iters += sample(settings, _r_0, _i_0, pixel_size).iters;
+        }
+        // the average of the 16 samples, over the whole line
+        const auto cost = static_cast<double>(total_iterations(iters)) * columns * settings.anti_aliasing;
+        std::fill(costs.begin() + first, costs.begin() + last, static_cast<float>(cost));
+    });
+}
+
+// what each line of the refinement will cost, from the first pass: the pixels that differ enough from their left
+// or upper neighbour to be refined, each weighted by its escape count. it's a cheaper check than the 3x3 one of
+// refine_line, and it doesn't need to be exact
+inline auto refinement_costs(task_system & tasks, render_frame const & frame, render_settings const & settings,
+                             std::vector<float> & costs) -> async_task<>
+{
+    const auto width = frame.image.width();
+    const auto fmax_iter = static_cast<float>(settings.max_iter);
+    const auto extra = static_cast<float>(settings.max_samples - settings.anti_aliasing);
+    co_await estimate_costs(tasks, static_cast<int>(frame.image.height()), costs, [ & ] ( int first, int last ) {
+        for ( auto line{first}; line < last; ++line ) {
+            const auto row = static_cast<std::size_t>(line) * width;
+            const auto above = line > 0 ? row - width : row;
+            auto cost = 0.f;
+            for ( auto x{1u}; x < width; ++x ) {
+                const auto i = row + x;
+                const auto inside = frame.escape[i] >= fmax_iter;
+                const auto edge = std::abs(frame.luma[i] - frame.luma[i - 1]) > luma_threshold
+                                  || std::abs(frame.luma[i] - frame.luma[above + x]) > luma_threshold
+                                  || inside != (frame.escape[i - 1] >= fmax_iter)
+                                  || inside != (frame.escape[above + x] >= fmax_iter);
+                if ( edge ) { cost += frame.escape[i] + 8.f; }
+            }
+            costs[static_cast<std::size_t>(line)] = cost * extra + static_cast<float>(width);
+        }
+    });
+}
+
+// the tasks of a pass, the most expensive first (longest processing time first): whatever is left at the end of the
+// frame is then only the cheap lines, which even out between the workers instead of leaving one of them alone with
+// the line along the set. the cheap lines are grouped up to lines_per_task at a time, the expensive ones always go
+// on their own, so that no task gets much longer than 1/8 of what a worker has to do for the whole pass
+inline auto schedule_lines(std::vector<float> const & costs, int lines_per_task, unsigned workers,
+                           std::vector<line_task> & tasks) -> void
+{
+    const auto height = static_cast<int>(costs.size());
+    auto total = 0.;
+    for ( auto c : costs ) { total += c; }
+    const auto target = static_cast<float>(total / (std::max(1u, workers) * 8.));
+    tasks.clear();
+    for ( auto first{0}; first < height; ) {
+        auto task = line_task{ first, 1, costs[static_cast<std::size_t>(first)] };
+        while ( task.count < lines_per_task && first + task.count < height
+                && task.cost + costs[static_cast<std::size_t>(first + task.count)] <= target ) {
+            task.cost += costs[static_cast<std::size_t>(first + task.count)];
+            ++task.count;
+        }
+        tasks.push_back(task);
+        first += task.count;
+    }
+    // the order of a stable sort on the costs, but without the buffer it allocates
+    std::ranges::sort(tasks, [ ] ( line_task const & a, line_task const & b ) {
+        return a.cost > b.cost || (a.cost == b.cost && a.first < b.first);
+    });
+}
+
+// renders both passes of a frame on the task system and blocks until they are done, without any progress report.
+// the lines go out the most expensive first, up to `lines_per_task` cheap ones per task, see schedule_lines.
+// returns the number of iterations it took, summed over every sample.
+inline auto render_blocking(task_system & tasks, render_frame & frame, viewport const & view,
+                            render_settings const & settings, int lines_per_task = 1) -> std::uint64_t
+{
+    auto iterations = std::atomic<std::uint64_t>{0};
+    auto costs = std::vector<float>{};
+    auto order = std::vector<line_task>{};
+    auto run_pass = [ & ] ( auto pass ) {
+        schedule_lines(costs, lines_per_task, tasks.size(), order);
+        auto done = std::latch{static_cast<std::ptrdiff_t>(order.size())};
+        for ( auto const & t : order ) {
+            tasks.async([ & ] ( line_task task ) {
+                auto sum = std::uint64_t{0};
+                for ( auto l{task.first}; l < task.first + task.count; ++l ) { sum += pass(frame, view, settings, l); }
+                iterations.fetch_add(sum, std::memory_order_relaxed);
+                done.count_down();
+            }, t);
+        }
+        done.wait();
+    };
+    sync_wait(first_pass_costs(tasks, frame, view, settings, costs));
+    run_pass(render_line);
+    if ( settings.max_samples > settings.anti_aliasing ) {
+        sync_wait(refinement_costs(tasks, frame, settings, costs));
+        run_pass(refine_line);
+    }
+    return iterations.load();
+}
+
+#endif
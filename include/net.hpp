@@ -0,0 +1,189 @@
+#ifndef NET_HPP
+#define NET_HPP
+
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <semaphore>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+
+
+// the handful of posix socket calls the network modes need. every function returns -1 or false on failure and
+// leaves the reporting to the caller.
+
+// a listening tcp socket on `bind:port`
+inline auto listen_tcp(std::string const & bind, int port) noexcept -> int
+{
+    auto address = sockaddr_in{};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(static_cast<std::uint16_t>(port));
+    if ( ::inet_pton(AF_INET, bind.c_str(), &address.sin_addr) != 1 ) { return -1; }
+    auto fd = ::socket(AF_INET, SOCK_STREAM, 0);
+    if ( fd < 0 ) { return -1; }
+    auto yes = 1;
+    ::setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+    if ( ::bind(fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) < 0 || ::listen(fd, 64) < 0 ) {
+        ::close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// a listening unix socket at `path`, replacing whatever was there
+inline auto listen_unix(std::string const & path) noexcept -> int
+{
+    auto address = sockaddr_un{};
+    if ( path.size() >= sizeof(address.sun_path) ) { return -1; }
+    address.sun_family = AF_UNIX;
+    std::copy(path.begin(), path.end(), address.sun_path);
+    ::unlink(path.c_str());
+    auto fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if ( fd < 0 ) { return -1; }
+    if ( ::bind(fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) < 0 || ::listen(fd, 64) < 0 ) {
+        ::close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// a tcp connection to `host:port`, host being a name or an address
+inline auto connect_tcp(std::string const & host, int port) noexcept -> int
+{
+    auto hints = addrinfo{};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo * found = nullptr;
+    if ( ::getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &found) != 0 ) { return -1; }
+    auto fd = -1;
+    for ( auto * a = found; a != nullptr; a = a->ai_next ) {
+        fd = ::socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+        if ( fd < 0 ) { continue; }
+        if ( ::connect(fd, a->ai_addr, a->ai_addrlen) == 0 ) { break; }
+        ::close(fd);
+        fd = -1;
+    }
+    ::freeaddrinfo(found);
+    if ( fd >= 0 ) {
+        // the messages are written in one go and waited on, there's nothing to gain from nagle
+        auto yes = 1;
+        ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+    }
+    return fd;
+}
+
+// splits `host:port`
+inline auto parse_endpoint(std::string_view endpoint) -> std::optional<std::pair<std::string, int>>
+{
+    auto colon = endpoint.rfind(':');
+    if ( colon == std::string_view::npos || colon == 0 ) { return std::nullopt; }
+    auto port = 0;
+    for ( auto c : endpoint.substr(colon + 1) ) {
+        if ( c < '0' || c > '9' ) { return std::nullopt; }
+        port = port * 10 + (c - '0');
+        if ( port > 65535 ) { return std::nullopt; }
+    }
+    if ( port == 0 ) { return std::nullopt; }
+    return std::pair{ std::string{endpoint.substr(0, colon)}, port };
+}
+
+// after this long without being able to receive anything, recv fails
+inline auto set_receive_timeout(int fd, int seconds) noexcept -> void
+{
+    auto timeout = timeval{};
+    timeout.tv_sec = seconds;
+    ::setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+}
+
+inline auto send_all(int fd, void const * data, std::size_t size) noexcept -> bool
+{
+    const auto * bytes = static_cast<char const *>(data);
+    while ( size > 0 ) {
+        auto sent = ::send(fd, bytes, size, MSG_NOSIGNAL);
+        if ( sent <= 0 ) { return false; }
+        bytes += sent;
+        size -= static_cast<std::size_t>(sent);
+    }
+    return true;
+}
+
+inline auto send_all(int fd, std::string_view data) noexcept -> bool
+{
+    return send_all(fd, data.data(), data.size());
+}
+
+// fails if the connection is closed, or times out, before `size` bytes arrived
+inline auto recv_all(int fd, void * data, std::size_t size) noexcept -> bool
+{
+    auto * bytes = static_cast<char *>(data);
+    while ( size > 0 ) {
+        auto received = ::recv(fd, bytes, size, 0);
+        if ( received <= 0 ) { return false; }
+        bytes += received;
+        size -= static_cast<std::size_t>(received);
+    }
+    return true;
+}
+
+// accept that rides out the failures waiting can fix: a signal or a client that went away before being accepted is
+// retried at once, running out of descriptors or memory (EMFILE, ENOBUFS, ...) with a sleep that doubles up to a
+// second. -1 when accept has kept failing for about a minute, or fails on the listening socket itself
+inline auto accept_retrying(int fd) noexcept -> int
+{
+    auto backoff = std::chrono::milliseconds{10};
+    auto waited = std::chrono::milliseconds{0};
+    while ( true ) {
+        auto client = ::accept(fd, nullptr, nullptr);
+        if ( client >= 0 ) { return client; }
+        switch ( errno ) {
+            case EINTR: case ECONNABORTED: case EPROTO: continue;
+            case EBADF: case EINVAL: case ENOTSOCK: case EOPNOTSUPP: case EFAULT: return -1;
+            default: break;
+        }
+        if ( waited >= std::chrono::minutes{1} ) { return -1; }
+        std::this_thread::sleep_for(backoff);
+        waited += backoff;
+        backoff = std::min(backoff * 2, std::chrono::milliseconds{1000});
+    }
+}
+
+// answers the connections on the listening socket `fd`, each with `handle(client)` on a thread of its own, at most
+// `limit` at a time: past that the next accept waits for a handler to be done, and the clients queue up in the
+// backlog of the socket. it returns only if accept gives up, after the handlers still running are done, so that
+// whatever they use can go away with the caller
+template <typename F>
+auto serve_connections(int fd, int limit, F handle) -> void
+{
+    limit = std::max(1, limit);
+    // shared, so that the last handler can still be inside release when this returns
+    auto slots = std::make_shared<std::counting_semaphore<>>(limit);
+    while ( true ) {
+        slots->acquire();
+        auto client = accept_retrying(fd);
+        if ( client < 0 ) {
+            slots->release();
+            break;
+        }
+        std::thread([ slots, &handle, client ] {
+            handle(client);
+            slots->release();
+        }).detach();
+    }
+    for ( auto k{0}; k < limit; ++k ) { slots->acquire(); }
+}
+
+#endif
@@ -0,0 +1,194 @@
+#ifndef PNG_WRITER_HPP
+#define PNG_WRITER_HPP
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+
+// a small in-memory png encoder, for the modes that have to hand out images without going through a file.
+// the deflate stream only uses the fixed huffman codes and only looks for repeats of the previous pixel and of the
+// pixel above: it's nowhere near zlib, but the fractal has large flat regions and long runs of the same color, which
+// is where nearly all of the gain is, and it's fast enough to not show up next to the render.
+
+constexpr auto png_crc_table = [] {
+    auto table = std::array<std::uint32_t, 256>{};
+    for ( auto n{0u}; n < 256; ++n ) {
+        auto c = n;
+        for ( auto k{0}; k < 8; ++k ) { c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1; }
+        table[n] = c;
+    }
+    return table;
+}();
+
+inline auto png_crc32(std::uint32_t crc, std::uint8_t const * data, std::size_t size) noexcept -> std::uint32_t
+{
+    crc = ~crc;
+    for ( auto n{0u}; n < size; ++n ) { crc = png_crc_table[(crc ^ data[n]) & 0xff] ^ (crc >> 8); }
+    return ~crc;
+}
+
+inline auto png_adler32(std::uint8_t const * data, std::size_t size) noexcept -> std::uint32_t
+{
+    auto a = std::uint32_t{1};
+    auto b = std::uint32_t{0};
+    for ( auto n{0u}; n < size; ++n ) {
+        a = (a + data[n]) % 65521;
+        b = (b + a) % 65521;
+    }
+    return (b << 16) | a;
+}
+
+// deflate writes the bits of everything but the huffman codes starting from the least significant one
+class deflate_bits {
+    std::vector<std::uint8_t> & _out;
+    std::uint64_t _bits{0};
+    int _count{0};
+
+public:
+    explicit deflate_bits(std::vector<std::uint8_t> & out) : _out{out} {}
+
+    auto put(std::uint32_t value, int count) -> void {
+        _bits |= static_cast<std::uint64_t>(value) << _count;
+        _count += count;
+        while ( _count >= 8 ) {
+            _out.push_back(static_cast<std::uint8_t>(_bits));
+            _bits >>= 8;
+            _count -= 8;
+        }
+    }
+
+    // the huffman codes instead go most significant bit first
+    auto put_code(std::uint32_t code, int count) -> void {
+        auto reversed = std::uint32_t{0};
+        for ( auto n{0}; n < count; ++n ) { reversed |= ((code >> n) & 1) << (count - 1 - n); }
+        put(reversed, count);
+    }
+
+    auto flush() -> void {
+        if ( _count > 0 ) { _out.push_back(static_cast<std::uint8_t>(_bits)); }
+        _bits = 0;
+        _count = 0;
+    }
+};
+
+constexpr auto deflate_length_base = std::array<int, 29>{
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+constexpr auto deflate_length_extra = std::array<int, 29>{
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+constexpr auto deflate_distance_base = std::array<int, 30>{
+    1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097,
+    6145, 8193, 12289, 16385, 24577
+};
+constexpr auto deflate_distance_extra = std::array<int, 30>{
+    0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+};
+constexpr auto deflate_max_match = 258;
+constexpr auto deflate_max_distance = 32768;
+
+// the fixed literal/length code of `symbol`, 0-287
+inline auto deflate_symbol(deflate_bits & bits, int symbol) -> void
+{
+    if ( symbol < 144 )      { bits.put_code(static_cast<std::uint32_t>(0x30 + symbol), 8); }
+    else if ( symbol < 256 ) { bits.put_code(static_cast<std::uint32_t>(0x190 + symbol - 144), 9); }
+    else if ( symbol < 280 ) { bits.put_code(static_cast<std::uint32_t>(symbol - 256), 7); }
+    else                     { bits.put_code(static_cast<std::uint32_t>(0xc0 + symbol - 280), 8); }
+}
+
+inline auto deflate_match(deflate_bits & bits, int length, int distance) -> void
+{
+    auto l = 0;
+    while ( l + 1 < 29 && deflate_length_base[l + 1] <= length ) { ++l; }
+    deflate_symbol(bits, 257 + l);
+    bits.put(static_cast<std::uint32_t>(length - deflate_length_base[l]), deflate_length_extra[l]);
+    auto d = 0;
+    while ( d + 1 < 30 && deflate_distance_base[d + 1] <= distance ) { ++d; }
+    bits.put_code(static_cast<std::uint32_t>(d), 5);
+    bits.put(static_cast<std::uint32_t>(distance - deflate_distance_base[d]), deflate_distance_extra[d]);
+}
+
+// how many bytes starting at `pos` repeat the ones `distance` bytes before, the two ranges may overlap
+inline auto deflate_match_length(std::vector<std::uint8_t> const & data, std::size_t pos, std::size_t distance) noexcept
+    -> int
+{
+    if ( distance == 0 || distance > pos || distance > deflate_max_distance ) { return 0; }
+    const auto end = std::min(data.size(), pos + deflate_max_match);
+    auto n = pos;
+    while ( n < end && data[n] == data[n - distance] ) { ++n; }
+    return static_cast<int>(n - pos);
+}
+
+// a single fixed huffman block, with the matches found greedily among the two candidates
+inline auto deflate_fixed(std::vector<std::uint8_t> const & data, std::size_t stride, std::vector<std::uint8_t> & out)
+    -> void
+{
+    auto bits = deflate_bits(out);
+    bits.put(1, 1);     // last block
+    bits.put(1, 2);     // fixed huffman codes
+    for ( auto pos = std::size_t{0}; pos < data.size(); ) {
+        const auto left = deflate_match_length(data, pos, 4);
+        const auto above = deflate_match_length(data, pos, stride);
+        const auto length = std::max(left, above);
+        if ( length >= 3 ) {
+            deflate_match(bits, length, static_cast<int>(left >= above ? 4 : stride));
+            pos += static_cast<std::size_t>(length);
+        } else {
+            deflate_symbol(bits, data[pos]);
+            ++pos;
+        }
+    }
+    deflate_symbol(bits, 256);
+    bits.flush();
+}
+
+inline auto png_u32(std::vector<std::uint8_t> & out, std::uint32_t v) -> void
+{
+    out.push_back(static_cast<std::uint8_t>(v >> 24));
+    out.push_back(static_cast<std::uint8_t>(v >> 16));
+    out.push_back(static_cast<std::uint8_t>(v >> 8));
+    out.push_back(static_cast<std::uint8_t>(v));
+}
+
+inline auto png_chunk(std::vector<std::uint8_t> & out, std::string_view type, std::vector<std::uint8_t> const & data)
+    -> void
+{
+    png_u32(out, static_cast<std::uint32_t>(data.size()));
+    const auto start = out.size();
+    out.insert(out.end(), type.begin(), type.end());
+    out.insert(out.end(), data.begin(), data.end());
+    png_u32(out, png_crc32(0, out.data() + start, out.size() - start));
+}
+
+// encodes 8 bit rgba pixels, one row after the other, as a png file
+inline auto encode_png(std::uint8_t const * rgba, std::size_t width, std::size_t height) -> std::vector<std::uint8_t>
+{
+    // every row is preceded by its filter type, always 0 (none) here
+    const auto stride = width * 4 + 1;
+    auto raw = std::vector<std::uint8_t>(stride * height);
+    for ( auto y{0u}; y < height; ++y ) {
+        raw[y * stride] = 0;
+        std::copy(rgba + y * width * 4, rgba + (y + 1) * width * 4, raw.begin() + static_cast<std::ptrdiff_t>(y * stride + 1));
+    }
+
+    auto header = std::vector<std::uint8_t>{};
+    png_u32(header, static_cast<std::uint32_t>(width));
+    png_u32(header, static_cast<std::uint32_t>(height));
+    header.insert(header.end(), { 8, 6, 0, 0, 0 });     // 8 bit, rgba, deflate, no filters, no interlacing
+
+    auto idat = std::vector<std::uint8_t>{ 0x78, 0x01 };
+    deflate_fixed(raw, stride, idat);
+    png_u32(idat, png_adler32(raw.data(), raw.size()));
+
+    auto png = std::vector<std::uint8_t>{ 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+    png_chunk(png, "IHDR", header);
+    png_chunk(png, "IDAT", idat);
+    png_chunk(png, "IEND", {});
+    return png;
+}
+
+#endif
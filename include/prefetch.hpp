@@ -0,0 +1,58 @@
+#ifndef PREFETCH_HPP
+#define PREFETCH_HPP
+
+#include <array>
+#include <cstddef>
+#include <memory>
+
+#include "disk_cache.hpp"
+#include "frame_pipeline.hpp"
+#include "lru_cache.hpp"
+#include "mandel_kernel.hpp"
+
+
+struct frame_key_hasher {
+    auto operator()(frame_key const & key) const noexcept -> std::size_t { return frame_key_hash(key); }
+};
+
+// finished frames kept in memory, both the ones shown and the ones rendered ahead of time
+using frame_cache = lru_cache<frame_key, std::shared_ptr<render_frame const>, frame_key_hasher>;
+
+inline auto frame_bytes(render_frame const & frame) noexcept -> std::size_t
+{
+    return frame.image.width() * frame.image.height() * 4 + frame.escape.size() * sizeof(float) + frame.luma.size();
+}
+
+// what the user is likely to ask for after `request`, most likely first: a 2x zoom, the four 10% pans and twice the
+// iterations.
+// the views are computed with exactly the same operations the gui uses for its keys and clicks, so that they come out
+// bit for bit equal and hit the cache. the gui zooms where it's clicked, here it can only guess the middle
+inline auto likely_next(frame_request const & request) -> std::array<frame_request, 6>
+{
+    auto next = std::array<frame_request, 6>{};
+    next.fill(request);
+    const auto & v = request.view;
+
+    const auto width = static_cast<int>(request.width);
+    const auto height = static_cast<int>(request.height);
+    const auto z = 2.;
+    auto & zoom = next[0].view;
+    double x = v.min_re + (v.max_re - v.min_re) * (width / 2) / width;
+    double y = v.min_im + (v.max_im - v.min_im) * (height / 2) / height;
+    zoom.min_re = x - (v.max_re - v.min_re) / 2 / z;
+    zoom.max_re = x + (v.max_re - v.min_re) / 2 / z;
+    zoom.min_im = y - (v.max_im - v.min_im) / 2 / z;
+    zoom.max_im = y + (v.max_im - v.min_im) / 2 / z;
+
+    double w = (v.max_re - v.min_re) * 0.1;
+    double h = (v.max_im - v.min_im) * 0.1;
+    next[1].view.min_re -= w, next[1].view.max_re -= w;
+    next[2].view.min_re += w, next[2].view.max_re += w;
+    next[3].view.min_im -= h, next[3].view.max_im -= h;
+    next[4].view.min_im += h, next[4].view.max_im += h;
+
+    next[5].settings.max_iter *= 2;
+    return next;
+}
+
+#endif
@@ -0,0 +1,337 @@
+#ifndef RENDER_STREAM_HPP
+#define RENDER_STREAM_HPP
+
+#include <atomic>
+#include <coroutine>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <utility>
+#include <vector>
+
+#include "async_task.hpp"
+#include "custom_locks.hpp"
+#include "equalize.hpp"
+#include "mandel_kernel.hpp"
+#include "task_system.hpp"
+
+
+// a render as a stream of the tiles it's made of, handed out as soon as each of them is done: with co_await next()
+// from a coroutine, which is then resumed by the worker that finished the tile, or with wait_next() from a thread
+// of its own. so whoever shows, encodes or caches the frame can start on its first lines while the workers are
+// still on the others, without a thread of its own polling for them.
+// a tile is a run of whole lines, what a task renders, see schedule_lines. the tiles of a pass come in whatever
+// order they finish in, then a tile with pass_done says the pass is over. the next pass, which writes over the same
+// pixels, only starts once the consumer asks for the tile after that one, so it can be done reading them first.
+// the passes themselves are a coroutine too: nobody blocks anywhere while a frame renders.
+// dropping the stream cancels the render: the tasks still queued return right away, and the last one lets the frame go
+
+enum class render_pass { first, refinement, equalize };
+
+struct frame_tile {
+    int first;
+    int count;
+    render_pass pass;
+    // summed over every sample
+    std::uint64_t iterations;
+    // no lines, just the end of the pass
+    bool pass_done;
+};
+
+class tile_channel_pool;
+
+struct tile_stream_options {
+    task_priority priority{task_priority::interactive};
+    // see schedule_lines
+    int lines_per_task{1};
+    // keeps its buffers between the frames, a fresh one is used without it
+    histogram_equalizer * equalizer{nullptr};
+    // the same for the channel and the line costs, see tile_channel_pool
+    tile_channel_pool * channels{nullptr};
+};
+
+// what the producer of a stream, its tasks and the consumer share. a single consumer
+class tile_channel {
+    spin_mutex _mutex;
+    std::vector<frame_tile> _ready;
+    std::size_t _read{0};
+    // a coroutine waiting in next()
+    std::coroutine_handle<> _consumer{};
+    // the passes, waiting at the end of one for the consumer to ask for more
+    std::coroutine_handle<> _producer{};
+    bool _finished{false};
+    bool _complete{false};
+    // bumped by everything the consumer may be waiting for, it's what wait_next() blocks on
+    std::atomic<std::uint64_t> _events{0};
+    std::atomic<bool> _cancelled{false};
+
+    // with the lock held: the next tile, or nothing at the end of the stream. false if neither is there yet
+    auto take(std::optional<frame_tile> & tile) noexcept -> bool {
+        tile.reset();
+        if ( _read < _ready.size() ) {
+            tile = _ready[_read++];
+            if ( _read == _ready.size() ) {
+                _ready.clear();
+                _read = 0;
+            }
+            return true;
+        }
+        return _finished;
+    }
+
+    // with the lock held. the one who bumps it must not touch the channel anymore once the lock is released: the
+    // consumer may be done with it by then
+    auto notify() noexcept -> std::coroutine_handle<> {
+        _events.fetch_add(1, std::memory_order_release);
+        _events.notify_one();
+        return std::exchange(_consumer, {});
+    }
+
+public:
+    // the producer's, what every line is expected to cost and the order its tasks go out in, see schedule_lines.
+    // here so that they are reused along with the channel
+    std::vector<float> line_costs;
+    std::vector<line_task> line_order;
+
+    // a pass has no more tiles than lines
+    explicit tile_channel(std::size_t lines) { _ready.reserve(lines + 1); }
+
+    // ready for another render. only once nobody else holds the channel anymore
+    auto reset(std::size_t lines) -> void {
+        _ready.clear();
+        _ready.reserve(lines + 1);
+        _read = 0;
+        _consumer = {};
+        _producer = {};
+        _finished = false;
+        _complete = false;
+        _cancelled.store(false, std::memory_order_relaxed);
+    }
+
+    auto cancelled() const noexcept -> bool { return _cancelled.load(std::memory_order_relaxed); }
+
+    auto push(frame_tile const & tile) -> void {
+        auto consumer = std::coroutine_handle<>{};
+        {
+            auto lock = std::lock_guard{_mutex};
+            _ready.push_back(tile);
+            consumer = notify();
+        }
+        if ( consumer ) { consumer.resume(); }
+    }
+
+    // the producer, at the end of a pass: hands out the pass_done tile and waits for the consumer to ask for more
+    auto end_of_pass(render_pass pass) noexcept {
+        struct awaiter {
+            tile_channel & channel;
+            render_pass pass;
+
+            auto await_ready() noexcept -> bool { return false; }
+            auto await_suspend(std::coroutine_handle<> h) noexcept -> std::coroutine_handle<> {
+                // the producer may be resumed as soon as the lock is released, and this awaiter is in its frame
+                auto & c = channel;
+                auto lock = std::lock_guard{c._mutex};
+                c._ready.push_back(frame_tile{ 0, 0, pass, 0, true });
+                c._producer = h;
+                const auto consumer = c.notify();
+                return consumer ? consumer : std::noop_coroutine();
+            }
+            auto await_resume() noexcept -> void {}
+        };
+        return awaiter{ *this, pass };
+    }
+
+    // the producer, once it's done with the frame, all of it or not
+    auto finish(bool complete) -> void {
+        auto consumer = std::coroutine_handle<>{};
+        {
+            auto lock = std::lock_guard{_mutex};
+            _finished = true;
+            _complete = complete;
+            consumer = notify();
+        }
+        if ( consumer ) { consumer.resume(); }
+    }
+
+    auto complete() noexcept -> bool {
+        auto lock = std::lock_guard{_mutex};
+        return _complete;
+    }
+
+    // the producer, if it's waiting at the end of a pass, notices right away
+    auto cancel() -> void {
+        _cancelled.store(true, std::memory_order_relaxed);
+        auto producer = std::coroutine_handle<>{};
+        {
+            auto lock = std::lock_guard{_mutex};
+            producer = std::exchange(_producer, {});
+        }
+        if ( producer ) { producer.resume(); }
+    }
+
+    auto next() noexcept {
+        struct awaiter {
+            tile_channel & channel;
+            std::optional<frame_tile> tile{};
+            bool taken{false};
+
+            auto await_ready() noexcept -> bool { return false; }
+            // when the producer waits for it, it goes on with the next pass right here
+            auto await_suspend(std::coroutine_handle<> h) -> bool {
+                while ( true ) {
+                    auto producer = std::coroutine_handle<>{};
+                    {
+                        auto lock = std::lock_guard{channel._mutex};
+                        if ( channel.take(tile) ) {
+                            taken = true;
+                            return false;
+                        }
+                        producer = std::exchange(channel._producer, {});
+                        if ( !producer ) {
+                            channel._consumer = h;
+                            return true;
+                        }
+                    }
+                    producer.resume();
+                }
+            }
+            auto await_resume() noexcept -> std::optional<frame_tile> {
+                if ( !taken ) {
+                    auto lock = std::lock_guard{channel._mutex};
+                    channel.take(tile);
+                }
+                return tile;
+            }
+        };
+        return awaiter{ *this };
+    }
+
+    auto wait_next() -> std::optional<frame_tile> {
+        auto tile = std::optional<frame_tile>{};
+        while ( true ) {
+            const auto seen = _events.load(std::memory_order_acquire);
+            auto producer = std::coroutine_handle<>{};
+            {
+                auto lock = std::lock_guard{_mutex};
+                if ( take(tile) ) { return tile; }
+                producer = std::exchange(_producer, {});
+            }
+            if ( producer ) { producer.resume(); }
+            else { _events.wait(seen, std::memory_order_acquire); }
+        }
+    }
+};
+
+// the channels of the renders of a thread, handed out again once their render is over, like the frames of
+// frame_pool: with the tiles and the line costs they have room for already, a render of the same size doesn't
+// allocate. there are as many as there were renders going on at once, which is seldom more than two: the one on
+// screen, and the one left behind that is still finishing the lines it was on
+class tile_channel_pool {
+    std::vector<std::shared_ptr<tile_channel>> _channels;
+
+public:
+    auto acquire(std::size_t lines) -> std::shared_ptr<tile_channel> {
+        for ( auto const & channel : _channels ) {
+            if ( channel.use_count() == 1 ) {
+                // pairs with the release of the producer dropping its reference, so it's done with the channel
+                std::atomic_thread_fence(std::memory_order_acquire);
+                channel->reset(lines);
+                return channel;
+            }
+        }
+        return _channels.emplace_back(std::make_shared<tile_channel>(lines));
+    }
+
+    auto size() const noexcept -> std::size_t { return _channels.size(); }
+};
+
+// what a render hands out, see above
+class tile_stream {
+    std::shared_ptr<tile_channel> _channel;
+
+public:
+    explicit tile_stream(std::shared_ptr<tile_channel> channel) noexcept : _channel{std::move(channel)} {}
+    tile_stream(tile_stream &&) noexcept = default;
+    auto operator=(tile_stream &&) -> tile_stream & = delete;
+
+    ~tile_stream() {
+        if ( _channel ) { _channel->cancel(); }
+    }
+
+    // the next tile, nothing once the render is over. from a coroutine, which must not block while it runs on a worker
+    auto next() noexcept { return _channel->next(); }
+
+    // the same, blocking the calling thread
+    auto wait_next() -> std::optional<frame_tile> { return _channel->wait_next(); }
+
+    // once there are no more tiles: whether every pass got to the end
+    auto complete() const noexcept -> bool { return _channel->complete(); }
+
+    // the stream ends as soon as the tasks already running are done with their current line
+    auto cancel() -> void { _channel->cancel(); }
+};
+
+// the keep_going of a render that only stops when its stream is dropped
+struct keep_rendering {
+    auto operator()() const noexcept -> bool { return true; }
+};
+
+// the passes of a frame, the lines of each the most expensive first, see schedule_lines
+template<typename KeepGoing>
+inline auto produce_tiles(std::shared_ptr<tile_channel> channel, task_system & tasks,
+                          std::shared_ptr<render_frame> frame, viewport view, render_settings settings,
+                          tile_stream_options opts, KeepGoing keep_going) -> async_task<>
+{
+    auto going = [ & ] { return !channel->cancelled() && keep_going(); };
+    auto & costs = channel->line_costs;
+    auto & order = channel->line_order;
+    auto run_pass = [ & ] ( auto pass, render_pass which ) {
+        schedule_lines(costs, opts.lines_per_task, tasks.size(), order);
+        return parallel_for(tasks, opts.priority, static_cast<int>(order.size()), [ &, pass, which ] ( int k ) {
+            const auto task = order[static_cast<std::size_t>(k)];
+            auto iterations = std::uint64_t{0};
+            for ( auto l{task.first}; l < task.first + task.count; ++l ) {
+                // a tile left half done is not handed out
+                if ( !going() ) { return; }
+                iterations += pass(*frame, view, settings, l);
+            }
+            channel->push(frame_tile{ task.first, task.count, which, iterations, false });
+        });
+    };
+
+    co_await first_pass_costs(tasks, *frame, view, settings, costs);
+    if ( going() ) { co_await run_pass(render_line, render_pass::first); }
+    if ( going() ) { co_await channel->end_of_pass(render_pass::first); }
+    if ( going() && settings.equalized ) {
+        auto own = std::optional<histogram_equalizer>{};
+        auto & equalizer = opts.equalizer ? *opts.equalizer : own.emplace();
+        co_await equalizer.apply(tasks, *frame, settings, opts.priority);
+        channel->push(frame_tile{ 0, static_cast<int>(frame->image.height()), render_pass::equalize, 0, false });
+        co_await channel->end_of_pass(render_pass::equalize);
+    } else if ( going() && settings.max_samples > settings.anti_aliasing ) {
+        // the refinement looks at the lines above and below every line, so it can't start any earlier
+        co_await refinement_costs(tasks, *frame, settings, costs);
+        if ( going() ) { co_await run_pass(refine_line, render_pass::refinement); }
+        if ( going() ) { co_await channel->end_of_pass(render_pass::refinement); }
+    }
+    const auto complete = going();
+    // the frame goes back to its owner before the consumer hears that it's over
+    frame.reset();
+    channel->finish(complete);
+}
+
+// starts rendering `frame` and returns right away. the stream holds the frame until the last of its tasks is done,
+// and the render stops early once keep_going() says so, or once the stream is dropped
+template<typename KeepGoing = keep_rendering>
+inline auto render_tiles(task_system & tasks, std::shared_ptr<render_frame> frame, viewport const & view,
+                         render_settings const & settings, tile_stream_options const & opts = {},
+                         KeepGoing keep_going = {}) -> tile_stream
+{
+    const auto lines = frame->image.height();
+    auto channel = opts.channels ? opts.channels->acquire(lines) : std::make_shared<tile_channel>(lines);
+    spawn(produce_tiles(channel, tasks, std::move(frame), view, settings, opts, std::move(keep_going)));
+    return tile_stream{ std::move(channel) };
+}
+
+#endif
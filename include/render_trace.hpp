@@ -0,0 +1,205 @@
+#ifndef RENDER_TRACE_HPP
+#define RENDER_TRACE_HPP
+
+#include <bit>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+#ifdef MANDEL_TRACE
+#include <atomic>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "fmt/format.h"
+#include "custom_locks.hpp"
+#endif
+
+
+// optional instrumentation of the render: per-line wall time, how many of the 8 lanes were actually doing something
+// in the escape loop, and when each worker was busy or idle. everything is exported as chrome trace-event json, to be
+// opened with chrome://tracing or https://ui.perfetto.dev
+//
+// it is compiled out unless MANDEL_TRACE is defined (cmake -DENABLE_TRACING=ON): every call below is then an empty
+// inline function and the kernel checks `tracing_enabled` with an if constexpr, so the escape loop is untouched.
+#ifdef MANDEL_TRACE
+inline constexpr auto tracing_enabled = true;
+#else
+inline constexpr auto tracing_enabled = false;
+#endif
+
+using trace_clock = std::chrono::steady_clock;
+
+// one complete ("ph":"X") event. the counters are only meaningful for the events recorded by the kernel
+struct trace_event {
+    std::string_view name;
+    std::string_view category;
+    trace_clock::time_point begin;
+    trace_clock::time_point end;
+    std::int64_t id{-1};
+    std::uint64_t lane_slots{0};
+    std::uint64_t active_lanes{0};
+};
+
+// the escape loop counters of the calling thread: every trip through the loop adds 8 slots, and one active lane for
+// every lane that had not escaped yet. active / slots is the lane utilization.
+struct lane_counters {
+    std::uint64_t slots{0};
+    std::uint64_t active{0};
+};
+
+#ifdef MANDEL_TRACE
+
+class render_trace {
+    // every thread records into its own buffer, the lock is only ever contended while saving
+    struct thread_buffer {
+        spin_mutex mutex;
+        std::vector<trace_event> events;
+        std::string name;
+        unsigned tid;
+    };
+
+    inline static std::mutex _registry_mutex;
+    inline static std::vector<std::shared_ptr<thread_buffer>> _registry;
+    inline static std::atomic<bool> _enabled{false};
+    inline static const auto _epoch = trace_clock::now();
+
+    static auto buffer() -> thread_buffer & {
+        thread_local auto local = [] {
+            auto b = std::make_shared<thread_buffer>();
+            auto lock = std::lock_guard{_registry_mutex};
+            b->tid = static_cast<unsigned>(_registry.size());
+            b->name = fmt::format("thread {}", b->tid);
+            _registry.push_back(b);
+            return b;
+        }();
+        return *local;
+    }
+
+    static auto micros(trace_clock::time_point t) -> double {
+        return std::chrono::duration<double, std::micro>(t - _epoch).count();
+    }
+
+public:
+    static auto enabled() noexcept -> bool { return _enabled.load(std::memory_order_relaxed); }
+
+    // drops whatever was recorded before and starts recording
+    static auto start() -> void {
+        {
+            auto lock = std::lock_guard{_registry_mutex};
+            for ( auto & b : _registry ) {
+                auto buffer_lock = std::lock_guard{b->mutex};
+                b->events.clear();
+            }
+        }
+        _enabled = true;
+    }
+
+    static auto stop() noexcept -> void { _enabled = false; }
+
+    static auto name_thread(std::string name) -> void {
+        auto & b = buffer();
+        auto lock = std::lock_guard{b.mutex};
+        b.name = std::move(name);
+    }
+
+    static auto record(trace_event const & event) -> void {
+        if ( !enabled() ) { return; }
+        auto & b = buffer();
+        auto lock = std::lock_guard{b.mutex};
+        b.events.push_back(event);
+    }
+
+    static auto counters() noexcept -> lane_counters & {
+        thread_local auto local = lane_counters{};
+        return local;
+    }
+
+    __attribute__ ((always_inline)) static auto count_lanes(std::uint8_t active_mask) noexcept -> void {
+        auto & c = counters();
+        c.slots += 8;
+        c.active += static_cast<std::uint64_t>(std::popcount(active_mask));
+    }
+
+    // writes everything recorded so far as a chrome trace-event json file
+    static auto save(std::string const & path) -> bool {
+        auto out = std::ofstream(path);
+        if ( !out ) { return false; }
+        out << "{\"traceEvents\":[\n";
+        auto first = true;
+        auto separator = [ & ] () -> std::string_view {
+            if ( first ) { first = false; return ""; }
+            return ",\n";
+        };
+        auto lock = std::lock_guard{_registry_mutex};
+        for ( auto & b : _registry ) {
+            auto buffer_lock = std::lock_guard{b->mutex};
+            out << separator() << fmt::format(R"({{"name":"thread_name","ph":"M","pid":0,"tid":{},"args":{{"name":"{}"}}}})",
+                                              b->tid, b->name);
+            for ( auto const & e : b->events ) {
+                out << separator() << fmt::format(R"({{"name":"{}","cat":"{}","ph":"X","pid":0,"tid":{},"ts":{:.3f},"dur":{:.3f})",
+                                                  e.name, e.category, b->tid, micros(e.begin), micros(e.end) - micros(e.begin));
+                if ( e.id >= 0 || e.lane_slots > 0 ) {
+                    out << fmt::format(R"(,"args":{{"id":{},"lane_iterations":{},"active_lane_iterations":{},"utilization":{:.4f}}})",
+                                       e.id, e.lane_slots, e.active_lanes,
+                                       e.lane_slots > 0 ? static_cast<double>(e.active_lanes) / e.lane_slots : 0.);
+                }
+                out << "}";
+            }
+        }
+        out << "\n]}\n";
+        return static_cast<bool>(out);
+    }
+};
+
+// records the lifetime of the scope as one event, together with the lane counters accumulated meanwhile
+class trace_scope {
+    trace_event _event;
+    lane_counters _start_counters;
+    bool _active;
+
+public:
+    trace_scope(std::string_view name, std::string_view category, std::int64_t id = -1) noexcept
+        : _event{ name, category, {}, {}, id }, _active{render_trace::enabled()} {
+        if ( !_active ) { return; }
+        _start_counters = render_trace::counters();
+        _event.begin = trace_clock::now();
+    }
+
+    ~trace_scope() {
+        if ( !_active ) { return; }
+        _event.end = trace_clock::now();
+        auto const & c = render_trace::counters();
+        _event.lane_slots = c.slots - _start_counters.slots;
+        _event.active_lanes = c.active - _start_counters.active;
+        render_trace::record(_event);
+    }
+
+    trace_scope(trace_scope const &) = delete;
+    auto operator=(trace_scope const &) -> trace_scope & = delete;
+};
+
+#else
+
+class render_trace {
+public:
+    static constexpr auto enabled() noexcept -> bool { return false; }
+    static auto start() noexcept -> void {}
+    static auto stop() noexcept -> void {}
+    static auto name_thread(std::string const &) noexcept -> void {}
+    static auto record(trace_event const &) noexcept -> void {}
+    static auto count_lanes(std::uint8_t) noexcept -> void {}
+    static auto save(std::string const &) noexcept -> bool { return false; }
+};
+
+// variables of this type are never warned about as unused, since with tracing compiled out they are empty
+class [[maybe_unused]] trace_scope {
+public:
+    constexpr trace_scope(std::string_view, std::string_view, std::int64_t = -1) noexcept {}
+};
+
+#endif
+
+#endif
@@ -0,0 +1,222 @@
+#ifndef RESOLVE_HPP
+#define RESOLVE_HPP
+
+#include <immintrin.h>
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <numbers>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "async_task.hpp"
+#include "mandel_kernel.hpp"
+#include "spl/image.hpp"
+#include "task_system.hpp"
+
+
+// the resolve stage: makes the final image out of a supersampled one, a render at a few times the resolution, with a
+// proper reconstruction filter instead of the plain average the kernel does over the samples of a pixel.
+// the filtering is done in linear light, the 8 bit channels are sRGB: averaging those directly makes the thin bright
+// filaments darker than they are.
+// the filter is separable, every output line takes the lines it needs from the source, filters them vertically into
+// a line of floats, and that line horizontally into the output, 8 pixels at a time. a task per few output lines.
+// the source is any image, so exports and thumbnails can be made out of a render that's already done, without
+// running a single iteration again.
+
+enum class resolve_filter {
+    box,
+    // a triangle, the bilinear filter
+    tent,
+    // a windowed sinc with 3 lobes: the sharpest of the three, at the cost of a bit of ringing along the edges
+    lanczos,
+};
+
+constexpr auto resolve_filter_names = std::array<std::string_view, 3>{ "box", "tent", "lanczos" };
+
+constexpr auto resolve_filter_name(resolve_filter f) noexcept -> std::string_view
+{
+    return resolve_filter_names[static_cast<std::size_t>(f)];
+}
+
+constexpr auto parse_resolve_filter(std::string_view name) noexcept -> std::optional<resolve_filter>
+{
+    for ( auto f{0u}; f < resolve_filter_names.size(); ++f ) {
+        if ( resolve_filter_names[f] == name ) { return static_cast<resolve_filter>(f); }
+    }
+    return std::nullopt;
+}
+
+// a resolve to do after a render: the size of the result and the filter
+struct resolve_options {
+    std::size_t width;
+    std::size_t height;
+    resolve_filter filter{resolve_filter::lanczos};
+};
+
+// how far the filter reaches, in pixels of the output
+constexpr auto filter_radius(resolve_filter f) noexcept -> double
+{
+    switch ( f ) {
+        case resolve_filter::box: return 0.5;
+        case resolve_filter::tent: return 1.;
+        case resolve_filter::lanczos: return 3.;
+    }
+    return 1.;
+}
+
+// the filter at x, in pixels of the output
+inline auto filter_weight(resolve_filter f, double x) noexcept -> double
+{
+    x = std::abs(x);
+    switch ( f ) {
+        case resolve_filter::box: return x < 0.5 ? 1. : 0.;
+        case resolve_filter::tent: return std::max(0., 1. - x);
+        case resolve_filter::lanczos: {
+            if ( x < 1e-9 ) { return 1.; }
+            if ( x >= 3. ) { return 0.; }
+            const auto px = std::numbers::pi * x;
+            return 3. * std::sin(px) * std::sin(px / 3.) / (px * px);
+        }
+    }
+    return 0.;
+}
+
+// the taps of every output pixel along one axis, tap k of pixel o at [k * padded + o], so that 8 neighbouring
+// pixels load their k-th tap in one go. the taps past the border of the source are clamped to it, and the
+// pixels past the end of the output, up to a multiple of 8, have weight 0
+struct filter_taps {
+    int taps{};
+    std::size_t padded{};
+    std::vector<std::int32_t> index;
+    std::vector<float> weight;
+
+    filter_taps(std::size_t source, std::size_t target, resolve_filter f) : padded{(target + 7) / 8 * 8} {
+        const auto scale = static_cast<double>(source) / static_cast<double>(target);
+        // when making it smaller the filter is stretched over the source, when making it bigger it's just sampled
+        const auto stretch = std::max(1., scale);
+        const auto reach = filter_radius(f) * stretch;
+        taps = static_cast<int>(std::ceil(2 * reach)) + 1;
+        index.assign(static_cast<std::size_t>(taps) * padded, 0);
+        weight.assign(static_cast<std::size_t>(taps) * padded, 0.f);
+        for ( auto o{0u}; o < target; ++o ) {
+            const auto center = (o + 0.5) * scale - 0.5;
+            const auto first = static_cast<long>(std::floor(center - reach)) + 1;
+            auto sum = 0.;
+            auto w = std::vector<double>(static_cast<std::size_t>(taps));
+            for ( auto k{0}; k < taps; ++k ) {
+                w[static_cast<std::size_t>(k)] = filter_weight(f, (static_cast<double>(first + k) - center) / stretch);
+                sum += w[static_cast<std::size_t>(k)];
+            }
+            for ( auto k{0}; k < taps; ++k ) {
+                const auto at = static_cast<std::size_t>(k) * padded + o;
+                index[at] = static_cast<std::int32_t>(std::clamp<long>(first + k, 0, static_cast<long>(source) - 1));
+                weight[at] = static_cast<float>(w[static_cast<std::size_t>(k)] / sum);
+            }
+        }
+    }
+};
+
+// sRGB to linear light for the 256 values of a channel, and back from 4096 steps of linear light
+struct srgb_tables {
+    static constexpr auto steps = 4096;
+    std::array<float, 256> to_linear;
+    std::array<std::int32_t, steps> to_srgb;
+
+    srgb_tables() noexcept {
+        for ( auto v{0}; v < 256; ++v ) {
+            const auto c = v / 255.;
+            to_linear[static_cast<std::size_t>(v)] = static_cast<float>(c <= 0.04045 ? c / 12.92
+                                                                        : std::pow((c + 0.055) / 1.055, 2.4));
+        }
+        for ( auto s{0}; s < steps; ++s ) {
+            const auto l = s / (steps - 1.);
+            const auto c = l <= 0.0031308 ? l * 12.92 : 1.055 * std::pow(l, 1 / 2.4) - 0.055;
+            to_srgb[static_cast<std::size_t>(s)] = static_cast<std::int32_t>(std::lround(c * 255.));
+        }
+    }
+};
+
+// filters `source` down (or up) to width x height, on the workers. sync_wait() it from a thread outside of them
+inline auto resolve(task_system & tasks, spl::graphics::image const & source, std::size_t width, std::size_t height,
+                    resolve_filter filter, task_priority priority = task_priority::interactive)
+    -> async_task<spl::graphics::image>
+{
+    static const auto tables = srgb_tables();
+    const auto source_width = source.width();
+    const auto columns = filter_taps(source_width, width, filter);
+    const auto rows = filter_taps(source.height(), height, filter);
+    auto result = spl::graphics::image(width, height);
+    const auto * in = reinterpret_cast<std::uint32_t const *>(source.raw_data());
+    auto * out = reinterpret_cast<std::uint32_t *>(result.raw_data());
+    // a handful of bands per worker, the lines don't all cost the same at the borders
+    const auto bands = static_cast<int>(std::min<std::size_t>(tasks.size() * 4, height));
+
+    co_await parallel_for(tasks, priority, bands, [ & ] ( int b ) {
+        const auto first = height * static_cast<std::size_t>(b) / static_cast<std::size_t>(bands);
+        const auto last = height * static_cast<std::size_t>(b + 1) / static_cast<std::size_t>(bands);
+        // a line of the source, filtered vertically, one plane per channel
+        const auto padded_source = (source_width + 7) / 8 * 8;
+        auto planes = std::vector<float>(padded_source * 3);
+        auto * red = planes.data();
+        auto * green = red + padded_source;
+        auto * blue = green + padded_source;
+        const auto _byte = _mm256_set1_epi32(0xff);
+        for ( auto y = first; y < last; ++y ) {
+            std::fill(planes.begin(), planes.end(), 0.f);
+            for ( auto k{0}; k < rows.taps; ++k ) {
+                const auto at = static_cast<std::size_t>(k) * rows.padded + y;
+                const auto _w = _mm256_set1_ps(rows.weight[at]);
+                const auto * line = in + static_cast<std::size_t>(rows.index[at]) * source_width;
+                for ( auto x{0u}; x < source_width; x += 8 ) {
+                    const auto tail = tail_mask(x, source_width);
+                    const auto _px = _mm256_maskz_loadu_epi32(tail, line + x);
+                    const auto _r = _mm256_i32gather_ps(tables.to_linear.data(), _mm256_and_si256(_px, _byte), 4);
+                    const auto _g = _mm256_i32gather_ps(tables.to_linear.data(),
+                                                        _mm256_and_si256(_mm256_srli_epi32(_px, 8), _byte), 4);
+                    const auto _b = _mm256_i32gather_ps(tables.to_linear.data(),
+                                                        _mm256_and_si256(_mm256_srli_epi32(_px, 16), _byte), 4);
+                    _mm256_storeu_ps(red + x, _mm256_fmadd_ps(_w, _r, _mm256_loadu_ps(red + x)));
+                    _mm256_storeu_ps(green + x, _mm256_fmadd_ps(_w, _g, _mm256_loadu_ps(green + x)));
+                    _mm256_storeu_ps(blue + x, _mm256_fmadd_ps(_w, _b, _mm256_loadu_ps(blue + x)));
+                }
+            }
+            const auto _steps = _mm256_set1_ps(srgb_tables::steps - 1);
+            auto encode = [ & ] ( __m256 _l ) {
+                _l = _mm256_min_ps(_mm256_max_ps(_l, _mm256_setzero_ps()), _mm256_set1_ps(1.f));
+                return _mm256_i32gather_epi32(tables.to_srgb.data(), _mm256_cvtps_epi32(_l * _steps), 4);
+            };
+            for ( auto x{0u}; x < width; x += 8 ) {
+                auto _r = _mm256_setzero_ps();
+                auto _g = _mm256_setzero_ps();
+                auto _b = _mm256_setzero_ps();
+                for ( auto k{0}; k < columns.taps; ++k ) {
+                    const auto at = static_cast<std::size_t>(k) * columns.padded + x;
+                    const auto _index = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(&columns.index[at]));
+                    const auto _w = _mm256_loadu_ps(&columns.weight[at]);
+                    _r = _mm256_fmadd_ps(_w, _mm256_i32gather_ps(red, _index, 4), _r);
+                    _g = _mm256_fmadd_ps(_w, _mm256_i32gather_ps(green, _index, 4), _g);
+                    _b = _mm256_fmadd_ps(_w, _mm256_i32gather_ps(blue, _index, 4), _b);
+                }
+                auto _px = _mm256_or_si256(encode(_r), _mm256_slli_epi32(encode(_g), 8));
+                _px = _mm256_or_si256(_px, _mm256_slli_epi32(encode(_b), 16));
+                _px = _mm256_or_si256(_px, _mm256_set1_epi32(static_cast<int>(0xff000000)));
+                _mm256_mask_storeu_epi32(out + y * width + x, tail_mask(x, width), _px);
+            }
+        }
+    });
+    co_return result;
+}
+
+// the name of the resolved copy of `filename`: "poster.png" becomes "poster_resolved.png"
+inline auto resolved_filename(std::string_view filename) -> std::string
+{
+    const auto dot = filename.rfind('.');
+    if ( dot == std::string_view::npos ) { return std::string{filename} + "_resolved"; }
+    return std::string{filename.substr(0, dot)} + "_resolved" + std::string{filename.substr(dot)};
+}
+
+#endif
@@ -0,0 +1,45 @@
+#ifndef SCHEDULER_STATS_HPP
+#define SCHEDULER_STATS_HPP
+
+#include <chrono>
+#include <cstdio>
+#include <vector>
+
+#include "fmt/core.h"
+#include "task_system.hpp"
+
+
+// what the workers did between two task_system::stats(), `elapsed` apart, one line per worker and the total:
+//  - tasks, and how many of them were stolen from the queue of another worker,
+//  - failed, the other queues found empty or locked while looking for work: with lots of workers and not enough
+//    tasks this grows much faster than the tasks,
+//  - contended, how many times the queue of the worker was found locked, by the worker itself or by whoever pushed,
+//  - busy and blocked, the share of the time spent running tasks and asleep waiting for one. whatever is left is
+//    spent looking for work,
+//  - depth, how many tasks were left in the queue on average when the worker took one from it.
+inline auto print_scheduler_stats(std::vector<worker_stats> const & before, std::vector<worker_stats> const & after,
+                                  std::chrono::steady_clock::duration elapsed, std::FILE * out = stdout) -> void
+{
+    const auto ns = std::max(1., static_cast<double>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count()));
+    auto total = worker_stats{};
+    auto line = [ & ] ( std::string_view name, worker_stats const & w, double span ) {
+        fmt::print(out, "{:>8} {:>8} {:>8} {:>10} {:>10} {:>6.1f}% {:>6.1f}% {:>7.1f}\n", name, w.tasks, w.steals,
+                   w.failed_steals, w.contended, 100. * static_cast<double>(w.busy_ns) / span,
+                   100. * static_cast<double>(w.blocked_ns) / span,
+                   w.tasks > 0 ? static_cast<double>(w.depth_sum) / static_cast<double>(w.tasks) : 0.);
+    };
+    fmt::print(out, "{:>8} {:>8} {:>8} {:>10} {:>10} {:>7} {:>7} {:>7}\n",
+               "worker", "tasks", "stolen", "failed", "contended", "busy", "blocked", "depth");
+    for ( auto n{0u}; n < after.size() && n < before.size(); ++n ) {
+        const auto w = after[n] - before[n];
+        line(fmt::format("{}", n), w, ns);
+        total = { total.tasks + w.tasks, total.steals + w.steals, total.failed_steals + w.failed_steals,
+                  total.contended + w.contended, total.busy_ns + w.busy_ns, total.blocked_ns + w.blocked_ns,
+                  total.depth_sum + w.depth_sum };
+    }
+    // the percentages of the total are of the time of all the workers together
+    line("all", total, ns * static_cast<double>(std::max<std::size_t>(1, after.size())));
+}
+
+#endif
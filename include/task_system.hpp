@@ -1,37 +1,186 @@
 #ifndef TASK_SYSTEM_HPP
 #define TASK_SYSTEM_HPP
 
-#include <deque>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <new>
 #include <thread>
 #include <condition_variable>
-#include <functional>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
 #include "custom_locks.hpp"
+#include "render_trace.hpp"
 
 
 using lock_t = std::unique_lock<spin_mutex>;
 
+// how many bytes of captures a task can carry
+inline constexpr auto task_capacity = std::size_t{320};
+
+// a move only void() callable stored in place, unlike std::function which goes to the heap as soon as the captures
+// are bigger than a couple of pointers, so pushing a task never allocates.
+// a callable that doesn't fit is a compile error, not a silent allocation
+class small_task {
+    struct ops_t {
+        void (*invoke)(void *);
+        // move constructs the callable into the first storage and destroys the one in the second
+        void (*relocate)(void *, void *) noexcept;
+        void (*destroy)(void *) noexcept;
+    };
+
+    template<typename F>
+    static constexpr auto ops_of = ops_t{
+        [] ( void * f ) { (*static_cast<F *>(f))(); },
+        [] ( void * to, void * from ) noexcept {
+            ::new (to) F(std::move(*static_cast<F *>(from)));
+            static_cast<F *>(from)->~F();
+        },
+        [] ( void * f ) noexcept { static_cast<F *>(f)->~F(); }
+    };
+
+    alignas(std::max_align_t) std::byte _storage[task_capacity];
+    ops_t const * _ops{nullptr};
+
+    auto reset() noexcept -> void {
+        if ( _ops ) { _ops->destroy(_storage); }
+        _ops = nullptr;
+    }
+
+public:
+    small_task() noexcept = default;
+
+    template<typename F> requires ( !std::is_same_v<std::remove_cvref_t<F>, small_task> )
+    small_task(F && f) noexcept(std::is_nothrow_constructible_v<std::decay_t<F>, F>) {
+        using fn_t = std::decay_t<F>;
+        static_assert(sizeof(fn_t) <= task_capacity, "the task captures too much, raise task_capacity");
+        static_assert(alignof(fn_t) <= alignof(std::max_align_t), "the task captures something over aligned");
+        static_assert(std::is_nothrow_move_constructible_v<fn_t>);
+        ::new (static_cast<void *>(_storage)) fn_t(std::forward<F>(f));
+        _ops = &ops_of<fn_t>;
+    }
+
+    small_task(small_task && other) noexcept : _ops{other._ops} {
+        if ( _ops ) { _ops->relocate(_storage, other._storage); }
+        other._ops = nullptr;
+    }
+
+    auto operator=(small_task && other) noexcept -> small_task & {
+        if ( this != &other ) {
+            reset();
+            _ops = other._ops;
+            if ( _ops ) { _ops->relocate(_storage, other._storage); }
+            other._ops = nullptr;
+        }
+        return *this;
+    }
+
+    small_task(small_task const &) = delete;
+    auto operator=(small_task const &) -> small_task & = delete;
+
+    ~small_task() { reset(); }
+
+    explicit operator bool() const noexcept { return _ops != nullptr; }
+
+    auto operator()() -> void { _ops->invoke(_storage); }
+};
+
+// a fifo of tasks on a ring buffer that only ever grows, so once it has seen the longest queue of a frame pushing
+// and popping don't allocate anymore. std::deque instead gives back and asks again for a block every few tasks
+class task_ring {
+    std::vector<small_task> _slots;
+    std::size_t _head{0};
+    std::size_t _size{0};
+
+    auto grow() -> void {
+        auto slots = std::vector<small_task>(std::max<std::size_t>(64, _slots.size() * 2));
+        for ( auto n{0u}; n < _size; ++n ) { slots[n] = std::move(_slots[(_head + n) % _slots.size()]); }
+        _slots = std::move(slots);
+        _head = 0;
+    }
+
+public:
+    auto empty() const noexcept -> bool { return _size == 0; }
+
+    auto size() const noexcept -> std::size_t { return _size; }
+
+    template<typename F>
+    auto emplace_back(F && f) -> void {
+        if ( _size == _slots.size() ) { grow(); }
+        _slots[(_head + _size) % _slots.size()] = small_task(std::forward<F>(f));
+        ++_size;
+    }
+
+    auto pop_front(small_task & x) noexcept -> void {
+        x = std::move(_slots[_head]);
+        _head = (_head + 1) % _slots.size();
+        --_size;
+    }
+
+    auto clear() noexcept -> void {
+        while ( _size > 0 ) {
+            _slots[_head] = small_task{};
+            _head = (_head + 1) % _slots.size();
+            --_size;
+        }
+    }
+};
+
+// the classes of tasks: the workers run every interactive task they can find before any background one, so a long
+// background job only slows the frames the user is looking at down by the one task each worker is in the middle of
+enum class task_priority { interactive, background };
+
+inline constexpr auto task_priorities = std::array{ task_priority::interactive, task_priority::background };
+
+// how a try_pop went: a task, nothing in the queue, or somebody else holding it
+enum class pop_result { popped, empty, busy };
+
 class notification_queue {
 private:
-    std::deque<std::function<void()>> _q;
+    std::array<task_ring, task_priorities.size()> _q;
     bool _done{false};
     const unsigned _count{std::thread::hardware_concurrency()};
     spin_mutex _mutex;
     std::binary_semaphore _pop{0};
+    // the owner is between two tasks, looking for the next one or asleep in pop()
+    std::atomic<bool> _looking{false};
+    // somebody woke the owner up to look at the other queues, see task_system::submit()
+    std::atomic<bool> _nudged{false};
+
+    auto ring(task_priority priority) noexcept -> task_ring & { return _q[static_cast<std::size_t>(priority)]; }
+
+    auto empty() const noexcept -> bool {
+        return std::ranges::all_of(_q, [] ( auto const & q ) { return q.empty(); });
+    }
+
+    auto depth() const noexcept -> std::size_t {
+        auto n = std::size_t{0};
+        for ( auto const & q : _q ) { n += q.size(); }
+        return n;
+    }
 
 public:
-    auto try_pop(std::function<void()>& x) noexcept -> bool {
+    // `left` is how many tasks, of any class, are still queued after this one
+    auto try_pop(small_task& x, task_priority priority, std::size_t & left) noexcept -> pop_result {
         lock_t lock{_mutex, std::try_to_lock};
-        if ( !lock || _q.empty() ) { return false; }
-        x = std::move(_q.front());
-        _q.pop_front();
-        return true;
+        if ( !lock ) { return pop_result::busy; }
+        if ( ring(priority).empty() ) { return pop_result::empty; }
+        ring(priority).pop_front(x);
+        left = depth();
+        return pop_result::popped;
     }
 
-    constexpr auto try_push(auto && f) noexcept -> bool {
+    // the task is only moved from if it was pushed
+    auto try_push(small_task & f, task_priority priority) noexcept -> bool {
         {
             lock_t lock{_mutex, std::try_to_lock};
             if (!lock) { return false; }
-            _q.emplace_back(std::forward<decltype(f)>(f));
+            ring(priority).emplace_back(std::move(f));
         }
         _pop.release();
         return true;
@@ -48,55 +197,163 @@ public:
     auto clear() noexcept -> void {
         {
             lock_t lock{_mutex};
-            _q.clear();
+            for ( auto & q : _q ) { q.clear(); }
         }
         _pop.release(_count);
     }
 
-    auto pop(std::function<void()>& x) noexcept -> bool {
-        while ( _q.empty() && !_done ) {
-            _pop.acquire();
-        }
-        lock_t lock{_mutex};
-        if ( _q.empty() ) {
-            _pop.release();
-            return false;
+    auto looking() const noexcept -> bool { return _looking.load(); }
+
+    auto looking(bool l) noexcept -> void { _looking.store(l); }
+
+    // wakes the owner up, if it's asleep in pop(), with nothing in its own queue
+    auto nudge() noexcept -> void {
+        _nudged.store(true, std::memory_order_release);
+        _pop.release();
+    }
+
+    // the most urgent task in this queue, false only once the queue is done. after a nudge() it's true but x is left
+    // empty: the task is elsewhere
+    auto pop(small_task& x, std::size_t & left) noexcept -> bool {
+        while ( true ) {
+            while ( empty() && !_done ) {
+                _pop.acquire();
+                if ( _nudged.exchange(false, std::memory_order_acquire) ) { return true; }
+            }
+            lock_t lock{_mutex};
+            for ( auto priority : task_priorities ) {
+                if ( !ring(priority).empty() ) {
+                    ring(priority).pop_front(x);
+                    left = depth();
+                    return true;
+                }
+            }
+            if ( _done ) {
+                _pop.release();
+                return false;
+            }
+            // another worker stole the task in between: back to sleep, the worker would be gone for good otherwise
         }
-        x = std::move( _q.front() );
-        _q.pop_front();
-        return true;
     }
 
-    auto push(auto && f) noexcept -> void {
+    auto push(small_task && f, task_priority priority) noexcept -> void {
         {
             lock_t lock{_mutex};
-            _q.emplace_back( std::forward<decltype(f)>(f));
+            ring(priority).emplace_back(std::move(f));
         }
         _pop.release();
     }
+
+    // how many times its lock was found taken, see custom_locks.hpp
+    auto contended() const noexcept -> std::uint64_t { return _mutex.contended(); }
+};
+
+// what a worker did, in total since the task system started: the tasks it ran, how many of them it took from the
+// queue of another worker, how many other queues it found empty or locked while looking for one, how many times
+// its own queue was found locked, the time spent running tasks and blocked waiting for one, and the sum of the
+// depth of its queue every time it took a task from it.
+// the difference of two of them is what happened in between, see scheduler_stats.hpp
+struct worker_stats {
+    std::uint64_t tasks{0};
+    std::uint64_t steals{0};
+    std::uint64_t failed_steals{0};
+    std::uint64_t contended{0};
+    std::uint64_t busy_ns{0};
+    std::uint64_t blocked_ns{0};
+    std::uint64_t depth_sum{0};
+
+    auto operator-(worker_stats const & o) const noexcept -> worker_stats {
+        return { tasks - o.tasks, steals - o.steals, failed_steals - o.failed_steals, contended - o.contended,
+                 busy_ns - o.busy_ns, blocked_ns - o.blocked_ns, depth_sum - o.depth_sum };
+    }
+};
+
+// the live counters of a worker. only the worker itself writes them, so they are just relaxed loads and stores, no
+// read-modify-write, and each worker has its own cache line: keeping them costs a couple of clock reads per task
+struct alignas(64) worker_counters {
+    std::atomic<std::uint64_t> tasks{0};
+    std::atomic<std::uint64_t> steals{0};
+    std::atomic<std::uint64_t> failed_steals{0};
+    std::atomic<std::uint64_t> busy_ns{0};
+    std::atomic<std::uint64_t> blocked_ns{0};
+    std::atomic<std::uint64_t> depth_sum{0};
+
+    static auto add(std::atomic<std::uint64_t> & counter, std::uint64_t n) noexcept -> void {
+        counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
 };
 
 
 class task_system {
-    const unsigned _count{std::thread::hardware_concurrency()};
+    const unsigned _count;
     std::vector<std::jthread> _threads;
     std::vector<notification_queue> _q{_count};
+    std::vector<worker_counters> _counters{_count};
     std::atomic<unsigned> _index{0};
 
+    static auto nanoseconds(std::chrono::steady_clock::duration d) noexcept -> std::uint64_t {
+        return static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(d).count());
+    }
+
     constexpr auto run(std::stop_token const & s, unsigned i) noexcept -> void {
+        if constexpr ( tracing_enabled ) { render_trace::name_thread("worker " + std::to_string(i)); }
+        auto & counters = _counters[i];
         while ( !s.stop_requested() ) {
-            auto f = std::function<void()>{};
-            for ( unsigned n = 0; n != _count * 2; ++n ) {
-                if ( _q[ (i + n) % _count].try_pop(f) ) { break; }
+            auto f = small_task{};
+            auto left = std::size_t{0};
+            // everything between the end of a task and the start of the next one is idle time
+            auto idle_start = trace_clock::time_point{};
+            if constexpr ( tracing_enabled ) { idle_start = trace_clock::now(); }
+            // from here on an interactive task pushed on the queue of a busy worker nudges this one, see submit()
+            _q[i].looking(true);
+            // every queue is looked at for interactive tasks first, only then for background ones
+            for ( auto priority : task_priorities ) {
+                for ( unsigned n = 0; n != _count * 2 && !f; ++n ) {
+                    const auto q = (i + n) % _count;
+                    const auto result = _q[q].try_pop(f, priority, left);
+                    if ( q == i ) { continue; }
+                    worker_counters::add(result == pop_result::popped ? counters.steals : counters.failed_steals, 1);
+                }
+                if ( f ) { break; }
+            }
+            if ( !f ) {
+                const auto blocked = std::chrono::steady_clock::now();
+                const auto popped = _q[i].pop(f, left);
+                worker_counters::add(counters.blocked_ns, nanoseconds(std::chrono::steady_clock::now() - blocked));
+                if ( !popped ) { break; }
+            }
+            _q[i].looking(false);
+            // nudged, the task it was woken up for is in another queue
+            if ( !f ) { continue; }
+            if constexpr ( tracing_enabled ) {
+                render_trace::record(trace_event{ "idle", "scheduler", idle_start, trace_clock::now() });
             }
-            if ( !f && !_q[i].pop(f) ) { break; }
+            worker_counters::add(counters.depth_sum, left);
 
+            auto busy = trace_scope("busy", "scheduler");
+            const auto start = std::chrono::steady_clock::now();
             f();
+            worker_counters::add(counters.busy_ns, nanoseconds(std::chrono::steady_clock::now() - start));
+            worker_counters::add(counters.tasks, 1);
+        }
+    }
+
+    // the owner of queue q may be in the middle of a long background task: unless it's looking for work already,
+    // a worker that is gets woken up to take the task pushed there. a worker that starts looking after the push finds
+    // it anyway, it goes through every queue before going to sleep
+    auto nudge_for(unsigned q) noexcept -> void {
+        if ( _q[q].looking() ) { return; }
+        for ( unsigned n = 1; n != _count; ++n ) {
+            auto & other = _q[(q + n) % _count];
+            if ( other.looking() ) {
+                other.nudge();
+                return;
+            }
         }
     }
 
 public:
-    task_system() {
+    explicit task_system(unsigned count = std::thread::hardware_concurrency()) : _count{ count > 0 ? count : 1 } {
         for ( unsigned n = 0; n != _count; ++n ) {
             _threads.emplace_back( [&, n, s = std::stop_token{}] { run(s, n); } );
         }
@@ -115,18 +372,50 @@ public:
         for ( auto & q : _q ) { q.clear(); }
     }
 
+    auto size() const noexcept -> unsigned { return _count; }
+
+    // what every worker did so far, see worker_stats
+    auto stats() const -> std::vector<worker_stats> {
+        auto result = std::vector<worker_stats>(_count);
+        for ( auto n{0u}; n < _count; ++n ) {
+            auto const & c = _counters[n];
+            result[n] = { c.tasks.load(std::memory_order_relaxed), c.steals.load(std::memory_order_relaxed),
+                          c.failed_steals.load(std::memory_order_relaxed), _q[n].contended(),
+                          c.busy_ns.load(std::memory_order_relaxed), c.blocked_ns.load(std::memory_order_relaxed),
+                          c.depth_sum.load(std::memory_order_relaxed) };
+        }
+        return result;
+    }
+
+    // queues f(args...) to be run by a worker, in the class given
     template<typename F, typename ...Args>
-    constexpr auto async(F && f, Args &&... args) noexcept -> void {
+    auto submit(task_priority priority, F && f, Args &&... args) noexcept -> void {
+        auto task = small_task([ fn = std::forward<F>(f), args = std::tuple{std::forward<Args>(args)...} ] {
+            return std::apply(std::move(fn), std::move(args));
+        });
         auto i = _index++;
-        for ( unsigned n = 0; n != _count * 4; ++n ) {
-            if ( _q[ (i + n) % _count ].try_push(
-                    [ fn = std::forward<F>(f), args = std::tuple{std::forward<Args>(args)...} ] {
-                        return std::apply(std::move(fn), std::move(args));
-                    } ) ) { return; }
+        auto q = i % _count;
+        auto pushed = false;
+        for ( unsigned n = 0; n != _count * 4 && !pushed; ++n ) {
+            q = (i + n) % _count;
+            pushed = _q[q].try_push(task, priority);
         }
-        _q[ i % _count ].push(
-                [ fn = std::forward<F>(f), args = std::tuple{std::forward<Args>(args)...} ] {
-                    return std::apply(std::move(fn), std::move(args)); } );
+        if ( !pushed ) {
+            q = i % _count;
+            _q[q].push(std::move(task), priority);
+        }
+        if ( priority == task_priority::interactive ) { nudge_for(q); }
+    }
+
+    template<typename F, typename ...Args>
+    auto async(F && f, Args &&... args) noexcept -> void {
+        submit(task_priority::interactive, std::forward<F>(f), std::forward<Args>(args)...);
+    }
+
+    // the same, for a task nobody is waiting on right now
+    template<typename F, typename ...Args>
+    auto async_background(F && f, Args &&... args) noexcept -> void {
+        submit(task_priority::background, std::forward<F>(f), std::forward<Args>(args)...);
     }
 };
 
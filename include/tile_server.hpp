@@ -0,0 +1,333 @@
+#ifndef TILE_SERVER_HPP
+#define TILE_SERVER_HPP
+
+#include <algorithm>
+#include <array>
+#include <charconv>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "fmt/core.h"
+#include "autotune.hpp"
+#include "cli.hpp"
+#include "disk_cache.hpp"
+#include "lru_cache.hpp"
+#include "mandel_kernel.hpp"
+#include "net.hpp"
+#include "png_writer.hpp"
+#include "task_system.hpp"
+
+
+// a slippy-map tile server: answers `GET /{z}/{x}/{y}.png` with a 256x256 tile rendered on demand, so that the set
+// can be browsed with any web map viewer (leaflet, openlayers, ...) pointed at http://host:port/{z}/{x}/{y}.png.
+// zoom level 0 is a single tile covering [-2, 2] x [-2, 2], every level splits each tile in 4.
+//
+// tiles go through four stages: the lru of encoded tiles, then the tiles being rendered, whose requests are merged
+// so that two clients asking for the same tile at the same time wait for the same render, then the queue of tiles to
+// render and finally the disk cache, with --disk-cache, which is looked at before actually rendering. the queue has
+// two classes: the tiles someone is looking at go before the prefetched ones, which are the requests with
+// `?prefetch` or a `Purpose: prefetch` header, and a prefetched tile that becomes visible is promoted. tiles are
+// rendered one at a time, with their lines spread on the task system.
+//
+// usage: mandelbrot_avx --serve [--port N] [--bind ADDR | --unix PATH] [--cache-mb N] [--max-connections N]
+//                       [--disk-cache [DIR]] [--disk-cache-mb N]
+//                       [--max-iter N] [--aa N] [--adaptive N] [--formula NAME] [--julia RE IM] ...
+
+struct tile_server_options {
+    std::string bind{"127.0.0.1"};
+    int port{8080};
+    // when set, listen on this unix socket instead of tcp
+    std::string unix_socket{};
+    std::size_t cache_bytes{std::size_t{256} << 20};
+    // each connection has a thread, past this many the next ones wait to be accepted
+    int max_connections{64};
+    // a connection with nothing to ask for this long is closed, so that idle keep-alives give their slot back
+    int idle_seconds{30};
+    // see autotune.hpp
+    int lines_per_task{1};
+};
+
+inline auto tile_server_options_from(cli_args const & args) -> tile_server_options
+{
+    auto opts = tile_server_options{};
+    opts.bind = args.get("--bind", opts.bind);
+    opts.port = args.get("--port", opts.port);
+    opts.unix_socket = args.get("--unix", opts.unix_socket);
+    opts.cache_bytes = static_cast<std::size_t>(std::max(1, args.get("--cache-mb", 256))) << 20;
+    opts.max_connections = std::max(1, args.get("--max-connections", opts.max_connections));
+    return opts;
+}
+
+constexpr auto tile_size = 256;
+// past this the tiles are smaller than what a double can tell apart anyway
+constexpr auto max_tile_zoom = 48;
+
+struct tile_key {
+    int z;
+    std::int64_t x;
+    std::int64_t y;
+
+    auto operator==(tile_key const &) const -> bool = default;
+};
+
+struct tile_key_hash {
+    auto operator()(tile_key const & k) const noexcept -> std::size_t {
+        auto h = std::hash<std::int64_t>{}(k.x);
+        h ^= std::hash<std::int64_t>{}(k.y) + 0x9e3779b97f4a7c15 + (h << 6) + (h >> 2);
+        h ^= std::hash<int>{}(k.z) + 0x9e3779b97f4a7c15 + (h << 6) + (h >> 2);
+        return h;
+    }
+};
+
+// the region of the plane covered by a tile. rows go from min_im to max_im like in every other mode
+inline auto tile_viewport(tile_key const & key) noexcept -> viewport
+{
+    const auto size = 4. / static_cast<double>(std::int64_t{1} << key.z);
+    const auto min_re = -2. + size * static_cast<double>(key.x);
+    const auto min_im = -2. + size * static_cast<double>(key.y);
+    return { min_re, min_re + size, min_im, min_im + size };
+}
+
+// parses `/{z}/{x}/{y}.png`, anything out of range is not a tile
+inline auto parse_tile_path(std::string_view path) noexcept -> std::optional<tile_key>
+{
+    auto number = [ & ] ( auto & value, char separator ) -> bool {
+        if ( path.empty() || path.front() != separator ) { return false; }
+        auto [ptr, ec] = std::from_chars(path.data() + 1, path.data() + path.size(), value);
+        if ( ec != std::errc{} ) { return false; }
+        path.remove_prefix(static_cast<std::size_t>(ptr - path.data()));
+        return true;
+    };
+    auto key = tile_key{};
+    if ( !number(key.z, '/') || !number(key.x, '/') || !number(key.y, '/') || path != ".png" ) { return std::nullopt; }
+    if ( key.z < 0 || key.z > max_tile_zoom ) { return std::nullopt; }
+    const auto tiles = std::int64_t{1} << key.z;
+    if ( key.x < 0 || key.x >= tiles || key.y < 0 || key.y >= tiles ) { return std::nullopt; }
+    return key;
+}
+
+class tile_server {
+    using tile_ptr = std::shared_ptr<std::vector<std::uint8_t> const>;
+
+    // a tile somebody asked for and that is not in the cache yet
+    struct tile_job {
+        tile_key key;
+        std::promise<tile_ptr> promise;
+        std::shared_future<tile_ptr> result{promise.get_future().share()};
+        bool visible{false};
+        bool started{false};
+    };
+
+    task_system & _tasks;
+    // may be null
+    std::shared_ptr<disk_cache> _disk;
+    const render_settings _settings;
+    const tile_server_options _opts;
+
+    // everything below is guarded by _mutex
+    std::mutex _mutex;
+    std::condition_variable_any _pending;
+    lru_cache<tile_key, tile_ptr, tile_key_hash> _cache;
+    std::unordered_map<tile_key, std::shared_ptr<tile_job>, tile_key_hash> _in_flight;
+    std::deque<std::shared_ptr<tile_job>> _visible;
+    std::deque<std::shared_ptr<tile_job>> _prefetch;
+
+    // declared last, so that it's stopped before anything it uses goes away
+    std::jthread _renderer;
+
+    auto render(tile_key const & key) const -> tile_ptr {
+        auto scope = trace_scope("render_tile", "tiles", key.z);
+        auto frame = std::make_shared<render_frame>(tile_size, tile_size);
+        const auto view = tile_viewport(key);
+        const auto cache_key = frame_key_of(view, tile_size, tile_size, _settings);
+        if ( !_disk || !_disk->load(cache_key, *frame) ) {
+            render_blocking(_tasks, *frame, view, _settings, _opts.lines_per_task);
+            if ( _disk ) { store_later(_tasks, _disk, cache_key, frame); }
+        }
+        const auto * pixels = &(frame->image.raw_data()->r);
+        return std::make_shared<std::vector<std::uint8_t> const>(encode_png(pixels, tile_size, tile_size));
+    }
+
+    // the visible queue is always drained first. a promoted tile sits in both queues, whichever copy comes second
+    // is already started and gets skipped
+    auto render_loop(std::stop_token const & stop) -> void {
+        while ( true ) {
+            auto job = std::shared_ptr<tile_job>{};
+            {
+                auto lock = std::unique_lock{_mutex};
+                _pending.wait(lock, stop, [ & ] { return !_visible.empty() || !_prefetch.empty(); });
+                if ( stop.stop_requested() ) { return; }
+                auto & queue = _visible.empty() ? _prefetch : _visible;
+                job = std::move(queue.front());
+                queue.pop_front();
+                if ( job->started ) { continue; }
+                job->started = true;
+            }
+            auto tile = render(job->key);
+            {
+                auto lock = std::lock_guard{_mutex};
+                _cache.insert(job->key, tile, tile->size());
+                _in_flight.erase(job->key);
+            }
+            job->promise.set_value(std::move(tile));
+        }
+    }
+
+public:
+    tile_server(task_system & tasks, std::shared_ptr<disk_cache> disk, render_settings const & settings,
+                tile_server_options const & opts)
+        : _tasks{tasks}, _disk{std::move(disk)}, _settings{settings}, _opts{opts}, _cache{opts.cache_bytes},
+          _renderer{[ this ] ( std::stop_token const & s ) { render_loop(s); }} {}
+
+    // the encoded tile, either straight from the cache or once it's rendered
+    auto request(tile_key const & key, bool prefetch) -> std::shared_future<tile_ptr> {
+        auto lock = std::lock_guard{_mutex};
+        if ( auto cached = _cache.get(key) ) {
+            auto ready = std::promise<tile_ptr>{};
+            ready.set_value(std::move(*cached));
+            return ready.get_future().share();
+        }
+        if ( auto it = _in_flight.find(key); it != _in_flight.end() ) {
+            auto & job = it->second;
+            if ( !prefetch && !job->visible && !job->started ) {
+                job->visible = true;
+                _visible.push_back(job);
+                _pending.notify_one();
+            }
+            return job->result;
+        }
+        auto job = std::make_shared<tile_job>();
+        job->key = key;
+        job->visible = !prefetch;
+        (prefetch ? _prefetch : _visible).push_back(job);
+        _in_flight.emplace(key, job);
+        _pending.notify_one();
+        return job->result;
+    }
+
+    // listens and answers forever, returns only if the socket can't be set up or accept keeps failing
+    auto serve() -> int;
+
+private:
+    auto handle_connection(int fd) -> void;
+};
+
+// case insensitive search of a header line starting with `name`, returns its value
+inline auto find_header(std::string_view headers, std::string_view name) noexcept -> std::optional<std::string_view>
+{
+    auto lower = [] ( char c ) { return static_cast<char>(c >= 'A' && c <= 'Z' ? c + ('a' - 'A') : c); };
+    while ( !headers.empty() ) {
+        auto end = headers.find("\r\n");
+        auto line = headers.substr(0, end);
+        headers.remove_prefix(end == std::string_view::npos ? headers.size() : end + 2);
+        if ( line.size() <= name.size() || line[name.size()] != ':' ) { continue; }
+        if ( !std::ranges::equal(line.substr(0, name.size()), name, {}, lower, lower) ) { continue; }
+        auto value = line.substr(name.size() + 1);
+        while ( !value.empty() && value.front() == ' ' ) { value.remove_prefix(1); }
+        return value;
+    }
+    return std::nullopt;
+}
+
+// one thread per connection, answering its requests in order. keep-alive is the default, browsers keep a handful
+// of connections open per host and reuse them for every tile
+inline auto tile_server::handle_connection(int fd) -> void
+{
+    auto buffer = std::string{};
+    auto chunk = std::array<char, 4096>{};
+    while ( true ) {
+        auto header_end = buffer.find("\r\n\r\n");
+        while ( header_end == std::string::npos ) {
+            if ( buffer.size() > 16384 ) { ::close(fd); return; }
+            auto received = ::recv(fd, chunk.data(), chunk.size(), 0);
+            if ( received <= 0 ) { ::close(fd); return; }
+            buffer.append(chunk.data(), static_cast<std::size_t>(received));
+            header_end = buffer.find("\r\n\r\n");
+        }
+        const auto head = std::string_view(buffer).substr(0, header_end + 2);
+        const auto request_line = head.substr(0, head.find("\r\n"));
+        const auto headers = head.substr(request_line.size() + 2);
+
+        // "GET /z/x/y.png?query HTTP/1.1"
+        const auto method_end = request_line.find(' ');
+        const auto target_end = request_line.rfind(' ');
+        const auto method = request_line.substr(0, method_end);
+        auto target = method_end < target_end ? request_line.substr(method_end + 1, target_end - method_end - 1)
+                                              : std::string_view{};
+        const auto query = target.find('?');
+        const auto path = target.substr(0, query);
+        const auto prefetch = ( query != std::string_view::npos && target.substr(query).find("prefetch") != std::string_view::npos )
+                              || find_header(headers, "purpose").value_or("").starts_with("prefetch")
+                              || find_header(headers, "sec-purpose").value_or("").starts_with("prefetch");
+        const auto keep_alive = find_header(headers, "connection").value_or("") != "close"
+                                && request_line.ends_with("HTTP/1.1");
+
+        auto response = std::string{};
+        auto body = tile_ptr{};
+        auto key = parse_tile_path(path);
+        if ( method != "GET" ) {
+            response = "HTTP/1.1 405 Method Not Allowed\r\nAllow: GET\r\nContent-Length: 0\r\n";
+        } else if ( !key ) {
+            response = "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\n";
+        } else {
+            body = request(*key, prefetch).get();
+            response = fmt::format("HTTP/1.1 200 OK\r\nContent-Type: image/png\r\nContent-Length: {}\r\n"
+                                   "Cache-Control: public, max-age=86400\r\nAccess-Control-Allow-Origin: *\r\n",
+                                   body->size());
+        }
+        response += keep_alive ? "Connection: keep-alive\r\n\r\n" : "Connection: close\r\n\r\n";
+        auto sent = send_all(fd, response);
+        if ( sent && body ) {
+            sent = send_all(fd, std::string_view(reinterpret_cast<char const *>(body->data()), body->size()));
+        }
+        if ( !sent || !keep_alive ) { ::close(fd); return; }
+        buffer.erase(0, header_end + 4);
+    }
+}
+
+inline auto tile_server::serve() -> int
+{
+    auto fd = _opts.unix_socket.empty() ? listen_tcp(_opts.bind, _opts.port) : listen_unix(_opts.unix_socket);
+    if ( fd < 0 ) {
+        fmt::print(stderr, "can't listen on {}\n",
+                   _opts.unix_socket.empty() ? fmt::format("{}:{}", _opts.bind, _opts.port) : _opts.unix_socket);
+        return 1;
+    }
+    if ( _opts.unix_socket.empty() ) {
+        fmt::print(stderr, "serving tiles on http://{}:{}/{{z}}/{{x}}/{{y}}.png\n", _opts.bind, _opts.port);
+    } else {
+        fmt::print(stderr, "serving tiles on {}\n", _opts.unix_socket);
+    }
+    serve_connections(fd, _opts.max_connections, [ this ] ( int client ) {
+        set_receive_timeout(client, _opts.idle_seconds);
+        handle_connection(client);
+    });
+    fmt::print(stderr, "accept keeps failing, stopping\n");
+    ::close(fd);
+    return 1;
+}
+
+// the whole --serve mode
+inline auto tile_server_main(cli_args const & args) -> int
+{
+    auto opts = tile_server_options_from(args);
+    const auto settings = settings_from(args);
+    auto disk = make_disk_cache(disk_cache_options_from(args));
+    const auto tuning = tuned_setup_from(args);
+    opts.lines_per_task = tuning.lines_per_task;
+    auto tasks = task_system(tuning.threads);
+    auto server = tile_server(tasks, disk, settings, opts);
+    return server.serve();
+}
+
+#endif
@@ -0,0 +1,383 @@
+#ifndef ZOOM_VIDEO_HPP
+#define ZOOM_VIDEO_HPP
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdio>
+#include <latch>
+#include <numbers>
+#include <string>
+#include <vector>
+
+#include "fmt/core.h"
+#include "autotune.hpp"
+#include "cli.hpp"
+#include "mandel_kernel.hpp"
+#include "spl/image.hpp"
+#include "task_system.hpp"
+
+
+// zoom videos from a single exponential map.
+// instead of rendering every frame from scratch, the whole zoom path is rendered once as a log-polar strip around the
+// target point: column j is the angle 2*pi*j/W, row k is the radius r_max * exp(-k * 2*pi/W), so that a texel is
+// square and every row covers a ring a bit smaller than the previous one. every frame of the video is then just a
+// resampling of the strip, and the iteration cost of the whole video is the one of the strip, W^2 * ln(zoom) / 2pi
+// samples, no matter how many frames it has.
+// with keyframes, every N-th frame is also rendered directly. what it has that the resampled one lacks, the
+// difference of the two, is added to it and faded into the frames on both sides, scaled to their zoom, so the
+// quality goes smoothly up towards each keyframe and back down instead of popping on it.
+//
+// usage: mandelbrot_avx --zoom-video --center RE IM [--start-radius R] [--end-radius R] [--frames N] [--size N]
+//                       [--width W] [--height H] [--fps N] [--keyframes N] [--output prefix | --y4m]
+//                       [--max-iter N] [--aa N] [--bw] [--smooth]
+
+struct zoom_video_options {
+    double center_re{-0.743643887037151};
+    double center_im{0.131825904205330};
+    // half the width of the first and of the last frame, the height follows the aspect
+    double start_radius{2.0};
+    double end_radius{1e-10};
+    int frames{300};
+    int width{1000};
+    int height{1000};
+    int fps{30};
+    // every `keyframes` frames one is rendered directly with the kernel and refines the frames around it, 0 to never
+    // do it
+    int keyframes{0};
+    std::string output{"zoom"};
+    bool y4m{false};
+};
+
+inline auto zoom_video_options_from(cli_args const & args) -> zoom_video_options
+{
+    auto opts = zoom_video_options{};
+    opts.center_re = args.get("--center", opts.center_re, 1);
+    opts.center_im = args.get("--center", opts.center_im, 2);
+    opts.start_radius = args.get("--start-radius", opts.start_radius);
+    opts.end_radius = args.get("--end-radius", opts.end_radius);
+    opts.frames = std::max(2, args.get("--frames", opts.frames));
+    // --size N for a square one
+    const auto size = args.get("--size", opts.width);
+    opts.width = std::max(1, args.get("--width", size));
+    opts.height = std::max(1, args.get("--height", size));
+    opts.fps = std::max(1, args.get("--fps", opts.fps));
+    opts.keyframes = std::max(0, args.get("--keyframes", opts.keyframes));
+    opts.output = args.get("--output", opts.output);
+    opts.y4m = args.has("--y4m");
+    return opts;
+}
+
+// half the width of frame f, the radius shrinks by the same factor from a frame to the next
+inline auto frame_radius(zoom_video_options const & opts, int f) noexcept -> double
+{
+    const auto progress = static_cast<double>(f) / (opts.frames - 1);
+    return opts.start_radius * std::pow(opts.end_radius / opts.start_radius, progress);
+}
+
+// the exponential strip: W angles times H radii, plus how to go from a radius to a row
+struct exp_strip {
+    spl::graphics::image texels;
+    double r_max;
+    // log-radius step between two rows, which is also the angle step between two columns
+    double step;
+
+    auto width() const noexcept -> int { return static_cast<int>(texels.width()); }
+    auto height() const noexcept -> int { return static_cast<int>(texels.height()); }
+};
+
+// renders the strip, one row per task. the angular resolution is chosen so that a texel is as big as a frame pixel
+// on the circle inscribed in the frame, and the rows go from the corner of the first frame down to half a pixel of
+// the last one.
+inline auto render_strip(task_system & tasks, zoom_video_options const & opts, render_settings const & settings)
+    -> exp_strip
+{
+    constexpr auto two_pi = 2 * std::numbers::pi;
+    // the strip itself goes 8 angles at a time, whatever the size of the frames
+    const auto columns = static_cast<int>(std::ceil(std::numbers::pi * std::min(opts.width, opts.height) / 8)) * 8;
+    const auto step = two_pi / columns;
+    const auto r_max = opts.start_radius * std::hypot(opts.width, opts.height) / opts.width;
+    const auto r_min = opts.end_radius / opts.width;
+    const auto rows = static_cast<int>(std::ceil(std::log(r_max / r_min) / step)) + 1;
+    fmt::print(stderr, "exponential strip: {}x{} texels, {:.1f} frames worth of samples\n",
+               columns, rows, static_cast<double>(columns) * rows / (static_cast<double>(opts.width) * opts.height));
+
+    auto strip = exp_strip{ spl::graphics::image(static_cast<std::size_t>(columns), static_cast<std::size_t>(rows)),
+                            r_max, step };
+    auto done = std::latch{rows};
+    auto rows_done = std::atomic<int>{0};
+    for ( auto row{0}; row < rows; ++row ) {
+        tasks.async([ & ] ( int k ) {
+            auto line = std::vector<spl::graphics::rgba>{};
+            line.reserve(static_cast<std::size_t>(columns));
+            const auto _aa = _mm256_set1_ps(static_cast<float>(settings.anti_aliasing));
+            // a texel of this row is as wide as the arc it spans
+            const auto texel_size = r_max * std::exp(-k * step) * step;
+            for ( auto j{0}; j < columns; j += 8 ) {
+                auto red = _mm256_setzero_ps();
+                auto green = _mm256_setzero_ps();
+                auto blue = _mm256_setzero_ps();
+                const auto _texels = _mm512_add_epi64(_mm512_set1_epi64(j), _mm512_set_epi64(7, 6, 5, 4, 3, 2, 1, 0));
+                const auto _keys = pixel_keys(_texels, static_cast<std::uint64_t>(k));
+                for ( auto aa{0}; aa < settings.anti_aliasing; ++aa ) {
+                    // the jitter is in texel units along both the angle and the log-radius
+                    auto [_dx, _dy] = jitter(_keys, aa, settings.anti_aliasing);
+                    alignas(64) auto re = std::array<double, 8>{};
+                    alignas(64) auto im = std::array<double, 8>{};
+                    for ( auto t{0}; t < 8; ++t ) {
+                        const auto r = r_max * std::exp(-(k + _dy[t]) * step);
+                        const auto theta = (j + t + _dx[t]) * step;
+                        re[t] = opts.center_re + r * std::cos(theta);
+                        im[t] = opts.center_im + r * std::sin(theta);
+                    }
+                    auto s = sample(settings, _mm512_load_pd(re.data()), _mm512_load_pd(im.data()), texel_size);
+                    red += s.red;
+                    green += s.green;
+                    blue += s.blue;
+                }
+                red = _mm256_div_ps(red, _aa);
+                green = _mm256_div_ps(green, _aa);
+                blue = _mm256_div_ps(blue, _aa);
+                for ( auto t{0}; t < 8; ++t ) {
+                    line.emplace_back(static_cast<uint8_t>(red[t]),
+                                      static_cast<uint8_t>(green[t]),
+                                      static_cast<uint8_t>(blue[t]));
+                }
+            }
+            std::copy(line.begin(), line.end(), strip.texels.get_pixel_iterator(0, static_cast<std::size_t>(k)));
+            if ( auto n = ++rows_done; n % 1000 == 0 ) { fmt::print(stderr, "strip rows: {}/{}\n", n, rows); }
+            done.count_down();
+        }, row);
+    }
+    done.wait();
+    return strip;
+}
+
+// bilinear lookup of the strip at fractional (column, row), wrapping around in angle and clamping in radius
+inline auto strip_lookup(exp_strip const & strip, double column, double row) noexcept -> std::array<float, 3>
+{
+    const auto w = strip.width();
+    const auto h = strip.height();
+    row = std::clamp(row, 0., static_cast<double>(h - 1));
+    const auto c0 = static_cast<int>(std::floor(column));
+    const auto r0 = static_cast<int>(row);
+    const auto fc = static_cast<float>(column - c0);
+    const auto fr = static_cast<float>(row - r0);
+    const auto r1 = std::min(r0 + 1, h - 1);
+    const auto wrap = [ w ] ( int c ) { return static_cast<std::size_t>(((c % w) + w) % w); };
+    const auto * texels = strip.texels.raw_data();
+    auto at = [ & ] ( int c, int r ) -> spl::graphics::rgba const & {
+        return texels[static_cast<std::size_t>(r) * static_cast<std::size_t>(w) + wrap(c)];
+    };
+    auto mix = [ & ] ( auto channel ) {
+        const auto top = std::lerp(static_cast<float>(at(c0, r0).*channel), static_cast<float>(at(c0 + 1, r0).*channel), fc);
+        const auto bottom = std::lerp(static_cast<float>(at(c0, r1).*channel), static_cast<float>(at(c0 + 1, r1).*channel), fc);
+        return std::lerp(top, bottom, fr);
+    };
+    return { mix(&spl::graphics::rgba::r), mix(&spl::graphics::rgba::g), mix(&spl::graphics::rgba::b) };
+}
+
+// resamples frame `radius` (half width of the frame) out of the strip.
+// close to the center of a frame a single pixel spans many strip texels, so there the pixel gets up to 4x4 taps
+// instead of a single bilinear one, otherwise the middle of every frame would sparkle.
+inline auto resample_frame(task_system & tasks, exp_strip const & strip, zoom_video_options const & opts,
+                           double radius, spl::graphics::image & frame) -> void
+{
+    const auto width = opts.width;
+    const auto height = opts.height;
+    const auto pixel = 2 * radius / width;
+    auto done = std::latch{height};
+    for ( auto y{0}; y < height; ++y ) {
+        tasks.async([ & ] ( int line ) {
+            auto out = frame.get_pixel_iterator(0, static_cast<std::size_t>(line));
+            for ( auto x{0}; x < width; ++x, ++out ) {
+                const auto dx = (x + 0.5 - width / 2.) * pixel;
+                const auto dy = (line + 0.5 - height / 2.) * pixel;
+                const auto r = std::max(std::hypot(dx, dy), pixel * 0.25);
+                // how many strip texels a pixel covers at this radius
+                const auto footprint = pixel / (r * strip.step);
+                const auto taps = std::clamp(static_cast<int>(std::ceil(footprint)), 1, 4);
+                auto color = std::array<float, 3>{};
+                for ( auto ty{0}; ty < taps; ++ty ) {
+                    for ( auto tx{0}; tx < taps; ++tx ) {
+                        const auto sx = dx + ((tx + 0.5) / taps - 0.5) * pixel;
+                        const auto sy = dy + ((ty + 0.5) / taps - 0.5) * pixel;
+                        const auto sr = std::max(std::hypot(sx, sy), pixel * 0.25);
+                        auto theta = std::atan2(sy, sx);
+                        if ( theta < 0 ) { theta += 2 * std::numbers::pi; }
+                        auto c = strip_lookup(strip, theta / strip.step, std::log(strip.r_max / sr) / strip.step);
+                        for ( auto ch{0}; ch < 3; ++ch ) { color[ch] += c[ch]; }
+                    }
+                }
+                const auto n = static_cast<float>(taps * taps);
+                *out = spl::graphics::rgba{ static_cast<uint8_t>(color[0] / n),
+                                            static_cast<uint8_t>(color[1] / n),
+                                            static_cast<uint8_t>(color[2] / n) };
+            }
+            done.count_down();
+        }, y);
+    }
+    done.wait();
+}
+
+// what the direct render of keyframe `index` has over the frame resampled from the strip, per pixel and channel
+struct keyframe_residual {
+    int index{-1};
+    double radius{0};
+    std::vector<float> delta;
+};
+
+inline auto keyframe_residual_at(task_system & tasks, exp_strip const & strip, zoom_video_options const & opts,
+                                 render_settings const & settings, int lines_per_task, int index) -> keyframe_residual
+{
+    const auto width = static_cast<std::size_t>(opts.width);
+    const auto height = static_cast<std::size_t>(opts.height);
+    const auto radius = frame_radius(opts, index);
+    // the real thing, adaptive AA included
+    auto exact = render_frame(width, height);
+    const auto half_height = radius * opts.height / opts.width;
+    const auto view = viewport{ opts.center_re - radius, opts.center_re + radius,
+                                opts.center_im - half_height, opts.center_im + half_height };
+    render_blocking(tasks, exact, view, settings, lines_per_task);
+    auto resampled = spl::graphics::image(width, height);
+    resample_frame(tasks, strip, opts, radius, resampled);
+
+    auto key = keyframe_residual{ index, radius, std::vector<float>(width * height * 3) };
+    const auto * direct = exact.image.raw_data();
+    const auto * approx = resampled.raw_data();
+    for ( auto p{0u}; p < width * height; ++p ) {
+        key.delta[3 * p] = static_cast<float>(direct[p].r) - static_cast<float>(approx[p].r);
+        key.delta[3 * p + 1] = static_cast<float>(direct[p].g) - static_cast<float>(approx[p].g);
+        key.delta[3 * p + 2] = static_cast<float>(direct[p].b) - static_cast<float>(approx[p].b);
+    }
+    return key;
+}
+
+// adds the residuals of the keyframes before and after the resampled frame of half width `radius`, weighted 1 - t
+// and t, `after` may be null. the frames all share the center, so a keyframe is the frame scaled by
+// radius / key.radius around it and its residual is looked up bilinearly there. a keyframe smaller than the frame
+// only covers its middle: there the residual fades out towards the border of the keyframe, over a width that grows
+// from 0 as the keyframe gets smaller, so that neither the edge nor the fade ever jumps from a frame to the next
+inline auto refine_frame(task_system & tasks, zoom_video_options const & opts, double radius,
+                         keyframe_residual const & before, keyframe_residual const * after, double t,
+                         spl::graphics::image & frame) -> void
+{
+    const auto width = opts.width;
+    const auto height = opts.height;
+    auto add = [ & ] ( keyframe_residual const & key, double weight, int x, int y, std::array<float, 3> & color ) {
+        if ( weight <= 0. ) { return; }
+        const auto scale = radius / key.radius;
+        const auto kx = (x + 0.5 - width / 2.) * scale + width / 2. - 0.5;
+        const auto ky = (y + 0.5 - height / 2.) * scale + height / 2. - 0.5;
+        if ( kx < 0. || ky < 0. || kx > width - 1. || ky > height - 1. ) { return; }
+        const auto ramp = std::min(8., (scale - 1.) * std::min(width, height) / 2.);
+        if ( ramp > 0. ) {
+            const auto edge = std::min({ kx, ky, width - 1. - kx, height - 1. - ky });
+            weight *= std::min(1., edge / ramp);
+        }
+        const auto x0 = static_cast<int>(kx);
+        const auto y0 = static_cast<int>(ky);
+        const auto x1 = std::min(x0 + 1, width - 1);
+        const auto y1 = std::min(y0 + 1, height - 1);
+        const auto fx = static_cast<float>(kx - x0);
+        const auto fy = static_cast<float>(ky - y0);
+        auto at = [ & ] ( int px, int py, int ch ) {
+            return key.delta[(static_cast<std::size_t>(py) * static_cast<std::size_t>(width)
+                              + static_cast<std::size_t>(px)) * 3 + static_cast<std::size_t>(ch)];
+        };
+        for ( auto ch{0}; ch < 3; ++ch ) {
+            const auto top = std::lerp(at(x0, y0, ch), at(x1, y0, ch), fx);
+            const auto bottom = std::lerp(at(x0, y1, ch), at(x1, y1, ch), fx);
+            color[static_cast<std::size_t>(ch)] += static_cast<float>(weight) * std::lerp(top, bottom, fy);
+        }
+    };
+    auto done = std::latch{height};
+    for ( auto y{0}; y < height; ++y ) {
+        tasks.async([ & ] ( int line ) {
+            auto out = frame.get_pixel_iterator(0, static_cast<std::size_t>(line));
+            for ( auto x{0}; x < width; ++x, ++out ) {
+                auto color = std::array<float, 3>{ static_cast<float>(out->r), static_cast<float>(out->g),
+                                                   static_cast<float>(out->b) };
+                add(before, 1. - t, x, line, color);
+                if ( after ) { add(*after, t, x, line, color); }
+                auto channel = [] ( float c ) { return static_cast<uint8_t>(std::clamp(std::round(c), 0.f, 255.f)); };
+                *out = spl::graphics::rgba{ channel(color[0]), channel(color[1]), channel(color[2]) };
+            }
+            done.count_down();
+        }, y);
+    }
+    done.wait();
+}
+
+// writes a frame as 8 bit 4:4:4 y4m, bt.601 limited range
+inline auto write_y4m_frame(std::FILE * out, spl::graphics::image const & frame) -> void
+{
+    const auto pixels = frame.width() * frame.height();
+    auto planes = std::vector<std::uint8_t>(pixels * 3);
+    const auto * data = frame.raw_data();
+    for ( auto p{0u}; p < pixels; ++p ) {
+        const auto r = static_cast<float>(data[p].r);
+        const auto g = static_cast<float>(data[p].g);
+        const auto b = static_cast<float>(data[p].b);
+        planes[p] = static_cast<std::uint8_t>(16.f + 0.257f * r + 0.504f * g + 0.098f * b);
+        planes[pixels + p] = static_cast<std::uint8_t>(128.f - 0.148f * r - 0.291f * g + 0.439f * b);
+        planes[2 * pixels + p] = static_cast<std::uint8_t>(128.f + 0.439f * r - 0.368f * g - 0.071f * b);
+    }
+    std::fputs("FRAME\n", out);
+    std::fwrite(planes.data(), 1, planes.size(), out);
+}
+
+// the whole --zoom-video mode. everything but the y4m stream goes to stderr
+inline auto zoom_video_main(cli_args const & args) -> int
+{
+    const auto opts = zoom_video_options_from(args);
+    const auto settings = settings_from(args);
+    if ( !(opts.end_radius > 0. && opts.end_radius < opts.start_radius) ) {
+        fmt::print(stderr, "the end radius must be positive and smaller than the start radius\n");
+        return 1;
+    }
+    const auto tuning = tuned_setup_from(args);
+    auto tasks = task_system(tuning.threads);
+    auto start_time = std::chrono::steady_clock::now();
+    const auto strip = render_strip(tasks, opts, settings);
+    fmt::print(stderr, "strip done in {:.2f}s\n",
+               std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count());
+
+    if ( opts.y4m ) {
+        std::fprintf(stdout, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C444\n", opts.width, opts.height, opts.fps);
+    }
+    auto frame = spl::graphics::image(static_cast<std::size_t>(opts.width), static_cast<std::size_t>(opts.height));
+    // the keyframes on both sides of the current frame, each rendered once
+    auto before = keyframe_residual{};
+    auto after = keyframe_residual{};
+    for ( auto f{0}; f < opts.frames; ++f ) {
+        const auto radius = frame_radius(opts, f);
+        resample_frame(tasks, strip, opts, radius, frame);
+        if ( opts.keyframes > 0 ) {
+            const auto first = f / opts.keyframes * opts.keyframes;
+            const auto second = first + opts.keyframes;
+            if ( before.index != first ) {
+                before = after.index == first ? std::move(after)
+                                              : keyframe_residual_at(tasks, strip, opts, settings,
+                                                                     tuning.lines_per_task, first);
+            }
+            if ( second < opts.frames && after.index != second ) {
+                after = keyframe_residual_at(tasks, strip, opts, settings, tuning.lines_per_task, second);
+            }
+            const auto t = static_cast<double>(f - first) / opts.keyframes;
+            refine_frame(tasks, opts, radius, before, second < opts.frames ? &after : nullptr, t, frame);
+        }
+        if ( opts.y4m ) {
+            write_y4m_frame(stdout, frame);
+        } else {
+            frame.save_to_file(fmt::format("{}_{:05}.png", opts.output, f));
+        }
+        if ( f % 10 == 0 ) { fmt::print(stderr, "frame {}/{}\n", f, opts.frames); }
+    }
+    std::fflush(stdout);
+    fmt::print(stderr, "zoom video done in {:.2f}s\n",
+               std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count());
+    return 0;
+}
+
+#endif
@@ -0,0 +1,191 @@
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <limits>
+#include <map>
+#include <span>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "fmt/core.h"
+#include "equalize.hpp"
+#include "mandel_kernel.hpp"
+#include "scheduler_stats.hpp"
+#include "task_system.hpp"
+
+
+// kernel benchmark: renders a fixed set of reference views at a few iteration limits with 1..N worker threads, and
+// prints one tab separated line per run on stdout, so that the results of two commits can be diffed or compared
+// with --baseline. lines starting with '#' are comments and are skipped when reading a baseline back.
+//
+// usage: mandelbrot_bench [--size N] [--reps N] [--threads N] [--baseline file] [--formula name] [--trace file]
+//                         [--equalize] [--interior] [--quick] [--scheduler-stats]
+//
+// --interior turns the interior detection on, which makes the points inside the set much cheaper
+// --scheduler-stats prints on stderr what the workers did during every run, see scheduler_stats.hpp
+
+struct reference_view {
+    std::string_view name;
+    double center_re;
+    double center_im;
+    double width;
+    // the iteration limits are multiplied by this for the view: nothing in the deep one escapes before about 2000
+    // iterations, at the limits of the others its rows would time the interior and nothing else
+    int iteration_scale{1};
+};
+
+// the classic places, from cheap to expensive. the deep one sits right at the limit of what doubles can resolve at
+// a 1000 px width, which is where the kernel spends most of its time in practice.
+constexpr auto reference_views = std::array{
+    reference_view{ "full_set",        -0.5,               0.0,               3.0 },
+    reference_view{ "seahorse_valley", -0.7435669,         0.1314023,         3e-3 },
+    reference_view{ "elephant_valley",  0.2850,            0.0110,            1e-2 },
+    reference_view{ "needle",          -1.9990,            0.0,               1e-2 },
+    reference_view{ "deep_1e-10",      -0.743643887037151, 0.131825904205330, 1e-10, 16 },
+    reference_view{ "interior",        -0.1,               0.0,               1e-1 },
+};
+
+struct bench_result {
+    double seconds;
+    std::uint64_t iterations;
+};
+
+auto run_view(task_system & tasks, reference_view const & ref, int size, int max_iter, int reps, formula_kind formula,
+              bool equalized, bool interior) -> bench_result
+{
+    const auto half = ref.width / 2;
+    const auto view = viewport{ ref.center_re - half, ref.center_re + half, ref.center_im - half, ref.center_im + half };
+    // plain single sample render, the adaptive AA would make the amount of work depend on the view's detail
+    auto settings = render_settings{ max_iter, 1, 1, true, true };
+    settings.formula = formula;
+    settings.equalized = equalized;
+    settings.interior_detection = interior;
+    auto frame = render_frame(static_cast<std::size_t>(size), static_cast<std::size_t>(size));
+    // with --equalize the coloring pass is part of the timing, to see what it adds to a plain render
+    auto equalizer = histogram_equalizer();
+    auto render = [ & ] {
+        auto iterations = render_blocking(tasks, frame, view, settings);
+        if ( equalized ) { sync_wait(equalizer.apply(tasks, frame, settings)); }
+        return iterations;
+    };
+    // one run to warm up the caches and the workers, then the best of `reps`
+    auto result = bench_result{ 0., render() };
+    result.seconds = std::numeric_limits<double>::max();
+    for ( auto r{0}; r < reps; ++r ) {
+        auto start = std::chrono::steady_clock::now();
+        render();
+        auto end = std::chrono::steady_clock::now();
+        result.seconds = std::min(result.seconds, std::chrono::duration<double>(end - start).count());
+    }
+    return result;
+}
+
+// reads back a file previously produced by this program, keyed by "view max_iter threads"
+auto load_baseline(std::string const & path) -> std::map<std::string, double>
+{
+    auto baseline = std::map<std::string, double>{};
+    auto file = std::ifstream(path);
+    auto line = std::string{};
+    while ( std::getline(file, line) ) {
+        if ( line.empty() || line.front() == '#' ) { continue; }
+        auto in = std::istringstream(line);
+        auto view = std::string{};
+        auto max_iter = 0;
+        auto threads = 0u;
+        auto seconds = 0.;
+        auto mpix = 0.;
+        auto giter = 0.;
+        if ( in >> view >> max_iter >> threads >> seconds >> mpix >> giter ) {
+            baseline[fmt::format("{} {} {}", view, max_iter, threads)] = giter;
+        }
+    }
+    return baseline;
+}
+
+int main(int argc, char ** argv)
+{
+    auto size = 1000;
+    auto reps = 3;
+    auto max_threads = std::thread::hardware_concurrency();
+    auto iteration_limits = std::vector<int>{ 256, 1024, 4096 };
+    auto baseline_path = std::string{};
+    auto trace_path = std::string{};
+    auto formula = formula_kind::mandelbrot;
+    auto equalized = false;
+    auto interior = false;
+    auto scheduler_stats = false;
+
+    auto args = std::span(argv, static_cast<std::size_t>(argc)).subspan(1);
+    for ( auto a{0u}; a < args.size(); ++a ) {
+        const auto arg = std::string_view{args[a]};
+        const auto has_value = a + 1 < args.size();
+        if ( arg == "--size" && has_value ) { size = std::stoi(args[++a]); }
+        else if ( arg == "--reps" && has_value ) { reps = std::stoi(args[++a]); }
+        else if ( arg == "--threads" && has_value ) { max_threads = static_cast<unsigned>(std::stoi(args[++a])); }
+        else if ( arg == "--baseline" && has_value ) { baseline_path = args[++a]; }
+        else if ( arg == "--trace" && has_value && tracing_enabled ) { trace_path = args[++a]; }
+        else if ( arg == "--formula" && has_value && parse_formula(args[a + 1]) ) { formula = *parse_formula(args[++a]); }
+        else if ( arg == "--equalize" ) { equalized = true; }
+        else if ( arg == "--interior" ) { interior = true; }
+        else if ( arg == "--scheduler-stats" ) { scheduler_stats = true; }
+        else if ( arg == "--quick" ) { size = 400; reps = 1; iteration_limits = { 256, 1024 }; }
+        else {
+            fmt::print(stderr, "usage: {} [--size N] [--reps N] [--threads N] [--baseline file] [--formula name] [--equalize] [--interior] [--quick] [--scheduler-stats]{}\n",
+                       argv[0], tracing_enabled ? " [--trace file]" : "");
+            return 1;
+        }
+    }
+    size = std::max(1, size);
+
+    // 1, 2, 4, ... and the full machine, whatever it is
+    auto thread_counts = std::vector<unsigned>{};
+    for ( auto t{1u}; t < max_threads; t *= 2 ) { thread_counts.push_back(t); }
+    thread_counts.push_back(std::max(1u, max_threads));
+
+    const auto baseline = baseline_path.empty() ? std::map<std::string, double>{} : load_baseline(baseline_path);
+
+    fmt::print("# size={} reps={} max_threads={} formula={}{}{}\n", size, reps, max_threads, formula_name(formula),
+               equalized ? " equalized" : "", interior ? " interior" : "");
+    fmt::print("# view\tmax_iter\tthreads\tseconds\tmpixels_s\tgiterations_s\tspeedup{}\n",
+               baseline.empty() ? "" : "\tvs_baseline");
+    if ( !trace_path.empty() ) { render_trace::start(); }
+    const auto pixels = static_cast<double>(size) * size;
+    // the scaling is measured against the single thread run of the same view, which always comes first
+    auto single_thread = std::map<std::string, double>{};
+    for ( auto threads : thread_counts ) {
+        auto tasks = task_system(threads);
+        for ( auto const & ref : reference_views ) {
+            for ( auto limit : iteration_limits ) {
+                const auto max_iter = limit * ref.iteration_scale;
+                const auto stats_before = scheduler_stats ? tasks.stats() : std::vector<worker_stats>{};
+                const auto start = std::chrono::steady_clock::now();
+                auto result = run_view(tasks, ref, size, max_iter, reps, formula, equalized, interior);
+                if ( scheduler_stats ) {
+                    fmt::print(stderr, "{} {} on {} threads, all the runs:\n", ref.name, max_iter, threads);
+                    print_scheduler_stats(stats_before, tasks.stats(), std::chrono::steady_clock::now() - start,
+                                          stderr);
+                }
+                const auto mpix = pixels / result.seconds * 1e-6;
+                const auto giter = static_cast<double>(result.iterations) / result.seconds * 1e-9;
+                const auto key = fmt::format("{} {}", ref.name, max_iter);
+                if ( threads == thread_counts.front() ) { single_thread[key] = result.seconds; }
+                fmt::print("{}\t{}\t{}\t{:.6f}\t{:.3f}\t{:.4f}\t{:.2f}", ref.name, max_iter, threads, result.seconds,
+                           mpix, giter, single_thread[key] / result.seconds);
+                if ( auto it = baseline.find(fmt::format("{} {}", key, threads)); it != baseline.end() ) {
+                    fmt::print("\t{:+.1f}%", (giter / it->second - 1.) * 100.);
+                }
+                fmt::print("\n");
+                std::fflush(stdout);
+            }
+        }
+    }
+    if ( !trace_path.empty() ) {
+        render_trace::stop();
+        if ( !render_trace::save(trace_path) ) { fmt::print(stderr, "could not write {}\n", trace_path); }
+    }
+    return 0;
+}
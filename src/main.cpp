@@ -6,294 +6,282 @@
 
 #include "fmt/core.h"
 #include "fmt/chrono.h"
-#include "avx_mathfun.hpp"
-#include "avx_pcg.hpp"
+#include "alloc_counter.hpp"
+#include "auto_iterations.hpp"
+#include "autotune.hpp"
+#include "background_render.hpp"
+#include "buddhabrot.hpp"
+#include "cli.hpp"
+#include "disk_cache.hpp"
+#include "distributed.hpp"
+#include "equalize.hpp"
+#include "frame_pipeline.hpp"
+#include "frame_pool.hpp"
+#include "frame_updates.hpp"
+#include "mandel_kernel.hpp"
+#include "prefetch.hpp"
+#include "render_stream.hpp"
+#include "resolve.hpp"
+#include "scheduler_stats.hpp"
 #include "spl/image.hpp"
 #include "task_system.hpp"
+#include "tile_server.hpp"
+#include "zoom_video.hpp"
 
 
-int main()
+int main(int argc, char ** argv)
 {
-    auto test=[]() -> std::string_view {
-        std::string stringa = "hello";
-        return std::string_view{stringa};
-    };
-    auto boh = test();
-    fmt::print("{}\n", boh);
-    constexpr auto image_size = 1000;
+    const auto args = cli_args(argc, argv);
+    if ( args.has("--zoom-video") ) { return zoom_video_main(args); }
+    if ( args.has("--serve") ) { return tile_server_main(args); }
+    if ( args.has("--worker") ) { return band_worker_main(args); }
+    if ( args.has("--coordinate") ) { return coordinator_main(args); }
+    if ( args.has("--buddhabrot") ) { return buddhabrot_main(args); }
+
+    // the thread count and the task size that work best on this host, see autotune.hpp
+    const auto tuning = tuned_setup_from(args);
+    // any size works, the view is stretched to the same aspect ratio so that the pixels stay square
+    const auto image_width = std::max(1, args.get("--width", 1000));
+    const auto image_height = std::max(1, args.get("--height", 1000));
+    const auto aspect = static_cast<double>(image_height) / image_width;
     auto render_factor = 4;
-    auto high_res_render = false;
+    // the high res renders are also filtered down to the size of the window with this, see resolve.hpp
+    auto export_filter = resolve_filter::lanczos;
+    if ( auto name = args.value("--filter") ) {
+        if ( auto f = parse_resolve_filter(*name) ) { export_filter = *f; }
+        else { fmt::print("unknown filter {}, using {}\n", *name, resolve_filter_name(export_filter)); }
+    }
     auto colored_pic = true;
     auto first_color = true;
-    auto aborted = false;
     auto anti_aliasing = 1;
-    auto window = sf::RenderWindow( sf::VideoMode( image_size, image_size ), "AVX512 Mandel" );
+    auto window = sf::RenderWindow( sf::VideoMode( static_cast<unsigned>(image_width), static_cast<unsigned>(image_height) ), "AVX512 Mandel" );
+    // the gui never waits for the renders, so it can just run at the refresh rate of the display
+    window.setVerticalSyncEnabled(true);
 
-    // the sf::Image unfortunately does not allow direct write access to its vector of pixels.
-    // so what I will do is to use this image as the one the gui will display, and instead use a spl::graphics::image
-    // as buffer for rendering, since I can use std::copy to dump whatever the compute threads render
-    // directly into its rbg vector.
-    // then, once the buffer is ready, I will re-create the image directly from the buffer.
-    auto image = sf::Image();
-    // these two down here are used to render the image onto the screen:
-    // the texture will load the image, and the sprite created from the texture will be displayed by the window.
-    auto texture = sf::Texture();
-    auto sprite = sf::Sprite();
+    // the compute threads render into a spl::graphics::image, and the gui thread uploads its lines to a texture as
+    // soon as they are done, straight from that buffer and only the part that changed.
+    // there are two textures: the front one holds the last complete frame, the back one the frame in progress.
+    // the front one is always drawn, moved and scaled to where its view falls in the view the user is looking at
+    // now, so zooming and panning show up right away; the lines of the back one are drawn on top as they arrive,
+    // and once the frame is complete the two swap.
+    auto textures = std::array<sf::Texture, 2>{};
+    for ( auto & t : textures ) { t.create(static_cast<unsigned>(image_width), static_cast<unsigned>(image_height)); }
+    auto front = 0;
+    auto front_view = viewport{};
+    auto front_ready = false;
+    auto back_view = viewport{};
+    auto back_serial = std::uint64_t{0};
+    // the lines of the back texture that hold something of the frame in progress
+    auto back_lines = std::vector<bool>(static_cast<std::size_t>(image_height));
+    // the lines the workers finished and the gui didn't upload yet
+    auto updates = frame_updates();
 
     auto min_re = -2.0;
     auto max_re = 1.0;
-    auto min_im = -1.5;
-    auto max_im = 1.5;
-    auto zoom = 1.0f;
+    auto min_im = -1.5 * aspect;
+    auto max_im = 1.5 * aspect;
     auto max_iter = 256;
+    // when set, every frame gets the limit its view needs instead, see auto_iterations.hpp. the wheel turns it off
+    auto auto_iterations = args.has("--auto-iter");
+    auto formula = formula_kind::mandelbrot;
+    auto julia_re = -0.8;
+    auto julia_im = 0.156;
+    auto distance_estimation = false;
+    auto interior_detection = args.has("--interior");
+    auto equalized = false;
 
-    auto tasks = task_system();
-    // this semaphore will be used by the gui thread to signal the compute thread to render the new frame since
-    // there is no need to compute the render each and every frame unless something changed, like zoom, AA, etc...
-    auto needs_update = std::binary_semaphore{1};
-    auto done_rendering = false;
-    auto line_count = std::atomic<int>{};
+    // the gui posts here what it wants to see, and the compute thread renders the latest of it, see frame_pipeline.hpp
+    auto pipeline = frame_pipeline();
+    auto tasks = task_system(tuning.threads);
+    // with --disk-cache, frames already rendered once, in this run or in a previous one, are read back instead of
+    // rendered again
+    auto disk = make_disk_cache(disk_cache_options_from(args));
+    // and the last ones, plus the ones rendered ahead of time while the workers were idle, are kept in memory
+    auto prefetch = !args.has("--no-prefetch");
+    auto prefetched = frame_cache(static_cast<std::size_t>(std::max(1, args.get("--prefetch-mb", 128))) << 20);
 
-    // this is the lambda that will compute, row by row, the fractal
-    auto mandel_avx512 = [ & ] ( spl::graphics::image & buffer, int line ) -> void {
-        auto temp_buffer = std::vector<spl::graphics::rgba>{};
-        temp_buffer.reserve(buffer.width());
-        thread_local auto rng = pcg32{};
+    // adaptive anti aliasing: only the pixels whose neighbourhood shows some detail get extra samples, up to
+    // `anti_aliasing * adaptive_aa_factor` in total. flat regions, which are most of the picture, never get past
+    // the first pass.
+    auto adaptive_aa = true;
+    auto adaptive_aa_factor = 8;
+    // when set, the next frame is recorded and saved as a chrome trace, see render_trace.hpp
+    auto trace_next_frame = false;
+    auto trace_count = 0;
+    // when set, every frame rendered prints what the workers did meanwhile, see scheduler_stats.hpp.
+    // the gui flips it, the compute thread reads it
+    auto scheduler_stats = std::atomic<bool>{args.has("--scheduler-stats")};
 
-        const auto _two = _mm512_set1_pd(2);
-        const auto _max_iter = _mm512_set1_epi64(max_iter);
-        const auto _brdc = _mm512_setzero_si512();
-        const auto _escape_radius = _mm512_set1_pd(1000);
-        const auto _255 = _mm256_set1_ps(255);
-
-        const auto _r_scale = _mm512_set1_pd((max_re - min_re) / static_cast<double>(buffer.width()));
-        const auto _i_scale = _mm512_set1_pd((max_im - min_im) / static_cast<double>(buffer.width()));
-        // I'm subtracting 0.5 since the double generated is between 0 and 1, and I want +/- half the pixel size
-        auto _x_rng_offset = std::vector<__m512d>{};
-        auto _y_rng_offset = std::vector<__m512d>{};
-        _x_rng_offset.reserve(anti_aliasing);
-        _y_rng_offset.reserve(anti_aliasing);
-        for ( auto aa{0}; aa < anti_aliasing; ++aa ) {
-            _x_rng_offset.push_back(_mm512_set1_pd(rng.next_d()-0.5));
-            _y_rng_offset.push_back(_mm512_set1_pd(rng.next_d()-0.5));
-        }
-        // we move horizontally by 8 since we are computing 8 doubles at a time
-        for ( auto x{0u}; x < buffer.width(); x += 8 ) {
-            auto red = _mm256_set1_ps(0);
-            auto green = _mm256_set1_ps(0);
-            auto blue = _mm256_set1_ps(0);
-            // the way I compute AA on this fractal is by doing something similar to what it's done with ray-tracing:
-            // basically I compute the color of a certain number of complex numbers around the one at the center of the
-            // pixel, and I average it after the for loop.
-            for ( auto aa{0}; aa < anti_aliasing; ++aa ) {
-                auto _i_0 = _mm512_set1_pd( min_im );
-                auto _r_0 = _mm512_set1_pd( min_re );
-                auto _r_offset = _mm512_set_pd(7., 6., 5., 4., 3., 2., 1., 0.);
-                auto _i_offset = _mm512_set1_pd( line );
-                _r_offset += _mm512_set1_pd( x );
-                _r_offset += _x_rng_offset[aa];
-                _i_offset += _y_rng_offset[aa];
-                _r_0 = _mm512_fmadd_pd(_r_scale, _r_offset, _r_0);
-                _i_0 = _mm512_fmadd_pd(_i_scale, _i_offset, _i_0);
-                auto _r_start = _r_0;
-                _r_start = _r_start + _x_rng_offset[aa] * _r_scale;
-                auto _r = _mm512_setzero_pd();
-                auto _i = _mm512_setzero_pd();
-                auto _iter = _mm512_setzero_si512();
-                auto _iter_mask = 0b0;
-                auto _mod_mask = 0b0;
-                auto _check = 0b0;
-                auto _mod = _mm512_setzero_pd();
-                // the idea inside this loop is:
-                // we store all the x and y values of the 8 complex numbers and apply the usual mandelbrot steps.
-                // we store all the iterations and abs of out points.
-                // we compare after one iteration if any point escapes generating a mask set for each point not escaped.
-                // we also check if the current iteration is greater than the max, and we generate a mask set for each
-                // point whose iteration is less than the max.
-                // basically, we are saying "a point is still valid if it's inside both the escape time and radius" so
-                // we bit-wise _and_ the two masks to check if any of the two loop condition are *not* verified.
-                // when a point fails at least one of the two condition, the relative mask bit will be set to 0 and
-                // since the mask is a simple 8-bit unsigned number, if the mask is 0 it means _all_ 8 points failed
-                // at least one of the two condition, and we exit the loop.
-                // if we are still looping, meaning at least 1 point is valid, we update the iteration counter
-                // and the new absolute value only for the valid ones.
-                do {
-                    auto _r2 = (_r * _r);
-                    auto _i2 = (_i * _i);
-                    auto _tr = (_r2 - _i2);
-                    _tr = (_tr + _r_start);
-                    _i = (_two * _i);
-                    _i = _mm512_fmadd_pd( _r, _i, _i_0 );
-                    _r = _tr;
-                    auto _tmp_mod = (_r2 + _i2);
-                    _mod_mask = _mm512_cmp_pd_mask( _tmp_mod, _escape_radius, _CMP_LT_OQ );
-                    _iter_mask = _mm512_cmplt_epi64_mask( _iter, _max_iter );
-                    _check = _iter_mask & _mod_mask;
-                    auto _c = _mm512_mask_set1_epi64( _brdc, _check, 1 );
-                    _iter = _iter + _c;
-                    _mod = _mm512_mask_blend_pd(_mod_mask, _mod, _tmp_mod);
-                } while ( _check > 0 );
+    // the gui frames are reused once nobody looks at them anymore, see frame_pool.hpp
+    auto pool = frame_pool();
+    // only ever used by the renders of the compute thread, one at a time
+    auto equalizer = histogram_equalizer();
+    // the same for what the renders hand their tiles through, see tile_channel_pool
+    auto channels = tile_channel_pool();
+    // the high res renders, which run next to the frames on screen, see background_render.hpp
+    auto exports = background_render();
 
-                // two coloring algorithms found online, feel free to change them!
-                // the first one is picked from the javidx9 YouTube video that inspired the project
-                // and despite beautiful colors it's affected by banding and noise, meaning two adjacent points could
-                // have completely different colors, making the pictures quite ugly near singular points.
-                if ( colored_pic ) {
-                    if ( first_color ) {
-                        auto _n = _mm256_set1_ps(0.1) * _mm512_cvtepi64_ps(_iter);
-                        const auto _half = _mm256_set1_ps(0.5);
-                        auto _red = sin256_ps(_n) * _half;
-                        auto _green = sin256_ps(_n + _mm256_set1_ps(2.094)) * _half;
-                        auto _blue = sin256_ps(_n + _mm256_set1_ps(4.188)) * _half;
-                        _red = (_red + _half);
-                        _green = (_green + _half);
-                        _blue = (_blue + _half);
-                        _red = (_red * _255);
-                        _green = (_green * _255);
-                        _blue = (_blue * _255);
-                        red = (red + _red);
-                        green = (green + _green);
-                        blue = (blue + _blue);
-                    } else {
-                        // if all points reached max iter we can skip all the computation for the colors
-                        // and go straight to the next AA pass
-                        if (_iter_mask == 0b0) {
-                            red += _mm256_set1_ps(64);
-                            green += _mm256_set1_ps(64);
-                            blue += _mm256_set1_ps(64);
-                            continue;
-                        }
-                        __m512i tmp_red;
-                        __m512i tmp_green;
-                        __m512i tmp_blue;
-                        _iter += _mm512_set1_epi64(2);
-                        const auto _log2 = _mm256_set1_ps(std::log(2.f));
-                        auto _log = log256_ps(_mm512_cvtpd_ps(_mod));
-                        _log = log256_ps(_log);
-                        auto _final_iters = _mm512_cvtepi64_ps(_iter) - _log / _log2;
-                        _final_iters = _mm256_max_ps(_final_iters, _mm256_set1_ps(0));
-                        auto periodic_color = [&](int c) {
-                            if (c < 128) return 128 + c;
-                            else if (c < 384) return 383 - c;
-                            return c - 384;
-                        };
-                        for (auto t{0}; t < 8; ++t) {
-                            auto a = std::sqrt(_final_iters[t]) * 8;
-                            tmp_red[t] = periodic_color(static_cast<int>(floor(a * 2)) % 512);
-                            tmp_green[t] = periodic_color(static_cast<int>(floor(a * 3)) % 512);
-                            tmp_blue[t] = periodic_color(static_cast<int>(floor(a * 5)) % 512);
-                        }
-                        tmp_red = _mm512_mask_blend_epi64(_iter_mask, _mm512_set1_epi64(64), tmp_red);
-                        tmp_green = _mm512_mask_blend_epi64(_iter_mask, _mm512_set1_epi64(64), tmp_green);
-                        tmp_blue = _mm512_mask_blend_epi64(_iter_mask, _mm512_set1_epi64(64), tmp_blue);
-                        red += _mm512_cvtepi64_ps(tmp_red);
-                        green += _mm512_cvtepi64_ps(tmp_green);
-                        blue += _mm512_cvtepi64_ps(tmp_blue);
-                    }
-                }
-                // this other algorithm is the classic mandelbrot black and white, it has excellent smooth blending but
-                // with the way I handle iterations (basically << 1 or >> 1) I don't have much control over the shadow
-                // and the overall image it's either too bright or too dark, and thus details are not so visible.
-                // also, I'm using the dumb way to make BW pixels, basically (r,r,r), and the human eye doesn't perceive
-                // each r-g-b color with the same sensitivity, so I should change the way the final rgb pixel is made.
-                else {
-                    _iter += _mm512_set1_epi64(1);
-                    const auto _log2 = _mm256_set1_ps(std::log(2.f));
-                    auto _log = log256_ps(_mm512_cvtpd_ps(_mod));
-                    _log = log256_ps(_log);
-                    auto _final_iters = _mm512_cvtepi64_ps(_iter) - _log / _log2;
-                    auto frac = _final_iters / _mm512_cvtepi64_ps(_max_iter);
-                    auto stability = _mm256_min_ps(frac, _mm256_set1_ps(1.0));
-                    stability = _mm256_max_ps(stability, _mm256_setzero_ps());
-                    red += (_mm256_set1_ps(1) - stability) * _255;
-                    green = red;
-                    blue = red;
+    // renders the first pass of a frame and then its refinement, a task per few lines, as long as keep_going() says so.
+    // the lines go out the most expensive first, from a quick estimate, so that the frame doesn't end with a single
+    // worker still on the lines along the set while the others wait. they come back as tiles, see render_stream.hpp,
+    // and go to the gui as they arrive.
+    // a frame that is not worth finishing anymore ends as soon as the lines the workers are on are done: its remaining
+    // tasks return right away, and the last one hands it back to the pool. false if it was left behind.
+    // past the first frames nothing in here allocates: the frame, the channel and the coroutines come from pools.
+    // the frames rendered ahead of time are background tasks, the one the user waits for never queues behind them
+    auto render_passes = [ & ] ( std::shared_ptr<frame_job> const & job, viewport const & view,
+                                 render_settings const & settings, bool live, bool report, auto keep_going ) -> bool {
+        const auto height = static_cast<int>(job->frame.image.height());
+        const auto opts = tile_stream_options{ live ? task_priority::interactive : task_priority::background,
+                                               tuning.lines_per_task, &equalizer, &channels };
+        auto tiles = render_tiles(tasks, std::shared_ptr<render_frame>(job, &job->frame), view, settings, opts,
+                                  keep_going);
+        auto lines = 0;
+        while ( auto tile = tiles.wait_next() ) {
+            if ( tile->pass_done ) {
+                // the next pass writes on the same lines, so the gui has to be done reading them
+                while ( live && !updates.drained() && keep_going() ) { std::this_thread::yield(); }
+                lines = 0;
+                continue;
+            }
+            if ( tile->pass == render_pass::equalize ) {
+                // every pixel was colored again
+                if ( live ) { updates.frame_done(); }
+                continue;
+            }
+            if ( live ) {
+                for ( auto l{tile->first}; l < tile->first + tile->count; ++l ) {
+                    updates.line_done(static_cast<std::size_t>(l));
                 }
             }
-            auto aa = _mm256_set1_ps(static_cast<float>(anti_aliasing));
-            red = _mm256_div_ps(red, aa);
-            green = _mm256_div_ps(green, aa);
-            blue = _mm256_div_ps(blue, aa);
-            // you can think of every _mmXXX as a simple array of N, so you can just use the [] operator
-            for ( auto t{0}; t < 8; ++t ) {
-                temp_buffer.emplace_back(static_cast<uint8_t>(red[t]),
-                                         static_cast<uint8_t>(green[t]),
-                                         static_cast<uint8_t>(blue[t]));
+            if ( report && (lines + tile->count) / 100 != lines / 100 ) {
+                fmt::print("{} progress: {}\n", tile->pass == render_pass::first ? "first pass" : "refinement",
+                           (lines + tile->count) * 100 / height);
             }
+            lines += tile->count;
         }
-        std::copy(temp_buffer.begin(), temp_buffer.end(), buffer.get_pixel_iterator(0, line));
-        ++line_count;
+        return tiles.complete();
     };
 
-    // I don't like the way this lambda is organized, at all.
-    auto compute = [ & ] ( std::stop_token const & stop ) {
-        while ( !stop.stop_requested() ) {
-            needs_update.acquire();
-            // since we wait for an acquire of the update flag, once we destroy the jthread and request a stop, the
-            // thread will be still waiting on this flag.
-            // so, in order to exit the loop, we first request the stop and then unblock the flag and then
-            // check for the stop in order to exit the program.
-            if ( stop.stop_requested() ) { break; }
-            if ( aborted ) {
-                tasks.clear();
-                aborted = false;
-                fmt::print("aborted\n");
-                continue;
-            }
-            auto render_dim = image_size;
-            if ( high_res_render ) {
-                render_dim *= render_factor;
-                anti_aliasing *= render_factor;
+    // the request with the iteration limit it will be rendered with: the same for the same view, so the frames
+    // rendered ahead of time are found again
+    auto with_iterations = [ & ] ( frame_request request ) {
+        if ( request.auto_iterations ) {
+            request.settings.max_iter = sync_wait(estimate_max_iter(tasks, request.view, request.settings,
+                                                                    request.width, request.height));
+        }
+        return request;
+    };
+
+    // once a frame is on screen the workers would just sit there until the next input, so they render what the user
+    // is likely to ask for next instead, see prefetch.hpp. anything posted in the meantime stops it right away
+    auto speculate = [ & ] ( frame_ticket const & ticket ) {
+        auto keep_going = [ &pipeline, ticket ] { return !pipeline.stale(ticket) && !pipeline.pending(); };
+        for ( auto const & guess : likely_next(ticket.request) ) {
+            if ( !keep_going() ) { return; }
+            // with the automatic limit, twice the iterations is the same frame again, and skipped right away
+            const auto next = with_iterations(guess);
+            const auto key = frame_key_of(next.view, next.width, next.height, next.settings);
+            if ( prefetched.contains(key) ) { continue; }
+            auto job = pool.acquire(next.width, next.height);
+            if ( render_passes(job, next.view, next.settings, false, false, keep_going) ) {
+                prefetched.insert(key, std::shared_ptr<render_frame const>(job, &job->frame), frame_bytes(job->frame));
             }
-            fmt::print("max iters: {}\n", max_iter);
-            fmt::print("depth: {}\n", zoom);
-            fmt::print("size: {}\n", render_dim);
-            fmt::print("AA: {}\n", anti_aliasing);
-            line_count = 0;
-            auto image_buffer = spl::graphics::image(render_dim, render_dim);
-            for (auto line{0u}; line < image_buffer.height(); ++line) {
-                tasks.async(mandel_avx512, std::ref(image_buffer), line);
+        }
+    };
+
+    // the compute thread only ever looks at the requests it takes from the pipeline, never at the gui state
+    auto compute = [ & ] () {
+        while ( auto next = pipeline.take() ) {
+            auto ticket = *next;
+            ticket.request = with_iterations(ticket.request);
+            const auto & request = ticket.request;
+            const auto & view = request.view;
+            const auto & settings = request.settings;
+            fmt::print("formula: {}\n", formula_name(settings.formula));
+            fmt::print("max iters: {}{}\n", settings.max_iter, request.auto_iterations ? " (auto)" : "");
+            fmt::print("depth: {}\n", 3.0 / (view.max_re - view.min_re));
+            fmt::print("size: {}x{}\n", request.width, request.height);
+            fmt::print("AA: {}, adaptive up to {}\n", settings.anti_aliasing, settings.max_samples);
+            const auto cache_key = frame_key_of(view, request.width, request.height, settings);
+            // a traced frame is always rendered, that is the whole point of it
+            if ( auto hit = request.trace ? std::nullopt : prefetched.get(cache_key) ) {
+                updates.begin(*hit, view);
+                updates.frame_done();
+                fmt::print("already in memory\n\n");
+                if ( prefetch ) { speculate(ticket); }
+                continue;
             }
-            auto last_line = 0;
+            if ( request.trace ) { render_trace::start(); }
+            // the frame is shared with the gui thread, which uploads its lines while the others are still rendering
+            auto job = pool.acquire(request.width, request.height);
+            auto shared_frame = std::shared_ptr<render_frame const>(job, &job->frame);
+            auto & frame = job->frame;
+            updates.begin(shared_frame, view);
             auto start_time = std::chrono::steady_clock::now();
-            while ( line_count < render_dim ) {
-                auto current_line = line_count.load(std::memory_order_relaxed);
-                if ( current_line == last_line ) { continue; }
-                auto progress = current_line * 100 / render_dim;
-                if ( current_line % 100 == 0 ) { fmt::print("progress: {}\n", progress); }
-                last_line = current_line;
+            auto superseded = false;
+            // whether the disk cache has it already
+            auto stored = true;
+            if ( disk && !request.trace && disk->load(cache_key, frame) ) {
+                fmt::print("loaded from the disk cache\n");
+                updates.frame_done();
+            } else {
+                const auto allocated = allocations();
+                const auto show_stats = scheduler_stats.load(std::memory_order_relaxed);
+                const auto stats_before = show_stats ? tasks.stats() : std::vector<worker_stats>{};
+                superseded = !render_passes(job, view, settings, true, true,
+                                            [ &pipeline, ticket ] { return !pipeline.stale(ticket); });
+                if constexpr ( allocation_counting_enabled ) {
+                    fmt::print("allocations while rendering: {}\n", allocations() - allocated);
+                }
+                if ( show_stats ) {
+                    print_scheduler_stats(stats_before, tasks.stats(), std::chrono::steady_clock::now() - start_time);
+                }
+                stored = !disk;
             }
             auto end_time = std::chrono::steady_clock::now();
-            if ( high_res_render ) {
-                high_res_render = false;
-                anti_aliasing /= render_factor;
-                fmt::print("high res render done in {}\n",
-                           std::chrono::duration_cast<std::chrono::microseconds>(end_time-start_time));
-                auto r_c = (max_re - min_re) / 2;
-                auto i_c = (max_im - min_im) / 2;
-                auto filename = fmt::format("{}_{}_{}_{}.png",
-                                            r_c, i_c, max_iter, colored_pic ? "color" : "bw");
-                image_buffer.save_to_file(filename);
-                fmt::print("image saved with name {}\n\n", filename);
+            if ( request.trace ) {
+                render_trace::stop();
+                auto filename = fmt::format("trace_{}.json", trace_count++);
+                if ( render_trace::save(filename) ) { fmt::print("trace saved with name {}\n", filename); }
+            }
+            if ( superseded ) {
+                fmt::print("dropped\n\n");
             } else {
-                const auto *first_pxl = &(image_buffer.raw_data()->r);
-                image.create(image_size, image_size, first_pxl);
-                texture.loadFromImage(image);
-                sprite.setTexture(texture);
+                updates.complete();
                 fmt::print("render done in {}\n\n",
                            std::chrono::duration_cast<std::chrono::microseconds>(end_time-start_time));
+                // the frames shown go in too, so going back to one is just as quick
+                prefetched.insert(cache_key, shared_frame, frame_bytes(frame));
+                // once it's on screen, and a superseded frame is only partially rendered anyway
+                if ( !stored ) { store_later(tasks, disk, cache_key, shared_frame); }
+                if ( prefetch ) { speculate(ticket); }
             }
-            done_rendering = true;
         }
     };
 
-    auto signal_update = [&](){
-            needs_update.release();
-            done_rendering = false;
+    // the current gui state
+    auto current_request = [ & ] () {
+        auto request = frame_request{ viewport{ min_re, max_re, min_im, max_im },
+                                      render_settings{ max_iter, anti_aliasing, anti_aliasing, colored_pic,
+                                                       first_color, formula, julia_re, julia_im,
+                                                       distance_estimation, interior_detection, equalized },
+                                      static_cast<std::size_t>(image_width), static_cast<std::size_t>(image_height),
+                                      trace_next_frame, auto_iterations };
+        // the equalized colors come from the escape counts of the first pass alone, a refinement would be thrown away
+        if ( adaptive_aa && !equalized ) { request.settings.max_samples *= adaptive_aa_factor; }
+        return request;
+    };
+
+    // folds the current gui state into a request, which replaces the frame in progress
+    auto signal_update = [ & ] () {
+        pipeline.post(current_request());
+        trace_next_frame = false;
     };
 
-    // the main thing to do inside this lambda is setting the update flag for the compute thread when an event
-    // that changes the frame occurs.
+    // the main thing to do inside this lambda is posting a new request to the compute thread when an event that
+    // changes the frame occurs. the input is never ignored: whatever happens while a frame is rendering just
+    // replaces it
     auto handle_gui = [ & ] () {
         auto event = sf::Event{};
         while ( window.pollEvent(event) ) {
@@ -301,97 +289,194 @@ int main()
                 window.close();
                 break;
             }
-            if ( done_rendering ) {
-                switch (event.type) {
-                    case sf::Event::KeyPressed: {
-                        if (event.key.code == sf::Keyboard::Escape) {
-                            window.close();
-                        } else if (event.key.code == sf::Keyboard::P) {
-                            anti_aliasing *= 2;
-                            signal_update();
-                        } else if (event.key.code == sf::Keyboard::O) {
-                            anti_aliasing = anti_aliasing > 1 ? anti_aliasing / 2 : 1;
-                            signal_update();
-                        } else if (event.key.code == sf::Keyboard::C) {
-                            colored_pic = !colored_pic;
+            switch (event.type) {
+                case sf::Event::KeyPressed: {
+                    if (event.key.code == sf::Keyboard::Escape) {
+                        window.close();
+                    } else if (event.key.code == sf::Keyboard::P) {
+                        anti_aliasing *= 2;
+                        signal_update();
+                    } else if (event.key.code == sf::Keyboard::O) {
+                        anti_aliasing = anti_aliasing > 1 ? anti_aliasing / 2 : 1;
+                        signal_update();
+                    } else if (event.key.code == sf::Keyboard::A) {
+                        adaptive_aa = !adaptive_aa;
+                        fmt::print("adaptive AA {}\n", adaptive_aa ? "on" : "off");
+                        signal_update();
+                    } else if (event.key.code == sf::Keyboard::T) {
+                        if constexpr ( tracing_enabled ) {
+                            trace_next_frame = true;
                             signal_update();
-                        } else if (event.key.code == sf::Keyboard::X) {
-                                first_color = !first_color;
-                                signal_update();
-                        } else if (event.key.code == sf::Keyboard::B) {
-                            line_count = image_size * render_factor;
-                            aborted = true;
-                            fmt::print("aborting computation\n");
+                        } else {
+                            fmt::print("tracing is not compiled in, configure with -DENABLE_TRACING=ON\n");
+                        }
+                    } else if (event.key.code == sf::Keyboard::G) {
+                        scheduler_stats = !scheduler_stats;
+                        fmt::print("scheduler stats {}\n", scheduler_stats ? "on" : "off");
+                    } else if (event.key.code == sf::Keyboard::M) {
+                        auto_iterations = !auto_iterations;
+                        fmt::print("automatic iterations {}\n", auto_iterations ? "on" : "off");
+                        signal_update();
+                    } else if (event.key.code == sf::Keyboard::F) {
+                        formula = next_formula(formula);
+                        signal_update();
+                    } else if (event.key.code == sf::Keyboard::D) {
+                        distance_estimation = !distance_estimation;
+                        fmt::print("distance estimation {}\n", distance_estimation ? "on" : "off");
+                        signal_update();
+                    } else if (event.key.code == sf::Keyboard::I) {
+                        interior_detection = !interior_detection;
+                        fmt::print("interior detection {}\n", interior_detection ? "on" : "off");
+                        signal_update();
+                    } else if (event.key.code == sf::Keyboard::H) {
+                        equalized = !equalized;
+                        fmt::print("histogram equalization {}\n", equalized ? "on" : "off");
+                        signal_update();
+                    } else if (event.key.code == sf::Keyboard::J) {
+                        // the julia set of the point at the center of the current view
+                        julia_re = (min_re + max_re) / 2;
+                        julia_im = (min_im + max_im) / 2;
+                        formula = formula_kind::julia;
+                        min_re = -2.0, max_re = 2.0, min_im = -2.0 * aspect, max_im = 2.0 * aspect;
+                        fmt::print("julia set of {} {:+}i\n", julia_re, julia_im);
+                        signal_update();
+                    } else if (event.key.code == sf::Keyboard::C) {
+                        colored_pic = !colored_pic;
+                        signal_update();
+                    } else if (event.key.code == sf::Keyboard::X) {
+                            first_color = !first_color;
                             signal_update();
-                        } else if (event.key.code == sf::Keyboard::R) {
+                    } else if (event.key.code == sf::Keyboard::B && event.key.shift) {
+                        exports.cancel();
+                        fmt::print("aborting high res render\n");
+                    } else if (event.key.code == sf::Keyboard::B) {
+                        pipeline.cancel();
+                        fmt::print("aborting computation\n");
+                    } else if (event.key.code == sf::Keyboard::R) {
+                        // the limit picked for the window is as good for the big one, the probe doesn't care
+                        auto request = with_iterations(current_request());
+                        request.auto_iterations = false;
+                        request.width *= static_cast<std::size_t>(render_factor);
+                        request.height *= static_cast<std::size_t>(render_factor);
+                        request.settings.max_samples *= render_factor;
+                        // it's written once and read back only to be saved, no point in going through the caches
+                        request.settings.streaming_stores = true;
+                        request.trace = false;
+                        const auto resolved = resolve_options{ static_cast<std::size_t>(image_width),
+                                                               static_cast<std::size_t>(image_height), export_filter };
+                        if ( exports.start(tasks, request, resolved) ) {
                             fmt::print("starting high res render\n");
-                            high_res_render = true;
-                            signal_update();
-                        } else if (event.key.code == sf::Keyboard::S) {
+                        } else {
+                            fmt::print("a high res render is already running, shift+b aborts it\n");
+                        }
+                    } else if (event.key.code == sf::Keyboard::S) {
+                        if ( front_ready ) {
                             auto r_c = (max_re - min_re) / 2;
                             auto i_c = (max_im - min_im) / 2;
-                            image.saveToFile(fmt::format("{}_{}_{}_{}.png",
+                            textures[front].copyToImage().saveToFile(fmt::format("{}_{}_{}_{}.png",
                                                          r_c, i_c, max_iter, colored_pic ? "color" : "bw"));
                             fmt::print("image saved\n\n");
                         } else {
-                            double w = (max_re - min_re) * 0.1;
-                            double h = (max_im - min_im) * 0.1;
+                            fmt::print("nothing to save yet, the first frame is still rendering\n\n");
+                        }
+                    } else {
+                        double w = (max_re - min_re) * 0.1;
+                        double h = (max_im - min_im) * 0.1;
 
-                            if (event.key.code == sf::Keyboard::Left) {
-                                min_re -= w, max_re -= w;
-                            }
-                            if (event.key.code == sf::Keyboard::Right) {
-                                min_re += w, max_re += w;
-                            }
-                            if (event.key.code == sf::Keyboard::Up) {
-                                min_im -= h, max_im -= h;
-                            }
-                            if (event.key.code == sf::Keyboard::Down) {
-                                min_im += h, max_im += h;
-                            }
-                            signal_update();
+                        if (event.key.code == sf::Keyboard::Left) {
+                            min_re -= w, max_re -= w;
                         }
-                        break;
-                    }
-                    case sf::Event::MouseButtonPressed: {
-                        auto zoomX = [&](double z) {
-                            double x = min_re + (max_re - min_re) * event.mouseButton.x / image_size;
-                            double y = min_im + (max_im - min_im) * event.mouseButton.y / image_size;
-                            double tmp_x = x - (max_re - min_re) / 2 / z;
-                            max_re = x + (max_re - min_re) / 2 / z;
-                            min_re = tmp_x;
-                            double tmp_y = y - (max_im - min_im) / 2 / z;
-                            max_im = y + (max_im - min_im) / 2 / z;
-                            min_im = tmp_y;
-                        };
-                        if (event.mouseButton.button == sf::Mouse::Left) {
-                            zoomX(2.);
-                            zoom *= 2.;
+                        if (event.key.code == sf::Keyboard::Right) {
+                            min_re += w, max_re += w;
                         }
-                        if (event.mouseButton.button == sf::Mouse::Right) {
-                            zoomX(0.5);
-                            zoom /= 2.;
-                            if (zoom < 0.5) { zoom = 0.5; }
+                        if (event.key.code == sf::Keyboard::Up) {
+                            min_im -= h, max_im -= h;
+                        }
+                        if (event.key.code == sf::Keyboard::Down) {
+                            min_im += h, max_im += h;
                         }
                         signal_update();
-                        break;
                     }
-                    case sf::Event::MouseWheelScrolled: {
-                        if (event.mouseWheelScroll.wheel == sf::Mouse::VerticalWheel) {
-                            if (event.mouseWheelScroll.delta > 0) { max_iter *= 2; }
-                            else { max_iter /= 2; }
-                            if (max_iter < 1) { max_iter = 1; }
+                    break;
+                }
+                case sf::Event::MouseButtonPressed: {
+                    auto zoomX = [&](double z) {
+                        double x = min_re + (max_re - min_re) * event.mouseButton.x / image_width;
+                        double y = min_im + (max_im - min_im) * event.mouseButton.y / image_height;
+                        double tmp_x = x - (max_re - min_re) / 2 / z;
+                        max_re = x + (max_re - min_re) / 2 / z;
+                        min_re = tmp_x;
+                        double tmp_y = y - (max_im - min_im) / 2 / z;
+                        max_im = y + (max_im - min_im) / 2 / z;
+                        min_im = tmp_y;
+                    };
+                    if (event.mouseButton.button == sf::Mouse::Left) {
+                        zoomX(2.);
+                    }
+                    if (event.mouseButton.button == sf::Mouse::Right) {
+                        zoomX(0.5);
+                    }
+                    signal_update();
+                    break;
+                }
+                case sf::Event::MouseWheelScrolled: {
+                    if (event.mouseWheelScroll.wheel == sf::Mouse::VerticalWheel) {
+                        if ( auto_iterations ) {
+                            auto_iterations = false;
+                            fmt::print("automatic iterations off\n");
                         }
-                        signal_update();
-                        break;
+                        if (event.mouseWheelScroll.delta > 0) { max_iter *= 2; }
+                        else { max_iter /= 2; }
+                        if (max_iter < 1) { max_iter = 1; }
                     }
-                    default:
-                        break;
+                    signal_update();
+                    break;
                 }
+                default:
+                    break;
             }
         }
     };
 
+    // uploads what the workers finished, and swaps the textures once the frame in progress is complete
+    auto upload = [ & ] () {
+        auto & back = textures[1 - front];
+        auto fresh = std::vector<std::pair<std::size_t, std::size_t>>{};
+        const auto status = updates.drain([ & ] ( std::size_t line, std::size_t count, std::uint8_t const * pixels ) {
+            back.update(pixels, static_cast<unsigned>(image_width), static_cast<unsigned>(count), 0, static_cast<unsigned>(line));
+            fresh.emplace_back(line, count);
+        });
+        if ( status.serial != back_serial ) {
+            // the lines of a superseded frame are not worth showing anymore
+            back_serial = status.serial;
+            back_view = status.view;
+            std::fill(back_lines.begin(), back_lines.end(), false);
+        }
+        for ( auto [line, count] : fresh ) {
+            std::fill_n(back_lines.begin() + static_cast<std::ptrdiff_t>(line), count, true);
+        }
+        if ( status.complete && std::ranges::all_of(back_lines, std::identity{}) ) {
+            front = 1 - front;
+            front_view = back_view;
+            front_ready = true;
+            std::fill(back_lines.begin(), back_lines.end(), false);
+        }
+    };
+
+    // draws `lines` lines of a texture starting at `first`, where the view it was rendered for falls in the current one
+    auto draw_lines = [ & ] ( sf::Texture const & texture, viewport const & shown, int first, int lines ) {
+        const auto width = max_re - min_re;
+        const auto height = max_im - min_im;
+        const auto scale_x = (shown.max_re - shown.min_re) / width;
+        const auto scale_y = (shown.max_im - shown.min_im) / height;
+        auto sprite = sf::Sprite(texture, sf::IntRect(0, first, image_width, lines));
+        sprite.setScale(static_cast<float>(scale_x), static_cast<float>(scale_y));
+        sprite.setPosition(static_cast<float>((shown.min_re - min_re) / width * image_width),
+                           static_cast<float>(((shown.min_im - min_im) / height * image_height) + first * scale_y));
+        window.draw(sprite);
+    };
+
+    signal_update();
     auto com = std::jthread{compute};
     fmt::print("Simple mandelbrot plotter, using AVX512 intrinsics.\n"
                "Below are the available controls:\n"
@@ -400,25 +485,48 @@ int main()
                "- right mouse click : zoom out\n"
                "- mouse wheel up : increase iterations\n"
                "- mouse wheel down : decrease iterations\n"
+               "- m : toggle the iteration limit picked for every view from a quick low resolution probe\n"
                "- s : save the current image\n"
-               "- r : render a {0}x image with {0}x AA and save it\n"
+               "- r : render a {0}x image with up to {0}x more adaptive AA samples and save it, in the background,\n"
+               "      together with a copy filtered down to the size of the window (--filter box|tent|lanczos)\n"
                "- o : decrease the anti aliasing level\n"
                "- p : increase the anti aliasing level\n"
+               "- a : toggle adaptive anti aliasing (up to {1}x more samples where there is detail)\n"
                "- c : switch between black and white and colored\n"
                "- x : switch between coloring algorithm\n"
+               "- h : toggle the histogram equalized colors, which follow the frame without any tuning\n"
+               "- f : cycle through the formulas (mandelbrot, julia, multibrot 3-5, burning ship, tricorn)\n"
+               "- j : show the julia set of the point at the center of the view\n"
+               "- d : toggle the distance estimation shading, to see the filaments\n"
+               "- i : toggle the early exit of the points inside the set\n"
                "- b : to abort the current computation\n"
-               "\n", render_factor);
+               "- shift+b : to abort the high res render\n"
+               "- t : render the frame again and save a chrome trace of it (needs -DENABLE_TRACING=ON)\n"
+               "- g : toggle the per frame scheduler stats: tasks, steals, contention, busy and blocked time\n"
+               "\n", render_factor, adaptive_aa_factor);
 
     while ( window.isOpen() ) {
         handle_gui();
+        upload();
         window.clear();
-        window.draw(sprite);
+        if ( front_ready ) { draw_lines(textures[front], front_view, 0, image_height); }
+        // the lines of the frame in progress, in runs of consecutive ones
+        for ( auto first{0}; first < image_height; ) {
+            if ( !back_lines[first] ) { ++first; continue; }
+            auto last = first;
+            while ( last < image_height && back_lines[last] ) { ++last; }
+            draw_lines(textures[1 - front], back_view, first, last - first);
+            first = last;
+        }
         window.display();
     }
-    line_count = image_size * render_factor;
-    com.request_stop();
-    needs_update.release(); // <--- if I don't release this the compute thread will hold onto the acquire and never exit
-                            // ask me how I know
+    // the compute thread may be waiting for a request, or rendering one that nobody will ever see. the tasks of that
+    // one still have to run, if only to return right away, before the queues are cleared
+    pipeline.cancel();
+    pipeline.close();
+    com.join();
+    exports.stop();
+    tasks.clear();
     fmt::print("bye!\n");
     return 0;
 }
@@ -0,0 +1,79 @@
+#include <array>
+#include <cstdint>
+
+#include "avx_pcg.hpp"
+#include "check.hpp"
+
+
+// every lane of the vector generator has to give the numbers of the scalar one with the same state and stream
+auto test_lanes_match_scalar() -> void
+{
+    alignas(64) auto states = std::array<std::uint64_t, 8>{};
+    alignas(64) auto streams = std::array<std::uint64_t, 8>{};
+    auto scalar = std::array<pcg32, 8>{};
+    for ( auto t{0u}; t < 8; ++t ) {
+        states[t] = 1234 + t * 99;
+        streams[t] = t + 1;
+        scalar[t] = pcg32{ states[t], streams[t] };
+    }
+    auto vector = avx_pcg32{ _mm512_load_si512(states.data()), _mm512_load_si512(streams.data()) };
+    auto same_u = true;
+    auto same_f = true;
+    auto same_d = true;
+    for ( auto n{0}; n < 1000; ++n ) {
+        alignas(32) auto u = std::array<std::uint32_t, 8>{};
+        _mm256_store_si256(reinterpret_cast<__m256i *>(u.data()), vector.next32());
+        alignas(32) auto f = std::array<float, 8>{};
+        _mm256_store_ps(f.data(), vector.next_f());
+        alignas(64) auto d = std::array<double, 8>{};
+        _mm512_store_pd(d.data(), vector.next_d());
+        for ( auto t{0u}; t < 8; ++t ) {
+            same_u &= u[t] == scalar[t].next();
+            same_f &= f[t] == scalar[t].next_f();
+            same_d &= d[t] == scalar[t].next_d();
+        }
+    }
+    CHECK(same_u);
+    CHECK(same_f);
+    CHECK(same_d);
+}
+
+// advance(n) lands where n calls to next() do, and jump() is advance(2^32)
+auto test_advance_and_jump() -> void
+{
+    for ( auto delta : { 0ul, 1ul, 2ul, 3ul, 1000ul, 65537ul } ) {
+        auto stepped = pcg32{ 42, 7 };
+        auto advanced = pcg32{ 42, 7 };
+        for ( auto n{0ul}; n < delta; ++n ) { stepped.next(); }
+        advanced.advance(delta);
+        auto same = true;
+        for ( auto n{0}; n < 16; ++n ) { same &= stepped.next() == advanced.next(); }
+        CHECK(same);
+    }
+
+    // 2^32 steps are too many to take one by one, but two advances of 2^31 are another way to get there
+    auto jumped = pcg32{ 5, 3 };
+    auto halves = pcg32{ 5, 3 };
+    jumped.jump();
+    halves.advance(std::uint64_t{1} << 31);
+    halves.advance(std::uint64_t{1} << 31);
+    auto same = true;
+    for ( auto n{0}; n < 16; ++n ) { same &= jumped.next() == halves.next(); }
+    CHECK(same);
+
+    // a full period of the lcg, 2^64 steps, comes back to the start: advance(2^63) twice
+    auto start = pcg32{ 9, 11 };
+    auto around = pcg32{ 9, 11 };
+    around.advance(std::uint64_t{1} << 63);
+    around.advance(std::uint64_t{1} << 63);
+    same = true;
+    for ( auto n{0}; n < 16; ++n ) { same &= start.next() == around.next(); }
+    CHECK(same);
+}
+
+auto main() -> int
+{
+    test_lanes_match_scalar();
+    test_advance_and_jump();
+    return test_result();
+}
@@ -0,0 +1,29 @@
+#ifndef TESTS_CHECK_HPP
+#define TESTS_CHECK_HPP
+
+#include <cstdio>
+#include <cstdlib>
+
+
+// the tests are plain executables run by ctest: a check that fails says what and where, and the test exits with 1
+// once it's done, so that one run shows every check that fails and not just the first one.
+// unlike assert it doesn't go away with NDEBUG, the tests are built with the flags of the release build.
+
+inline auto failed_checks = 0;
+
+inline auto check(bool ok, char const * what, char const * file, int line) noexcept -> void
+{
+    if ( !ok ) {
+        std::fprintf(stderr, "%s:%d: check failed: %s\n", file, line, what);
+        ++failed_checks;
+    }
+}
+
+#define CHECK(...) check((__VA_ARGS__), #__VA_ARGS__, __FILE__, __LINE__)
+
+inline auto test_result() noexcept -> int
+{
+    return failed_checks == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+#endif
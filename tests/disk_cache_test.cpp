@@ -0,0 +1,100 @@
+#include <cstring>
+#include <filesystem>
+#include <iterator>
+#include <string>
+
+#include <unistd.h>
+
+#include "check.hpp"
+#include "disk_cache.hpp"
+
+
+// a directory of its own, so that runs in parallel don't see each other's files
+auto test_dir() -> std::filesystem::path
+{
+    return std::filesystem::temp_directory_path() / ("mandelbrot_avx_disk_cache_test." + std::to_string(::getpid()));
+}
+
+auto frame_files(std::filesystem::path const & dir) -> std::ptrdiff_t
+{
+    return std::distance(std::filesystem::directory_iterator(dir), std::filesystem::directory_iterator{});
+}
+
+auto same_frame(render_frame const & a, render_frame const & b) -> bool
+{
+    const auto pixels = a.image.width() * a.image.height();
+    return a.image.width() == b.image.width() && a.image.height() == b.image.height()
+           && std::memcmp(a.image.raw_data(), b.image.raw_data(), pixels * sizeof(spl::graphics::rgba)) == 0
+           && a.escape == b.escape && a.luma == b.luma;
+}
+
+// what is stored comes back the same, under its key only
+auto test_round_trip(task_system & tasks, std::filesystem::path const & dir) -> void
+{
+    auto settings = render_settings{};
+    settings.max_iter = 200;
+    const auto view = viewport{ -2, 1, -1.5, 1.5 };
+    auto rendered = render_frame(64, 48);
+    render_blocking(tasks, rendered, view, settings);
+
+    auto cache = disk_cache(dir, std::uintmax_t{1} << 30);
+    const auto key = frame_key_of(view, 64, 48, settings);
+    cache.store(key, rendered);
+    auto loaded = render_frame(64, 48);
+    CHECK(cache.load(key, loaded));
+    CHECK(same_frame(rendered, loaded));
+
+    auto other = settings;
+    other.max_iter = 201;
+    CHECK(!cache.load(frame_key_of(view, 64, 48, other), loaded));
+    // the key says 64x48, a frame of another size can't be filled from it
+    auto smaller = render_frame(32, 48);
+    CHECK(!cache.load(key, smaller));
+}
+
+// over the budget the least recently used frames go first, a load counts as a use, and a cache opened again on the
+// same directory picks up the files and the budget from there
+auto test_eviction(std::filesystem::path const & dir) -> void
+{
+    std::filesystem::remove_all(dir);
+    const auto view = viewport{ -2, 1, -1.5, 1.5 };
+    auto key_of = [ & ] ( int n ) {
+        auto settings = render_settings{};
+        settings.max_iter = 100 + n;
+        return frame_key_of(view, 16, 16, settings);
+    };
+    const auto file_size = sizeof(frame_key) + 16 * 16 * (sizeof(spl::graphics::rgba) + sizeof(float) + 1);
+    {
+        auto cache = disk_cache(dir, file_size * 3);
+        for ( auto n{0}; n < 3; ++n ) {
+            auto frame = render_frame(16, 16);
+            frame.escape[0] = static_cast<float>(n);
+            cache.store(key_of(n), frame);
+        }
+        CHECK(cache.total() == file_size * 3);
+        auto frame = render_frame(16, 16);
+        CHECK(cache.load(key_of(0), frame) && frame.escape[0] == 0.f);
+        // one too many: 1 is now the oldest
+        cache.store(key_of(3), render_frame(16, 16));
+        CHECK(cache.total() == file_size * 3);
+        CHECK(!cache.load(key_of(1), frame));
+        CHECK(cache.load(key_of(0), frame) && frame.escape[0] == 0.f);
+        CHECK(cache.load(key_of(2), frame) && frame.escape[0] == 2.f);
+        CHECK(cache.load(key_of(3), frame));
+        CHECK(frame_files(dir) == 3);
+    }
+    auto cache = disk_cache(dir, file_size * 2);
+    CHECK(cache.total() == file_size * 2);
+    CHECK(frame_files(dir) == 2);
+}
+
+auto main() -> int
+{
+    const auto dir = test_dir();
+    std::filesystem::remove_all(dir);
+    auto tasks = task_system(2);
+    test_round_trip(tasks, dir);
+    test_eviction(dir);
+    std::filesystem::remove_all(dir);
+    return test_result();
+}
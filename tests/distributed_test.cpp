@@ -0,0 +1,121 @@
+#include <array>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#include "check.hpp"
+#include "distributed.hpp"
+
+
+// the settings go to the workers as a band_request: everything the kernel looks at has to come back out of it
+auto test_request_round_trip() -> void
+{
+    auto settings = render_settings{};
+    settings.max_iter = 777;
+    settings.anti_aliasing = 3;
+    settings.max_samples = 12;
+    settings.colored_pic = false;
+    settings.first_color = false;
+    settings.formula = formula_kind::julia;
+    settings.julia_re = -0.8;
+    settings.julia_im = 0.156;
+    settings.distance_estimation = true;
+    settings.interior_detection = true;
+    const auto view = viewport{ -0.75, -0.73, 0.1, 0.12 };
+
+    // through the bytes, like on the wire
+    const auto sent = make_band_request(view, 640, 480, settings);
+    auto bytes = std::array<char, sizeof(band_request)>{};
+    std::memcpy(bytes.data(), &sent, sizeof(sent));
+    auto req = band_request{};
+    std::memcpy(&req, bytes.data(), sizeof(req));
+
+    CHECK(req.width == 640 && req.height == 480);
+    CHECK(req.min_re == view.min_re && req.max_re == view.max_re);
+    CHECK(req.min_im == view.min_im && req.max_im == view.max_im);
+    const auto back = settings_of(req);
+    CHECK(back.max_iter == settings.max_iter);
+    CHECK(back.anti_aliasing == settings.anti_aliasing);
+    CHECK(back.max_samples == settings.max_samples);
+    CHECK(back.colored_pic == settings.colored_pic);
+    CHECK(back.first_color == settings.first_color);
+    CHECK(back.formula == settings.formula);
+    CHECK(back.julia_re == settings.julia_re && back.julia_im == settings.julia_im);
+    CHECK(back.distance_estimation == settings.distance_estimation);
+    CHECK(back.interior_detection == settings.interior_detection);
+}
+
+auto test_valid_band() -> void
+{
+    auto req = make_band_request(viewport{ -2, 1, -1.5, 1.5 }, 100, 50, render_settings{});
+    req.first_line = 40;
+    req.lines = 10;
+    CHECK(valid_band(req));
+    auto past_the_end = req;
+    past_the_end.lines = 11;
+    CHECK(!valid_band(past_the_end));
+    auto empty = req;
+    empty.lines = 0;
+    CHECK(!valid_band(empty));
+    auto other_version = req;
+    other_version.version = band_protocol_version + 1;
+    CHECK(!valid_band(other_version));
+    auto garbage = req;
+    garbage.magic = 0;
+    CHECK(!valid_band(garbage));
+}
+
+// a worker on one end of a socket pair, answering bands that together make a frame: the frame has to be the one
+// rendered in one go, the adaptive AA at the borders of the bands included
+auto test_bands_over_a_socket() -> void
+{
+    auto settings = render_settings{};
+    settings.max_iter = 500;
+    settings.anti_aliasing = 3;
+    settings.max_samples = 12;
+    const auto view = viewport{ -0.75, -0.73, 0.1, 0.12 };
+    constexpr auto width = 203u;
+    constexpr auto height = 150u;
+    auto tasks = task_system(4);
+    auto whole = render_frame(width, height);
+    render_blocking(tasks, whole, view, settings);
+
+    int fds[2];
+    CHECK(::socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+    auto worker = std::thread([ & ] { serve_bands(tasks, fds[1], 1); });
+    auto pixels = std::vector<spl::graphics::rgba>(width * 13);
+    auto same = true;
+    for ( auto first{0u}; first < height; first += 13 ) {
+        auto req = make_band_request(view, width, height, settings);
+        req.id = first;
+        req.first_line = first;
+        req.lines = std::min(13u, height - first);
+        CHECK(send_all(fds[0], &req, sizeof(req)));
+        auto reply = band_reply{};
+        CHECK(recv_all(fds[0], &reply, sizeof(reply)));
+        CHECK(reply.magic == band_magic && reply.id == req.id && reply.status == 0);
+        CHECK(recv_all(fds[0], pixels.data(), width * req.lines * sizeof(spl::graphics::rgba)));
+        same &= std::memcmp(pixels.data(), &*whole.image.get_pixel_iterator(0, first),
+                            width * req.lines * sizeof(spl::graphics::rgba)) == 0;
+    }
+    CHECK(same);
+
+    // a band that doesn't fit is refused, and the worker hangs up
+    auto bad = make_band_request(view, width, height, settings);
+    bad.first_line = height;
+    bad.lines = 1;
+    CHECK(send_all(fds[0], &bad, sizeof(bad)));
+    auto reply = band_reply{};
+    CHECK(recv_all(fds[0], &reply, sizeof(reply)));
+    CHECK(reply.status != 0);
+    worker.join();
+    ::close(fds[0]);
+}
+
+auto main() -> int
+{
+    test_request_round_trip();
+    test_valid_band();
+    test_bands_over_a_socket();
+    return test_result();
+}
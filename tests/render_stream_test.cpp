@@ -0,0 +1,114 @@
+// the whole test binary counts its allocations, see alloc_counter.hpp
+#define MANDEL_COUNT_ALLOCATIONS
+
+#include <cinttypes>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#include "alloc_counter.hpp"
+#include "check.hpp"
+#include "frame_pool.hpp"
+#include "render_stream.hpp"
+
+
+auto test_settings() -> render_settings
+{
+    auto settings = render_settings{};
+    settings.max_iter = 500;
+    settings.anti_aliasing = 1;
+    settings.max_samples = 4;
+    return settings;
+}
+
+// the tiles of every pass cover each line once, and the frame comes out the same as rendered in one go
+auto test_tiles_cover_the_frame(task_system & tasks) -> void
+{
+    const auto settings = test_settings();
+    const auto view = viewport{ -0.75, -0.73, 0.1, 0.12 };
+    auto whole = render_frame(203, 150);
+    render_blocking(tasks, whole, view, settings, 4);
+
+    auto frame = std::make_shared<render_frame>(203, 150);
+    auto tiles = render_tiles(tasks, frame, view, settings, tile_stream_options{ task_priority::interactive, 4 });
+    auto seen = std::vector<int>(150);
+    auto passes = 0;
+    auto covered = true;
+    while ( auto tile = tiles.wait_next() ) {
+        if ( tile->pass_done ) {
+            for ( auto & s : seen ) {
+                covered &= s == 1;
+                s = 0;
+            }
+            ++passes;
+            continue;
+        }
+        for ( auto l{tile->first}; l < tile->first + tile->count; ++l ) { ++seen[static_cast<std::size_t>(l)]; }
+    }
+    CHECK(tiles.complete());
+    CHECK(passes == 2);
+    CHECK(covered);
+    CHECK(std::memcmp(frame->image.raw_data(), whole.image.raw_data(),
+                      203 * 150 * sizeof(spl::graphics::rgba)) == 0);
+}
+
+// with the frames, the channels and the equalizer kept between them, like the gui does, only the first frames
+// allocate
+auto test_no_allocations_once_warm(task_system & tasks) -> void
+{
+    auto pool = frame_pool();
+    auto equalizer = histogram_equalizer();
+    auto channels = tile_channel_pool();
+    auto settings = test_settings();
+    auto render = [ & ] ( int n ) {
+        auto job = pool.acquire(256, 256);
+        const auto before = allocations();
+        const auto view = viewport{ -2, 1, -1.5 + n * 0.01, 1.5 };
+        auto tiles = render_tiles(tasks, std::shared_ptr<render_frame>(job, &job->frame), view, settings,
+                                  tile_stream_options{ task_priority::interactive, 4, &equalizer, &channels });
+        while ( tiles.wait_next() ) {}
+        CHECK(tiles.complete());
+        return allocations() - before;
+    };
+    for ( auto equalized : { false, true } ) {
+        settings.equalized = equalized;
+        render(0);
+        auto allocated = std::uint64_t{0};
+        for ( auto n{1}; n < 5; ++n ) { allocated += render(n); }
+        if ( allocated != 0 ) {
+            std::fprintf(stderr, "equalized %d: %" PRIu64 " allocations\n", equalized, allocated);
+        }
+        CHECK(allocated == 0);
+    }
+}
+
+// a stream dropped early stops its render, and the channel it leaves behind is taken again once that's over
+auto test_dropped_stream(task_system & tasks) -> void
+{
+    auto channels = tile_channel_pool();
+    const auto settings = test_settings();
+    const auto view = viewport{ -2, 1, -1.5, 1.5 };
+    for ( auto n{0}; n < 20; ++n ) {
+        auto frame = std::make_shared<render_frame>(256, 256);
+        {
+            auto tiles = render_tiles(tasks, frame, view, settings,
+                                      tile_stream_options{ task_priority::interactive, 4, nullptr, &channels });
+            static_cast<void>(tiles.wait_next());
+        }
+        // the last task of the render lets the frame go
+        while ( frame.use_count() > 1 ) { std::this_thread::yield(); }
+    }
+    // the producer lets the channel go right after the frame
+    CHECK(channels.size() <= 2);
+}
+
+auto main() -> int
+{
+    auto tasks = task_system(4);
+    test_tiles_cover_the_frame(tasks);
+    test_no_allocations_once_warm(tasks);
+    test_dropped_stream(tasks);
+    return test_result();
+}
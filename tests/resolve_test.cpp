@@ -0,0 +1,47 @@
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+
+#include "async_task.hpp"
+#include "check.hpp"
+#include "resolve.hpp"
+
+
+// the weights of every filter add up to 1, so a flat image comes out just as flat whatever the filter and the size,
+// the borders included, and going through linear light and back gives the same 8 bit values
+auto test_constant_image(task_system & tasks) -> void
+{
+    struct size { std::size_t width; std::size_t height; };
+    const auto sizes = { size{ 640, 480 }, size{ 203, 150 }, size{ 37, 5 }, size{ 1, 1 } };
+    const auto resized = { size{ 160, 120 }, size{ 67, 50 }, size{ 8, 3 }, size{ 13, 9 } };
+    for ( auto value : { 0, 1, 37, 128, 200, 254, 255 } ) {
+        const auto color = spl::graphics::rgba{ static_cast<std::uint8_t>(value),
+                                                static_cast<std::uint8_t>(255 - value),
+                                                static_cast<std::uint8_t>(value / 2), 255 };
+        for ( auto from : sizes ) {
+            auto source = spl::graphics::image(from.width, from.height);
+            std::fill_n(source.raw_data(), from.width * from.height, color);
+            for ( auto filter : { resolve_filter::box, resolve_filter::tent, resolve_filter::lanczos } ) {
+                for ( auto to : resized ) {
+                    const auto result = sync_wait(resolve(tasks, source, to.width, to.height, filter));
+                    const auto * px = result.raw_data();
+                    const auto flat = std::all_of(px, px + to.width * to.height, [ & ] ( auto const & p ) {
+                        return p.r == color.r && p.g == color.g && p.b == color.b && p.a == 255;
+                    });
+                    if ( !flat ) {
+                        std::fprintf(stderr, "value %d, %zux%zu to %zux%zu with %s\n", value, from.width, from.height,
+                                     to.width, to.height, resolve_filter_name(filter).data());
+                    }
+                    CHECK(flat);
+                }
+            }
+        }
+    }
+}
+
+auto main() -> int
+{
+    auto tasks = task_system(4);
+    test_constant_image(tasks);
+    return test_result();
+}